@@ -0,0 +1,471 @@
+// Benchmarks for weak_hash_map and concurrent_weak_hash_map, each workload
+// also run against a std::unordered_map keyed by weak_ptr as a baseline.
+//
+// Counters reported next to the timings:
+//   items_per_second  operations completed per second
+//   p99_ns            99th percentile latency of single operations; one
+//                     operation in latency_sampler::period is timed on its own
+//   bytes_per_entry   bytes held through the container's allocator after the
+//                     fill, divided by the number of entries (key objects and
+//                     their control blocks are not included)
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <whm/concurrent_weak_hash_map.hpp>
+#include <whm/weak_hash_map.hpp>
+
+namespace {
+
+struct object {
+    std::uint64_t payload[2] = {};
+};
+
+using value = std::uint64_t;
+
+// ---------------------------------------------------------------------------
+// Allocation accounting
+
+std::atomic<std::size_t> allocated_bytes{0};
+
+template <class T>
+struct counting_allocator {
+    using value_type = T;
+
+    counting_allocator() = default;
+    template <class U>
+    counting_allocator(const counting_allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        allocated_bytes.fetch_add(n * sizeof(T), std::memory_order_relaxed);
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        allocated_bytes.fetch_sub(n * sizeof(T), std::memory_order_relaxed);
+        std::allocator<T>{}.deallocate(p, n);
+    }
+};
+
+template <class T, class U>
+bool operator==(const counting_allocator<T>&, const counting_allocator<U>&) noexcept {
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Latency sampling
+
+class latency_sampler {
+public:
+    static constexpr std::size_t period = 64;
+
+    template <class F>
+    void run(std::size_t i, F&& f) {
+        if (i % period != 0) {
+            f();
+            return;
+        }
+        const auto start = clock::now();
+        f();
+        samples_.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count());
+    }
+
+    // Averaged over threads, so multi-threaded runs report the mean of the
+    // per-thread percentiles.
+    void report(benchmark::State& state) {
+        if (samples_.empty()) {
+            return;
+        }
+        const auto p99 = samples_.begin() + static_cast<std::ptrdiff_t>(samples_.size() * 99 / 100);
+        std::nth_element(samples_.begin(), p99, samples_.end());
+        state.counters["p99_ns"] = benchmark::Counter(*p99, benchmark::Counter::kAvgThreads);
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+    std::vector<double> samples_;
+};
+
+void report_bytes(benchmark::State& state, std::size_t bytes, std::size_t entries) {
+    state.counters["bytes_per_entry"] =
+        benchmark::Counter(static_cast<double>(bytes) / static_cast<double>(entries), benchmark::Counter::kAvgThreads);
+}
+
+// ---------------------------------------------------------------------------
+// Keys
+
+// `live` keys are inserted by the benchmarks, `absent` keys never are.
+// `order` is a random permutation used as the access sequence.
+struct key_set {
+    explicit key_set(std::size_t n) : order(n) {
+        live.reserve(n);
+        absent.reserve(n);
+        for (std::size_t i = 0; i != n; ++i) {
+            live.push_back(std::make_shared<object>());
+            absent.push_back(std::make_shared<object>());
+        }
+        std::iota(order.begin(), order.end(), std::uint32_t{0});
+        std::shuffle(order.begin(), order.end(), std::mt19937_64(n));
+    }
+
+    const std::shared_ptr<object>& live_at(std::size_t i) const { return live[order[i % order.size()]]; }
+    const std::shared_ptr<object>& absent_at(std::size_t i) const { return absent[order[i % order.size()]]; }
+
+    std::vector<std::shared_ptr<object>> live;
+    std::vector<std::shared_ptr<object>> absent;
+    std::vector<std::uint32_t> order;
+};
+
+// Key sets are expensive to build for large n and are shared by every
+// benchmark of that size. Not thread safe: call it from one thread only.
+const key_set& shared_keys(std::size_t n) {
+    static std::map<std::size_t, std::unique_ptr<key_set>> sets;
+    auto& set = sets[n];
+    if (!set) {
+        set = std::make_unique<key_set>(n);
+    }
+    return *set;
+}
+
+// ---------------------------------------------------------------------------
+// Containers under test, behind a common interface
+
+template <class Map>
+struct whm_adapter {
+    void insert(const std::shared_ptr<object>& k, value v) { map.insert_or_assign(k, v); }
+
+    bool find(const std::shared_ptr<object>& k) {
+        auto it = map.find(k);
+        if (it == map.end()) {
+            return false;
+        }
+        benchmark::DoNotOptimize(it->second);
+        return true;
+    }
+
+    void erase(const std::shared_ptr<object>& k) { map.erase(k); }
+    void purge() { map.purge(); }
+
+    Map map;
+};
+
+template <class Sweep>
+using weak_map = whm::weak_hash_map<object, value, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                    counting_allocator<std::pair<const std::weak_ptr<object>, value>>, Sweep>;
+
+using whm_map = whm_adapter<weak_map<whm::no_sweep>>;
+using whm_map_incremental = whm_adapter<weak_map<whm::incremental_sweep<8>>>;
+
+// Baseline: a node-based map keyed by weak_ptr, hashed and compared by the
+// address the weak_ptr was created from, which is what an owner_hash keyed
+// map does for keys that are not aliasing pointers. Lookups are
+// heterogeneous, so like weak_hash_map they take no reference count.
+struct weak_key {
+    std::weak_ptr<object> ptr;
+    const object* address;
+};
+
+struct weak_key_hash {
+    using is_transparent = void;
+    std::size_t operator()(const weak_key& k) const noexcept { return std::hash<const object*>{}(k.address); }
+    std::size_t operator()(const object* p) const noexcept { return std::hash<const object*>{}(p); }
+};
+
+struct weak_key_equal {
+    using is_transparent = void;
+    static const object* address(const weak_key& k) noexcept { return k.address; }
+    static const object* address(const object* p) noexcept { return p; }
+
+    template <class A, class B>
+    bool operator()(const A& a, const B& b) const noexcept {
+        return address(a) == address(b);
+    }
+};
+
+using std_weak_map = std::unordered_map<weak_key, value, weak_key_hash, weak_key_equal,
+                                        counting_allocator<std::pair<const weak_key, value>>>;
+
+struct std_map {
+    void insert(const std::shared_ptr<object>& k, value v) { map.insert_or_assign(weak_key{k, k.get()}, v); }
+
+    bool find(const std::shared_ptr<object>& k) {
+        auto it = map.find(static_cast<const object*>(k.get()));
+        if (it == map.end() || it->first.ptr.expired()) {
+            return false;
+        }
+        benchmark::DoNotOptimize(it->second);
+        return true;
+    }
+
+    void erase(const std::shared_ptr<object>& k) {
+        if (auto it = map.find(static_cast<const object*>(k.get())); it != map.end()) {
+            map.erase(it);
+        }
+    }
+
+    void purge() {
+        std::erase_if(map, [](const auto& entry) { return entry.first.ptr.expired(); });
+    }
+
+    std_weak_map map;
+};
+
+template <class Reads>
+struct concurrent_adapter {
+    void insert(const std::shared_ptr<object>& k, value v) { map.insert_or_assign(k, v); }
+
+    bool find(const std::shared_ptr<object>& k) {
+        const std::optional<value> v = map.find(k);
+        benchmark::DoNotOptimize(v);
+        return v.has_value();
+    }
+
+    void erase(const std::shared_ptr<object>& k) { map.erase(k); }
+    void purge() { map.purge(); }
+
+    whm::concurrent_weak_hash_map<object, value, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                  counting_allocator<std::pair<const std::weak_ptr<object>, value>>, whm::no_sweep,
+                                  Reads>
+        map;
+};
+
+using concurrent_locked = concurrent_adapter<whm::locked_reads>;
+using concurrent_lock_free = concurrent_adapter<whm::lock_free_reads>;
+
+// Baseline for the multi-threaded mixes: the std map behind one shared_mutex.
+struct std_map_shared_mutex {
+    void insert(const std::shared_ptr<object>& k, value v) {
+        std::unique_lock lock(mutex);
+        inner.insert(k, v);
+    }
+
+    bool find(const std::shared_ptr<object>& k) {
+        std::shared_lock lock(mutex);
+        return inner.find(k);
+    }
+
+    void erase(const std::shared_ptr<object>& k) {
+        std::unique_lock lock(mutex);
+        inner.erase(k);
+    }
+
+    void purge() {
+        std::unique_lock lock(mutex);
+        inner.purge();
+    }
+
+    std::shared_mutex mutex;
+    std_map inner;
+};
+
+// Fills `a` with keys.live and returns the bytes it allocated for them.
+template <class Adapter>
+std::size_t fill(Adapter& a, const std::vector<std::shared_ptr<object>>& keys) {
+    const std::size_t before = allocated_bytes.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i != keys.size(); ++i) {
+        a.insert(keys[i], i);
+    }
+    return allocated_bytes.load(std::memory_order_relaxed) - before;
+}
+
+// ---------------------------------------------------------------------------
+// Single-threaded workloads
+
+template <class Adapter>
+void find_hit(benchmark::State& state) {
+    const auto n = static_cast<std::size_t>(state.range(0));
+    const key_set& keys = shared_keys(n);
+    Adapter a;
+    const std::size_t bytes = fill(a, keys.live);
+    latency_sampler latency;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        latency.run(i, [&] { benchmark::DoNotOptimize(a.find(keys.live_at(i))); });
+        ++i;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(i));
+    latency.report(state);
+    report_bytes(state, bytes, n);
+}
+
+template <class Adapter>
+void find_miss(benchmark::State& state) {
+    const auto n = static_cast<std::size_t>(state.range(0));
+    const key_set& keys = shared_keys(n);
+    Adapter a;
+    const std::size_t bytes = fill(a, keys.live);
+    latency_sampler latency;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        latency.run(i, [&] { benchmark::DoNotOptimize(a.find(keys.absent_at(i))); });
+        ++i;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(i));
+    latency.report(state);
+    report_bytes(state, bytes, n);
+}
+
+// Steady-state churn: every operation erases one key and inserts another,
+// keeping n entries. Keys cycle through live and absent in order, so each
+// key is erased n operations after it was inserted.
+template <class Adapter>
+void insert_churn(benchmark::State& state) {
+    const auto n = static_cast<std::size_t>(state.range(0));
+    const key_set& keys = shared_keys(n);
+    std::vector<std::shared_ptr<object>> ring;
+    ring.reserve(2 * n);
+    for (std::size_t i = 0; i != n; ++i) {
+        ring.push_back(keys.live[keys.order[i]]);
+    }
+    for (std::size_t i = 0; i != n; ++i) {
+        ring.push_back(keys.absent[keys.order[i]]);
+    }
+    Adapter a;
+    const std::size_t bytes = fill(a, keys.live);
+    latency_sampler latency;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        latency.run(i, [&] {
+            a.erase(ring[i % ring.size()]);
+            a.insert(ring[(i + n) % ring.size()], i);
+        });
+        ++i;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(i));
+    latency.report(state);
+    report_bytes(state, bytes, n);
+}
+
+// Kills range(1) percent of n keys, then times the container's cleanup plus
+// one lookup of every surviving key. Keys are rebuilt (untimed) for every
+// iteration because the dead ones cannot be revived.
+template <class Adapter>
+void mass_expiry(benchmark::State& state) {
+    const auto n = static_cast<std::size_t>(state.range(0));
+    const auto dead = n * static_cast<std::size_t>(state.range(1)) / 100;
+    latency_sampler latency;
+    std::size_t bytes = 0;
+    std::size_t ops = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto keys = std::make_unique<key_set>(n);
+        auto a = std::make_unique<Adapter>();
+        bytes = fill(*a, keys->live);
+        for (std::size_t i = 0; i != dead; ++i) {
+            keys->live[keys->order[i]].reset();
+        }
+        state.ResumeTiming();
+
+        a->purge();
+        for (std::size_t i = dead; i != n; ++i) {
+            latency.run(ops++, [&] { benchmark::DoNotOptimize(a->find(keys->live[keys->order[i]])); });
+        }
+
+        state.PauseTiming();
+        a.reset();
+        keys.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(ops));
+    latency.report(state);
+    report_bytes(state, bytes, n);
+}
+
+// ---------------------------------------------------------------------------
+// Multi-threaded read/write mix
+
+// range(1) percent of the operations are lookups; the rest overwrite the
+// value of an existing key, so the map keeps n entries.
+template <class Adapter>
+void read_write_mix(benchmark::State& state) {
+    static const key_set* keys = nullptr;
+    static Adapter* shared = nullptr;
+    static std::size_t bytes = 0;
+    const auto n = static_cast<std::size_t>(state.range(0));
+    const auto read_percent = static_cast<std::size_t>(state.range(1));
+    if (state.thread_index() == 0) {
+        keys = &shared_keys(n);
+        shared = new Adapter;
+        bytes = fill(*shared, keys->live);
+    }
+
+    latency_sampler latency;
+    const std::size_t stride = n / static_cast<std::size_t>(state.threads()) + 1;
+    std::size_t i = static_cast<std::size_t>(state.thread_index()) * stride;
+    std::size_t ops = 0;
+    for (auto _ : state) {
+        const auto& key = keys->live_at(i);
+        if ((i * 37) % 100 < read_percent) {
+            latency.run(ops, [&] { benchmark::DoNotOptimize(shared->find(key)); });
+        } else {
+            latency.run(ops, [&] { shared->insert(key, i); });
+        }
+        ++i;
+        ++ops;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(ops));
+    latency.report(state);
+    report_bytes(state, bytes, n);
+
+    if (state.thread_index() == 0) {
+        delete shared;
+        shared = nullptr;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Registration
+
+void sizes(benchmark::internal::Benchmark* b) {
+    b->Arg(1 << 10)->Arg(1 << 14)->Arg(1 << 20);
+}
+
+void expiry_args(benchmark::internal::Benchmark* b) {
+    for (int percent : {10, 50, 90}) {
+        b->Args({1 << 16, percent});
+    }
+}
+
+void mix_args(benchmark::internal::Benchmark* b) {
+    for (int read_percent : {90, 99}) {
+        b->Args({1 << 16, read_percent});
+    }
+    b->ThreadRange(1, 8)->UseRealTime();
+}
+
+BENCHMARK_TEMPLATE(find_hit, whm_map)->Apply(sizes);
+BENCHMARK_TEMPLATE(find_hit, std_map)->Apply(sizes);
+
+BENCHMARK_TEMPLATE(find_miss, whm_map)->Apply(sizes);
+BENCHMARK_TEMPLATE(find_miss, std_map)->Apply(sizes);
+
+BENCHMARK_TEMPLATE(insert_churn, whm_map)->Apply(sizes);
+BENCHMARK_TEMPLATE(insert_churn, whm_map_incremental)->Apply(sizes);
+BENCHMARK_TEMPLATE(insert_churn, std_map)->Apply(sizes);
+
+BENCHMARK_TEMPLATE(mass_expiry, whm_map)->Apply(expiry_args);
+BENCHMARK_TEMPLATE(mass_expiry, std_map)->Apply(expiry_args);
+
+BENCHMARK_TEMPLATE(read_write_mix, concurrent_locked)->Apply(mix_args);
+BENCHMARK_TEMPLATE(read_write_mix, concurrent_lock_free)->Apply(mix_args);
+BENCHMARK_TEMPLATE(read_write_mix, std_map_shared_mutex)->Apply(mix_args);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,401 @@
+// Multi-threaded torture test and contention benchmark for
+// concurrent_weak_hash_map.
+//
+// A table of key slots holds the only owners of the key objects. "Killer"
+// threads keep replacing random slots with fresh objects, so keys die while
+// other threads use them and the allocator hands their addresses to new
+// keys; killers also purge now and then. The remaining threads run a mix of
+// find, insert_or_assign and erase on random slots. Every value is the
+// serial number of the object it was stored for, so a hit that returns
+// another object's value (a stale entry matched through a reused address)
+// is counted as an error. The exit status is non-zero if any run had one.
+//
+// Each thread count is run for a fixed time and reports:
+//   Mops/s            operations completed per second, all threads together
+//   p50/p99/p999_ns   latency percentiles of single operations; one
+//                     operation in sample_period is timed on its own
+//   max_us            slowest timed operation
+//   miss/op           hardware cache misses per operation, counted with
+//                     perf_event_open where the kernel allows it. Contention
+//                     and false sharing show up as coherence misses here;
+//                     --raw-event=0x... counts a model-specific event (e.g.
+//                     a HITM load event) instead.
+//
+//   weak_hash_map_torture [--map=locked|lock_free|all] [--threads=1,2,4,...]
+//                         [--seconds=0.5] [--keys=65536] [--raw-event=0x...]
+//
+// Build with -DWHM_BUILD_TORTURE=ON, and add -DWHM_TORTURE_TSAN=ON to run it
+// under ThreadSanitizer (use a short --seconds and few threads there).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <whm/concurrent_weak_hash_map.hpp>
+
+namespace {
+
+struct object {
+    explicit object(std::uint64_t serial) noexcept : serial(serial) {}
+    std::uint64_t serial;
+};
+
+using value = std::uint64_t;
+
+constexpr std::size_t sample_period = 64;
+
+// ---------------------------------------------------------------------------
+// Options
+
+struct options {
+    std::string map = "all";
+    std::vector<unsigned> threads{1, 2, 4, 8, 16, 32, 64, 128};
+    double seconds = 0.5;
+    std::size_t keys = 1 << 16;
+    std::optional<std::uint64_t> raw_event;
+};
+
+std::vector<unsigned> parse_list(std::string_view s) {
+    std::vector<unsigned> out;
+    while (!s.empty()) {
+        const std::size_t comma = s.find(',');
+        out.push_back(static_cast<unsigned>(std::strtoul(std::string(s.substr(0, comma)).c_str(), nullptr, 10)));
+        s = comma == std::string_view::npos ? std::string_view() : s.substr(comma + 1);
+    }
+    std::erase(out, 0u);
+    return out;
+}
+
+std::optional<options> parse(int argc, char** argv) {
+    options opt;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const std::size_t eq = arg.find('=');
+        const std::string_view name = arg.substr(0, eq);
+        const std::string value(eq == std::string_view::npos ? std::string_view() : arg.substr(eq + 1));
+        if (name == "--map" && (value == "locked" || value == "lock_free" || value == "all")) {
+            opt.map = value;
+        } else if (name == "--threads") {
+            opt.threads = parse_list(value);
+        } else if (name == "--seconds") {
+            opt.seconds = std::strtod(value.c_str(), nullptr);
+        } else if (name == "--keys") {
+            opt.keys = std::max<std::size_t>(std::strtoull(value.c_str(), nullptr, 10), 1);
+        } else if (name == "--raw-event") {
+            opt.raw_event = std::strtoull(value.c_str(), nullptr, 0);
+        } else {
+            std::fprintf(stderr, "unknown or malformed option: %s\n", argv[i]);
+            return std::nullopt;
+        }
+    }
+    if (opt.threads.empty() || opt.seconds <= 0) {
+        std::fprintf(stderr, "--threads needs at least one count and --seconds must be positive\n");
+        return std::nullopt;
+    }
+    return opt;
+}
+
+// ---------------------------------------------------------------------------
+// Hardware counters
+
+// Counts one event over the calling thread and the threads it starts
+// afterwards. valid() is false where perf events are unavailable.
+class perf_counter {
+public:
+    explicit perf_counter(std::optional<std::uint64_t> raw_event) {
+#if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = raw_event ? PERF_TYPE_RAW : PERF_TYPE_HARDWARE;
+        attr.config = raw_event ? *raw_event : static_cast<std::uint64_t>(PERF_COUNT_HW_CACHE_MISSES);
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#else
+        (void)raw_event;
+#endif
+    }
+
+    perf_counter(const perf_counter&) = delete;
+    perf_counter& operator=(const perf_counter&) = delete;
+
+    ~perf_counter() {
+#if defined(__linux__)
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    bool valid() const noexcept { return fd_ >= 0; }
+
+    // Inherited counts are only added in when the threads have exited.
+    std::uint64_t read() const noexcept {
+        std::uint64_t count = 0;
+#if defined(__linux__)
+        if (fd_ < 0 || ::read(fd_, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count))) {
+            return 0;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// ---------------------------------------------------------------------------
+// Workload
+
+struct thread_result {
+    std::uint64_t ops = 0;
+    std::uint64_t kills = 0;
+    std::uint64_t errors = 0;
+    std::vector<double> samples;
+};
+
+struct run_result {
+    unsigned threads = 0;
+    double seconds = 0;
+    std::uint64_t ops = 0;
+    std::uint64_t errors = 0;
+    std::vector<double> samples;
+    std::optional<std::uint64_t> misses;
+};
+
+// The key slots, each behind its own mutex so that killers can replace a
+// key while workers copy it. (libstdc++'s std::atomic<std::shared_ptr> would
+// do, but ThreadSanitizer does not understand its lock bit.)
+class key_table {
+    struct slot {
+        mutable std::mutex mutex;
+        std::shared_ptr<object> key;
+    };
+
+public:
+    explicit key_table(std::size_t n) : slots_(n) {
+        for (slot& s : slots_) {
+            s.key = fresh();
+        }
+    }
+
+    std::size_t size() const noexcept { return slots_.size(); }
+
+    std::shared_ptr<object> get(std::size_t i) const {
+        std::lock_guard lock(slots_[i].mutex);
+        return slots_[i].key;
+    }
+
+    // The old key dies here, outside the slot's lock, unless a worker still
+    // holds it.
+    void replace(std::size_t i) {
+        std::shared_ptr<object> old = fresh();
+        std::lock_guard lock(slots_[i].mutex);
+        slots_[i].key.swap(old);
+    }
+
+private:
+    std::shared_ptr<object> fresh() { return std::make_shared<object>(next_.fetch_add(1, std::memory_order_relaxed)); }
+
+    std::vector<slot> slots_;
+    std::atomic<std::uint64_t> next_{0};
+};
+
+// With `kills`, a tenth of the operations replace a key instead: used when
+// a thread runs alone and has no killer to race with.
+template <class Map>
+void worker(Map& map, key_table& keys, const std::atomic<bool>& stop, std::uint64_t seed, bool kills,
+            thread_result& out) {
+    std::mt19937_64 rng(seed);
+    out.samples.reserve(1 << 16);
+    while (!stop.load(std::memory_order_relaxed)) {
+        const std::uint64_t r = rng();
+        const std::size_t slot = r % keys.size();
+        const unsigned op = static_cast<unsigned>(r >> 56) % 100;
+        auto step = [&] {
+            if (kills && op >= 90) {
+                keys.replace(slot);
+                return;
+            }
+            const std::shared_ptr<object> key = keys.get(slot);
+            if (op < 70) {
+                if (const std::optional<value> v = map.find(key); v && *v != key->serial) {
+                    ++out.errors;
+                }
+            } else if (op < 85) {
+                map.insert_or_assign(key, key->serial);
+            } else {
+                map.erase(key);
+            }
+        };
+        if (out.ops % sample_period == 0) {
+            const auto start = std::chrono::steady_clock::now();
+            step();
+            out.samples.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+        } else {
+            step();
+        }
+        ++out.ops;
+    }
+}
+
+template <class Map>
+void killer(Map& map, key_table& keys, const std::atomic<bool>& stop, std::uint64_t seed, thread_result& out) {
+    std::mt19937_64 rng(seed);
+    while (!stop.load(std::memory_order_relaxed)) {
+        keys.replace(rng() % keys.size());
+        if (++out.kills % 4096 == 0) {
+            map.purge();
+        }
+    }
+}
+
+// One thread in four is a killer. Killers' replacements are not counted as
+// operations.
+template <class Map>
+run_result run(const options& opt, unsigned threads) {
+    Map map;
+    key_table keys(opt.keys);
+    for (std::size_t i = 0; i != keys.size(); ++i) {
+        const std::shared_ptr<object> key = keys.get(i);
+        map.insert_or_assign(key, key->serial);
+    }
+
+    std::vector<thread_result> results(threads);
+    std::atomic<bool> stop{false};
+    std::optional<std::uint64_t> misses;
+    const auto start = std::chrono::steady_clock::now();
+    {
+        // Opened before the threads start so that they inherit it, and read
+        // after they have been joined.
+        perf_counter counter(opt.raw_event);
+        {
+            std::vector<std::jthread> pool;
+            pool.reserve(threads);
+            for (unsigned t = 0; t != threads; ++t) {
+                pool.emplace_back([&, t] {
+                    const std::uint64_t seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+                    if (threads > 1 && t % 4 == 1) {
+                        killer(map, keys, stop, seed, results[t]);
+                    } else {
+                        worker(map, keys, stop, seed, threads == 1, results[t]);
+                    }
+                });
+            }
+            std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+            stop.store(true, std::memory_order_relaxed);
+        }
+        if (counter.valid()) {
+            misses = counter.read();
+        }
+    }
+
+    run_result total;
+    total.threads = threads;
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    total.misses = misses;
+    for (const thread_result& r : results) {
+        total.ops += r.ops;
+        total.errors += r.errors;
+        total.samples.insert(total.samples.end(), r.samples.begin(), r.samples.end());
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------------------
+// Report
+
+double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) {
+        return 0;
+    }
+    const auto at = samples.begin() + static_cast<std::ptrdiff_t>(static_cast<double>(samples.size() - 1) * p);
+    std::nth_element(samples.begin(), at, samples.end());
+    return *at;
+}
+
+void print_header(const char* name) {
+    std::printf("\n%s\n%8s %10s %10s %10s %10s %10s %10s %8s\n", name, "threads", "Mops/s", "p50_ns", "p99_ns",
+                "p999_ns", "max_us", "miss/op", "errors");
+}
+
+void print(run_result& r) {
+    const double max = r.samples.empty() ? 0 : *std::max_element(r.samples.begin(), r.samples.end());
+    char misses[32] = "n/a";
+    if (r.misses && r.ops) {
+        std::snprintf(misses, sizeof(misses), "%.2f", static_cast<double>(*r.misses) / static_cast<double>(r.ops));
+    }
+    std::printf("%8u %10.2f %10.0f %10.0f %10.0f %10.1f %10s %8llu\n", r.threads,
+                static_cast<double>(r.ops) / r.seconds / 1e6, percentile(r.samples, 0.5), percentile(r.samples, 0.99),
+                percentile(r.samples, 0.999), max / 1000, misses, static_cast<unsigned long long>(r.errors));
+}
+
+template <class Map>
+std::uint64_t run_all(const options& opt, const char* name) {
+    print_header(name);
+    std::uint64_t errors = 0;
+    for (unsigned threads : opt.threads) {
+        run_result r = run<Map>(opt, threads);
+        errors += r.errors;
+        print(r);
+        std::fflush(stdout);
+    }
+    return errors;
+}
+
+using locked_map = whm::concurrent_weak_hash_map<object, value, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                                 std::allocator<std::pair<const std::weak_ptr<object>, value>>,
+                                                 whm::incremental_sweep<8>, whm::locked_reads>;
+
+using lock_free_map =
+    whm::concurrent_weak_hash_map<object, value, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                  std::allocator<std::pair<const std::weak_ptr<object>, value>>,
+                                  whm::incremental_sweep<8>, whm::lock_free_reads>;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::optional<options> opt = parse(argc, argv);
+    if (!opt) {
+        return 2;
+    }
+    std::uint64_t errors = 0;
+    if (opt->map != "lock_free") {
+        errors += run_all<locked_map>(*opt, "concurrent_weak_hash_map<locked_reads, incremental_sweep<8>>");
+    }
+    if (opt->map != "locked") {
+        errors += run_all<lock_free_map>(*opt, "concurrent_weak_hash_map<lock_free_reads, incremental_sweep<8>>");
+    }
+    if (errors) {
+        std::printf("\nFAILED: %llu lookups returned another key's value\n", static_cast<unsigned long long>(errors));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+// Monotonic arena and an allocator over it, for short-lived containers such
+// as per-request side tables.
+//
+// Allocation bumps a pointer through chunks obtained from operator new; the
+// allocator's deallocate() does nothing, and release() (or the arena's
+// destructor) returns every chunk at once. Containers stored in the arena
+// still run their element destructors, which for weak_hash_map releases the
+// weak references, but free no memory of their own.
+//
+//   whm::arena request_arena;
+//   whm::weak_hash_map<Object, Tag, whm::pointer_hash<Object>, whm::pointer_equal<Object>,
+//                      whm::arena_allocator<std::pair<const std::weak_ptr<Object>, Tag>>>
+//       tags(whm::arena_allocator<std::pair<const std::weak_ptr<Object>, Tag>>(request_arena));
+//
+// An arena is not thread safe; containers shared between threads need an
+// allocator of their own. Any std::pmr::memory_resource, pool resources
+// included, can be used instead through std::pmr::polymorphic_allocator.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace whm {
+
+class arena {
+public:
+    static constexpr std::size_t default_chunk_size = 4096;
+
+    // The first chunk holds `initial_chunk_size` bytes; each further chunk is
+    // twice the size of the previous one, or larger if a request needs it.
+    explicit arena(std::size_t initial_chunk_size = default_chunk_size) noexcept
+        : next_chunk_size_(std::max(initial_chunk_size, sizeof(chunk))) {}
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    ~arena() { release(); }
+
+    void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+        if (void* p = bump(bytes, alignment)) {
+            return p;
+        }
+        add_chunk(bytes + alignment);
+        return bump(bytes, alignment);
+    }
+
+    // Frees every chunk. Everything allocated from the arena is invalidated.
+    void release() noexcept {
+        while (chunks_) {
+            chunk* next = chunks_->next;
+            ::operator delete(static_cast<void*>(chunks_));
+            chunks_ = next;
+        }
+        cursor_ = nullptr;
+        end_ = nullptr;
+        reserved_ = 0;
+    }
+
+    // Total size of the chunks obtained so far.
+    std::size_t bytes_reserved() const noexcept { return reserved_; }
+
+private:
+    struct chunk {
+        chunk* next;
+    };
+
+    void* bump(std::size_t bytes, std::size_t alignment) noexcept {
+        if (cursor_ == nullptr) {
+            return nullptr;
+        }
+        const std::uintptr_t start = (reinterpret_cast<std::uintptr_t>(cursor_) + alignment - 1) & ~(alignment - 1);
+        if (start > reinterpret_cast<std::uintptr_t>(end_) ||
+            bytes > reinterpret_cast<std::uintptr_t>(end_) - start) {
+            return nullptr;
+        }
+        cursor_ = reinterpret_cast<char*>(start + bytes);
+        return reinterpret_cast<void*>(start);
+    }
+
+    void add_chunk(std::size_t min_bytes) {
+        const std::size_t size = std::max(next_chunk_size_, min_bytes + sizeof(chunk));
+        void* mem = ::operator new(size);
+        chunks_ = ::new (mem) chunk{chunks_};
+        cursor_ = static_cast<char*>(mem) + sizeof(chunk);
+        end_ = static_cast<char*>(mem) + size;
+        reserved_ += size;
+        next_chunk_size_ = size * 2;
+    }
+
+    chunk* chunks_ = nullptr;
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+    std::size_t next_chunk_size_;
+    std::size_t reserved_ = 0;
+};
+
+// Allocator drawing from an arena. Copies, rebinds and the containers they
+// are moved or swapped into all share the arena, which must outlive them.
+template <class T>
+class arena_allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit arena_allocator(arena& a) noexcept : arena_(&a) {}
+
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other) noexcept : arena_(other.arena_) {}
+
+    T* allocate(std::size_t n) {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) noexcept {}
+
+    arena& resource() const noexcept { return *arena_; }
+
+    template <class U>
+    friend bool operator==(const arena_allocator& a, const arena_allocator<U>& b) noexcept {
+        return &a.resource() == &b.resource();
+    }
+
+private:
+    template <class U>
+    friend class arena_allocator;
+
+    arena* arena_;
+};
+
+}  // namespace whm
@@ -0,0 +1,356 @@
+#pragma once
+
+// concurrent_weak_hash_map: a weak_hash_map split into independently locked
+// shards.
+//
+// The key hash picks the shard from its top bits; each shard owns its lock
+// and table on cache lines of its own, so threads working on different
+// shards share no memory. Writers lock their shard exclusively, and
+// expired-entry sweeps (the Sweep policy, purge()) run one shard at a time.
+//
+// The Reads policy selects how lookups synchronise:
+//   locked_reads     shared lock on the shard; entries stored inline. A
+//                    shard grows or rehashes in one rebuild under its
+//                    exclusive lock, and its readers wait for the rebuild.
+//   lock_free_reads  no lock at all: readers pin an epoch and probe a table
+//                    of immutable entries. A hit needs no weak_ptr::lock().
+//                    Updates publish a copy of the entry, so values must be
+//                    copy constructible. Large shards grow by migrating a
+//                    few groups per write, and readers never wait for it.
+//                    Suited to read-mostly maps.
+//
+// References into the map cannot outlive the synchronisation, so the
+// interface is value based: find() returns a copy, visit() runs a callback.
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "detail/parallel.hpp"
+#include "detail/shards.hpp"
+#include "policy.hpp"
+#include "weak_hash_map.hpp"
+
+namespace whm {
+
+struct locked_reads {
+    template <class K, class V, class Hash, class KeyEqual, class Alloc, class Sweep, class... MapPolicies>
+    using shard = detail::locked_shard<K, V, Hash, KeyEqual, Alloc, Sweep, MapPolicies...>;
+};
+
+struct lock_free_reads {
+    template <class K, class V, class Hash, class KeyEqual, class Alloc, class Sweep, class... MapPolicies>
+    using shard = detail::lock_free_shard<K, V, Hash, KeyEqual, Alloc, Sweep, MapPolicies...>;
+};
+
+// With locked_reads, `MapPolicies` are passed on to the weak_hash_map of
+// each shard after Sweep (Resize, Stats, Layout).
+template <class K, class V, class Hash = pointer_hash<K>, class KeyEqual = pointer_equal<K>,
+          class Alloc = std::allocator<std::pair<const std::weak_ptr<K>, V>>, class Sweep = no_sweep,
+          class Reads = locked_reads, class... MapPolicies>
+class concurrent_weak_hash_map {
+    static_assert(!std::is_same_v<Sweep, tracked_sweep>,
+                  "concurrent_weak_hash_map has no make_tracked(): Sweep must not be tracked_sweep");
+
+    using shard = typename Reads::template shard<K, V, Hash, KeyEqual, Alloc, Sweep, MapPolicies...>;
+
+public:
+    using key_type = std::weak_ptr<K>;
+    using element_type = K;
+    using mapped_type = V;
+    using size_type = std::size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Alloc;
+    using sweep_policy = Sweep;
+    using read_policy = Reads;
+
+    static constexpr size_type default_shard_count = 64;
+
+    // `shard_count` is rounded up to a power of two.
+    explicit concurrent_weak_hash_map(size_type shard_count = default_shard_count, const Hash& hash = Hash(),
+                                      const KeyEqual& eq = KeyEqual(), const Alloc& alloc = Alloc())
+        : shard_bits_(std::countr_zero(std::bit_ceil(std::max<size_type>(shard_count, 1)))),
+          shards_(make_shards(size_type{1} << shard_bits_, hash, eq, alloc)),
+          hash_(hash),
+          alloc_(alloc) {}
+
+    concurrent_weak_hash_map(const concurrent_weak_hash_map&) = delete;
+    concurrent_weak_hash_map& operator=(const concurrent_weak_hash_map&) = delete;
+
+    ~concurrent_weak_hash_map() {
+        for (size_type i = shard_count(); i != 0; --i) {
+            shards_[i - 1].~shard();
+        }
+        shard_alloc alloc(alloc_);
+        std::allocator_traits<shard_alloc>::deallocate(alloc, shards_, shard_count());
+    }
+
+    size_type shard_count() const noexcept { return size_type{1} << shard_bits_; }
+
+    // Sum of the shard sizes; entries may be added or removed concurrently
+    // while the total is computed.
+    size_type size() const {
+        size_type total = 0;
+        for (size_type i = 0; i != shard_count(); ++i) {
+            total += shards_[i].size();
+        }
+        return total;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    void clear() {
+        for (size_type i = 0; i != shard_count(); ++i) {
+            shards_[i].clear();
+        }
+    }
+
+    // Reserves room for `n` entries spread evenly over the shards.
+    void reserve(size_type n) {
+        const size_type per_shard = (n + shard_count() - 1) / shard_count();
+        for (size_type i = 0; i != shard_count(); ++i) {
+            shards_[i].reserve(per_shard);
+        }
+    }
+
+    // Rebuilds every shard for its share of max(n, size()) entries.
+    void rehash(size_type n) {
+        const size_type per_shard = (n + shard_count() - 1) / shard_count();
+        for (size_type i = 0; i != shard_count(); ++i) {
+            shards_[i].rehash(per_shard);
+        }
+    }
+
+    // Removes every expired entry, locking one shard at a time.
+    size_type purge() {
+        size_type removed = 0;
+        for (size_type i = 0; i != shard_count(); ++i) {
+            removed += shards_[i].purge();
+        }
+        return removed;
+    }
+
+    // purge() and rehash() with one task per shard on `ex`, any callable
+    // that runs the task it is given once, on some thread (see
+    // detail/parallel.hpp). Each task locks only its own shard. They return
+    // when all tasks are done.
+    template <detail::executor Executor>
+    size_type purge(Executor&& ex) {
+        std::atomic<size_type> removed{0};
+        auto task = [this, &removed](size_type i) {
+            removed.fetch_add(shards_[i].purge(), std::memory_order_relaxed);
+        };
+        detail::parallel_for(ex, shard_count(), task);
+        return removed.load(std::memory_order_relaxed);
+    }
+
+    template <detail::executor Executor>
+    void rehash(size_type n, Executor&& ex) {
+        const size_type per_shard = (n + shard_count() - 1) / shard_count();
+        auto task = [this, per_shard](size_type i) { shards_[i].rehash(per_shard); };
+        detail::parallel_for(ex, shard_count(), task);
+    }
+
+    // Purges shard `i` unless its lock is taken, in which case it returns
+    // nullopt without waiting. Used by weak_hash_map_reaper.
+    std::optional<size_type> try_purge_shard(size_type i) {
+        assert(i < shard_count());
+        return shards_[i].try_purge();
+    }
+
+    template <class... Args>
+    bool try_emplace(const std::shared_ptr<K>& key, Args&&... args) {
+        const size_type hash = hash_(key.get());
+        return shard_for(hash).try_emplace(hash, key, std::forward<Args>(args)...);
+    }
+
+    bool insert(const std::shared_ptr<K>& key, const V& value) { return try_emplace(key, value); }
+    bool insert(const std::shared_ptr<K>& key, V&& value) { return try_emplace(key, std::move(value)); }
+
+    template <class M>
+    bool insert_or_assign(const std::shared_ptr<K>& key, M&& value) {
+        const size_type hash = hash_(key.get());
+        return shard_for(hash).insert_or_assign(hash, key, std::forward<M>(value));
+    }
+
+    // Lookups accept the key as a raw pointer, a shared_ptr or a weak_ptr to
+    // K or a class derived from it, as in weak_hash_map; only a weak_ptr
+    // argument is locked.
+
+    // Copy of the value mapped to `p`, if any.
+    std::optional<V> find(const K* p) const {
+        const size_type hash = hash_(p);
+        return shard_for(hash).find(hash, p);
+    }
+
+    template <detail::pointer_to<K> U>
+    std::optional<V> find(const std::shared_ptr<U>& key) const {
+        return find(static_cast<const K*>(key.get()));
+    }
+
+    template <detail::pointer_to<K> U>
+    std::optional<V> find(const std::weak_ptr<U>& key) const {
+        return find(key.lock());
+    }
+
+    bool contains(const K* p) const {
+        const size_type hash = hash_(p);
+        return shard_for(hash).contains(hash, p);
+    }
+
+    template <detail::pointer_to<K> U>
+    bool contains(const std::shared_ptr<U>& key) const {
+        return contains(static_cast<const K*>(key.get()));
+    }
+
+    template <detail::pointer_to<K> U>
+    bool contains(const std::weak_ptr<U>& key) const {
+        return contains(key.lock());
+    }
+
+    // Calls `f(value)` if `p` is present. The non-const overload may
+    // modify the value and excludes other writers of the shard; the const
+    // overload runs alongside other readers.
+    template <class F>
+    bool visit(const K* p, F&& f) {
+        const size_type hash = hash_(p);
+        return shard_for(hash).visit(hash, p, std::forward<F>(f));
+    }
+
+    template <class F>
+    bool visit(const K* p, F&& f) const {
+        const size_type hash = hash_(p);
+        return shard_for(hash).visit(hash, p, std::forward<F>(f));
+    }
+
+    template <detail::pointer_to<K> U, class F>
+    bool visit(const std::shared_ptr<U>& key, F&& f) {
+        return visit(static_cast<const K*>(key.get()), std::forward<F>(f));
+    }
+
+    template <detail::pointer_to<K> U, class F>
+    bool visit(const std::shared_ptr<U>& key, F&& f) const {
+        return visit(static_cast<const K*>(key.get()), std::forward<F>(f));
+    }
+
+    size_type erase(const K* p) {
+        const size_type hash = hash_(p);
+        return shard_for(hash).erase(hash, p);
+    }
+
+    template <detail::pointer_to<K> U>
+    size_type erase(const std::shared_ptr<U>& key) {
+        return erase(static_cast<const K*>(key.get()));
+    }
+
+    template <detail::pointer_to<K> U>
+    size_type erase(const std::weak_ptr<U>& key) {
+        return erase(key.lock());
+    }
+
+    // Calls `f(key, value)` for every stored entry, one shard at a time.
+    // Expired entries are included; check key.expired().
+    template <class F>
+    void for_each(F&& f) const {
+        for (size_type i = 0; i != shard_count(); ++i) {
+            shards_[i].for_each(f);
+        }
+    }
+
+    // The live entries, keys pinned and values copied, in one contiguous
+    // vector. Each shard is copied under its own lock, held only for its own
+    // pass, so the result is consistent per shard but not across shards.
+    std::vector<std::pair<std::shared_ptr<K>, V>> snapshot_live() const {
+        std::vector<snapshot_part> parts(shard_count());
+        for (size_type i = 0; i != shard_count(); ++i) {
+            parts[i] = shards_[i].snapshot_live();
+        }
+        return join_parts(parts);
+    }
+
+    // The same, with one task per shard on `ex` as for purge(ex).
+    template <detail::executor Executor>
+    std::vector<std::pair<std::shared_ptr<K>, V>> snapshot_live(Executor&& ex) const {
+        std::vector<snapshot_part> parts(shard_count());
+        auto task = [this, &parts](size_type i) { parts[i] = shards_[i].snapshot_live(); };
+        detail::parallel_for(ex, shard_count(), task);
+        return join_parts(parts);
+    }
+
+    // Sum of the shards' stats, with locked_reads and a collecting Stats
+    // policy among MapPolicies. Shards are read one at a time.
+    table_stats stats() const
+        requires requires(const shard& s) { s.stats(); }
+    {
+        table_stats total;
+        for (size_type i = 0; i != shard_count(); ++i) {
+            total += shards_[i].stats();
+        }
+        return total;
+    }
+
+    hasher hash_function() const { return hash_; }
+
+private:
+    using shard_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<shard>;
+
+    static shard* make_shards(size_type n, const Hash& hash, const KeyEqual& eq, const Alloc& alloc) {
+        shard_alloc salloc(alloc);
+        shard* shards = std::to_address(std::allocator_traits<shard_alloc>::allocate(salloc, n));
+        size_type built = 0;
+        try {
+            for (; built != n; ++built) {
+                ::new (static_cast<void*>(shards + built)) shard(hash, eq, alloc);
+            }
+        } catch (...) {
+            while (built) {
+                shards[--built].~shard();
+            }
+            std::allocator_traits<shard_alloc>::deallocate(salloc, shards, n);
+            throw;
+        }
+        return shards;
+    }
+
+    // Shard snapshots, concatenated in shard order.
+    using snapshot_part = decltype(std::declval<const shard&>().snapshot_live());
+
+    static std::vector<std::pair<std::shared_ptr<K>, V>> join_parts(std::vector<snapshot_part>& parts) {
+        size_type total = 0;
+        for (const snapshot_part& p : parts) {
+            total += p.size();
+        }
+        std::vector<std::pair<std::shared_ptr<K>, V>> out;
+        out.reserve(total);
+        for (snapshot_part& p : parts) {
+            std::move(p.begin(), p.end(), std::back_inserter(out));
+        }
+        return out;
+    }
+
+    shard& shard_for(size_type hash) noexcept { return shards_[shard_index(hash)]; }
+    const shard& shard_for(size_type hash) const noexcept { return shards_[shard_index(hash)]; }
+
+    // The inner tables index with the low bits of the hash, so the shard is
+    // chosen from the high bits to keep the two independent.
+    size_type shard_index(size_type hash) const noexcept {
+        return std::rotl(hash, static_cast<int>(shard_bits_)) & (shard_count() - 1);
+    }
+
+    size_type shard_bits_;
+    shard* shards_;
+    [[no_unique_address]] Hash hash_;
+    [[no_unique_address]] Alloc alloc_;
+};
+
+}  // namespace whm
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+// Marks the functions of the non-template core (see table_core.hpp): inline
+// by default, compiled once into weak_hash_map_core with WHM_SEPARATE_CORE.
+#if defined(WHM_SEPARATE_CORE)
+#define WHM_CORE_API
+#else
+#define WHM_CORE_API inline
+#endif
+
+namespace whm::detail {
+
+// Alignment used to keep independently written state on separate cache lines.
+// std::hardware_destructive_interference_size is not usable in headers
+// without ABI warnings, so spell it out.
+#if defined(__aarch64__) && defined(__APPLE__)
+inline constexpr std::size_t cache_line_size = 128;
+#else
+inline constexpr std::size_t cache_line_size = 64;
+#endif
+
+// Hint that `p` is about to be read. A no-op where no prefetch is available.
+inline void prefetch(const void* p) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p, 0, 3);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+    (void)p;
+#endif
+}
+
+}  // namespace whm::detail
@@ -0,0 +1,211 @@
+#pragma once
+
+// Epoch-based reclamation for structures that are read without locks.
+//
+// A reader pins the current global epoch for the duration of a lookup; a
+// writer that unlinks an object retires it instead of freeing it. An object
+// retired in epoch e is freed once the global epoch reaches e + 2: advancing
+// requires every pinned reader to have observed the latest epoch, so by
+// then no reader can still hold a reference obtained before the unlink.
+//
+// Pinning writes only to the calling thread's own record, which sits on a
+// cache line of its own; readers never write to memory shared with other
+// readers.
+//
+// Ordering is carried by read-modify-write operations rather than fences:
+// retiring joins the release sequence of the epoch counter and the advance
+// scan reads each record with an RMW, so every edge the proof needs is an
+// acquire/release pair (which also keeps ThreadSanitizer precise).
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+
+namespace whm::detail {
+
+class epoch_domain {
+public:
+    struct alignas(cache_line_size) record {
+        std::atomic<std::uint64_t> local{0};  // 0 when not pinned
+        std::atomic<bool> in_use{false};
+        record* next = nullptr;
+        unsigned depth = 0;  // nesting of guards on the owning thread
+    };
+
+    // Pins the epoch for the lifetime of the guard. Nested guards on one
+    // thread are cheap and only the outermost one publishes.
+    class guard {
+    public:
+        explicit guard(epoch_domain& domain) noexcept : record_(domain.thread_record()) {
+            if (record_->depth++ == 0) {
+                record_->local.exchange(domain.epoch_.load(std::memory_order_acquire), std::memory_order_acq_rel);
+            }
+        }
+
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+
+        ~guard() {
+            if (--record_->depth == 0) {
+                record_->local.store(0, std::memory_order_release);
+            }
+        }
+
+    private:
+        record* record_;
+    };
+
+    epoch_domain() = default;
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+
+    ~epoch_domain() {
+        for (record* r = records_.load(std::memory_order_acquire); r;) {
+            delete std::exchange(r, r->next);
+        }
+    }
+
+    // Process-wide domain. Leaked on purpose: threads may still release
+    // their records during static destruction.
+    static epoch_domain& global() {
+        static epoch_domain* domain = new epoch_domain;
+        return *domain;
+    }
+
+    // Epoch to tag an object unlinked just before the call. The RMW orders
+    // the unlink before any later advance of the epoch.
+    std::uint64_t retire_epoch() noexcept { return epoch_.fetch_add(0, std::memory_order_acq_rel); }
+
+    std::uint64_t current() const noexcept { return epoch_.load(std::memory_order_acquire); }
+
+    // Moves the global epoch forward if every pinned reader has seen the
+    // current one. Returns the (possibly new) current epoch.
+    std::uint64_t try_advance() noexcept {
+        const std::uint64_t e = epoch_.load(std::memory_order_acquire);
+        for (record* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+            const std::uint64_t local = r->local.fetch_add(0, std::memory_order_acq_rel);
+            if (local != 0 && local != e) {
+                return e;
+            }
+        }
+        std::uint64_t expected = e;
+        if (epoch_.compare_exchange_strong(expected, e + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return e + 1;
+        }
+        return expected;
+    }
+
+private:
+    struct thread_slot {
+        ~thread_slot() {
+            for (auto& [domain, rec] : records) {
+                rec->in_use.store(false, std::memory_order_release);
+            }
+        }
+        std::vector<std::pair<epoch_domain*, record*>> records;
+    };
+
+    record* thread_record() {
+        thread_local thread_slot slot;
+        for (auto& [domain, rec] : slot.records) {
+            if (domain == this) {
+                return rec;
+            }
+        }
+        record* rec = acquire_record();
+        slot.records.emplace_back(this, rec);
+        return rec;
+    }
+
+    // Reuses a record released by an exited thread, or links a new one.
+    // Records are never unlinked, so readers of the list need no protection.
+    record* acquire_record() {
+        for (record* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+            bool expected = false;
+            if (!r->in_use.load(std::memory_order_relaxed) &&
+                r->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return r;
+            }
+        }
+        record* r = new record;
+        r->in_use.store(true, std::memory_order_relaxed);
+        r->next = records_.load(std::memory_order_relaxed);
+        while (!records_.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return r;
+    }
+
+    std::atomic<std::uint64_t> epoch_{1};
+    std::atomic<record*> records_{nullptr};
+};
+
+// Objects retired by one writer (callers serialise access, e.g. under a shard
+// lock), each freed once the domain's epoch has moved two steps past the
+// epoch it was retired in. The pending list is stored through `Alloc`.
+template <class Alloc = std::allocator<void>>
+class retire_list {
+public:
+    using deleter_type = void (*)(void* object, void* context) noexcept;
+
+    retire_list() = default;
+    explicit retire_list(const Alloc& alloc) : pending_(item_alloc(alloc)) {}
+    retire_list(const retire_list&) = delete;
+    retire_list& operator=(const retire_list&) = delete;
+
+    // Frees everything. Only valid once no reader can reach the objects.
+    ~retire_list() { drain(); }
+
+    void retire(epoch_domain& domain, void* object, deleter_type deleter, void* context) {
+        pending_.push_back({object, deleter, context, domain.retire_epoch()});
+    }
+
+    bool empty() const noexcept { return pending_.empty(); }
+    std::size_t size() const noexcept { return pending_.size(); }
+
+    // Frees the objects that no reader can reach any more. Trying to advance
+    // the epoch scans every reader record, so that only happens once a batch
+    // of objects is pending; smaller lists rely on other writers advancing.
+    void reclaim(epoch_domain& domain) noexcept {
+        if (pending_.empty()) {
+            return;
+        }
+        const std::uint64_t e = pending_.size() >= advance_batch ? domain.try_advance() : domain.current();
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i != pending_.size(); ++i) {
+            if (pending_[i].epoch + 2 <= e) {
+                pending_[i].deleter(pending_[i].object, pending_[i].context);
+            } else {
+                pending_[kept++] = pending_[i];
+            }
+        }
+        pending_.resize(kept);
+    }
+
+    void drain() noexcept {
+        for (auto& item : pending_) {
+            item.deleter(item.object, item.context);
+        }
+        pending_.clear();
+    }
+
+private:
+    static constexpr std::size_t advance_batch = 32;
+
+    struct item {
+        void* object;
+        deleter_type deleter;
+        void* context;
+        std::uint64_t epoch;
+    };
+
+    using item_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<item>;
+
+    std::vector<item, item_alloc> pending_;
+};
+
+}  // namespace whm::detail
@@ -0,0 +1,84 @@
+#pragma once
+
+// Death notifications for keys created by a container's make_tracked().
+//
+// The deleter of a tracked object pushes a node naming the object onto the
+// container's expiry_queue. Pushes may come from any thread; the container
+// drains the queue from inside its own (externally synchronised) operations
+// and erases the matching entries directly, without scanning.
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace whm::detail {
+
+struct expiry_node {
+    expiry_node* next = nullptr;
+    const void* address = nullptr;  // object address as cached in the slot
+    std::size_t hash = 0;           // hash of that address in the owning table
+};
+
+// Multi-producer, single-consumer stack. The consumer always takes the whole
+// list at once, so pops never race with each other and there is no ABA.
+class expiry_queue {
+public:
+    expiry_queue() = default;
+    expiry_queue(const expiry_queue&) = delete;
+    expiry_queue& operator=(const expiry_queue&) = delete;
+
+    ~expiry_queue() { free_list(head_.load(std::memory_order_acquire)); }
+
+    void push(expiry_node* node) noexcept {
+        node->next = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    // Detaches every pending node. The caller owns the returned list.
+    expiry_node* take_all() noexcept {
+        if (head_.load(std::memory_order_relaxed) == nullptr) {
+            return nullptr;
+        }
+        return head_.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    // Nodes pushed and not yet taken. Only the consumer may call this: nodes
+    // are freed by nobody else, so the list it walks stays intact.
+    std::size_t pending() const noexcept {
+        std::size_t n = 0;
+        for (const expiry_node* node = head_.load(std::memory_order_acquire); node; node = node->next) {
+            ++n;
+        }
+        return n;
+    }
+
+    static void free_list(expiry_node* node) noexcept {
+        while (node) {
+            delete std::exchange(node, node->next);
+        }
+    }
+
+private:
+    std::atomic<expiry_node*> head_{nullptr};
+};
+
+// Deleter installed by make_tracked(). The node is allocated together with
+// the object so that the death path never allocates; if the container is
+// gone by then, the unique_ptr frees the node.
+template <class T>
+struct tracked_deleter {
+    void operator()(T* p) noexcept {
+        delete p;
+        if (auto q = queue.lock()) {
+            q->push(node.release());
+        }
+    }
+
+    std::weak_ptr<expiry_queue> queue;
+    std::unique_ptr<expiry_node> node;
+};
+
+}  // namespace whm::detail
@@ -0,0 +1,260 @@
+#pragma once
+
+// Control bytes and group probing for the flat table.
+//
+// Every slot of a raw_table has one control byte. A full slot stores the low
+// seven bits of its hash (h2); the special values below mark empty slots,
+// tombstones and the end of the array. Lookups compare a whole group of
+// control bytes against h2 at once and only touch the slots that match.
+//
+// The group implementation is chosen at compile time from the target:
+// AVX2 (32 bytes), SSE2 (16 bytes), else portable 64-bit arithmetic
+// (8 bytes), which is also what ARM targets use. Define WHM_NO_SIMD to force
+// the portable one. The choice is part of the table layout, so every
+// translation unit of a program must be built with the same one.
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if !defined(WHM_NO_SIMD)
+#if defined(__AVX2__)
+#define WHM_GROUP_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WHM_GROUP_SSE2 1
+#include <emmintrin.h>
+#endif
+#endif
+
+namespace whm::detail {
+
+using ctrl_t = std::int8_t;
+using h2_t = std::uint8_t;
+
+inline constexpr ctrl_t ctrl_empty = -128;   // 0b10000000
+inline constexpr ctrl_t ctrl_deleted = -2;   // 0b11111110
+inline constexpr ctrl_t ctrl_sentinel = -1;  // 0b11111111
+
+constexpr bool is_full(ctrl_t c) noexcept { return c >= 0; }
+constexpr bool is_empty(ctrl_t c) noexcept { return c == ctrl_empty; }
+constexpr bool is_deleted(ctrl_t c) noexcept { return c == ctrl_deleted; }
+constexpr bool is_empty_or_deleted(ctrl_t c) noexcept { return c < ctrl_sentinel; }
+
+// Position part of the hash.
+constexpr std::size_t h1(std::size_t hash) noexcept { return hash >> 7; }
+
+// Fingerprint stored in the control byte of a full slot.
+constexpr h2_t h2(std::size_t hash) noexcept { return static_cast<h2_t>(hash & 0x7F); }
+
+// Set of slot positions inside a group. Each position occupies 1 << Shift
+// bits of the underlying integer; only the top bit of a position is set.
+template <class T, int Significant, int Shift = 0>
+class bitmask {
+public:
+    constexpr explicit bitmask(T mask) noexcept : mask_(mask) {}
+
+    constexpr bitmask& operator++() noexcept {
+        mask_ &= mask_ - 1;
+        return *this;
+    }
+
+    constexpr explicit operator bool() const noexcept { return mask_ != 0; }
+    constexpr unsigned operator*() const noexcept { return lowest_bit_set(); }
+
+    constexpr unsigned lowest_bit_set() const noexcept { return trailing_zeros(); }
+
+    constexpr unsigned trailing_zeros() const noexcept {
+        return static_cast<unsigned>(std::countr_zero(mask_)) >> Shift;
+    }
+
+    constexpr unsigned leading_zeros() const noexcept {
+        constexpr int total_significant_bits = Significant << Shift;
+        constexpr int extra_bits = static_cast<int>(sizeof(T) * 8) - total_significant_bits;
+        return static_cast<unsigned>(std::countl_zero(static_cast<T>(mask_ << extra_bits))) >> Shift;
+    }
+
+    constexpr bitmask begin() const noexcept { return *this; }
+    constexpr bitmask end() const noexcept { return bitmask(0); }
+
+    friend constexpr bool operator==(const bitmask& a, const bitmask& b) noexcept {
+        return a.mask_ == b.mask_;
+    }
+
+private:
+    T mask_;
+};
+
+// Eight control bytes matched with plain 64-bit arithmetic. Works on every
+// target; match() may report false positives, which the caller's key
+// comparison filters out.
+struct group_portable {
+    static constexpr std::size_t width = 8;
+    using mask_type = bitmask<std::uint64_t, 8, 3>;
+
+    explicit group_portable(const ctrl_t* pos) noexcept {
+        std::memcpy(&ctrl, pos, sizeof(ctrl));
+        if constexpr (std::endian::native == std::endian::big) {
+            ctrl = __builtin_bswap64(ctrl);
+        }
+    }
+
+    mask_type match(h2_t hash) const noexcept {
+        constexpr std::uint64_t msbs = 0x8080808080808080ULL;
+        constexpr std::uint64_t lsbs = 0x0101010101010101ULL;
+        const std::uint64_t x = ctrl ^ (lsbs * hash);
+        return mask_type((x - lsbs) & ~x & msbs);
+    }
+
+    mask_type match_empty() const noexcept {
+        constexpr std::uint64_t msbs = 0x8080808080808080ULL;
+        return mask_type((ctrl & (~ctrl << 6)) & msbs);
+    }
+
+    mask_type match_empty_or_deleted() const noexcept {
+        constexpr std::uint64_t msbs = 0x8080808080808080ULL;
+        return mask_type((ctrl & (~ctrl << 7)) & msbs);
+    }
+
+    std::uint64_t ctrl;
+};
+
+#if defined(WHM_GROUP_SSE2) || defined(WHM_GROUP_AVX2)
+// Sixteen control bytes per SSE2 compare; movemask yields one bit per byte.
+struct group_sse2 {
+    static constexpr std::size_t width = 16;
+    using mask_type = bitmask<std::uint32_t, 16>;
+
+    explicit group_sse2(const ctrl_t* pos) noexcept
+        : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+    mask_type match(h2_t hash) const noexcept {
+        return to_mask(_mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(hash)), ctrl));
+    }
+
+    mask_type match_empty() const noexcept { return to_mask(_mm_cmpeq_epi8(_mm_set1_epi8(ctrl_empty), ctrl)); }
+
+    mask_type match_empty_or_deleted() const noexcept {
+        return to_mask(_mm_cmpgt_epi8(_mm_set1_epi8(ctrl_sentinel), ctrl));
+    }
+
+    static mask_type to_mask(__m128i bytes) noexcept {
+        return mask_type(static_cast<std::uint32_t>(_mm_movemask_epi8(bytes)));
+    }
+
+    __m128i ctrl;
+};
+#endif
+
+#if defined(WHM_GROUP_AVX2)
+// Thirty-two control bytes per AVX2 compare. Fewer probe steps on long
+// chains at the cost of a wider window per step.
+struct group_avx2 {
+    static constexpr std::size_t width = 32;
+    using mask_type = bitmask<std::uint32_t, 32>;
+
+    explicit group_avx2(const ctrl_t* pos) noexcept
+        : ctrl(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos))) {}
+
+    mask_type match(h2_t hash) const noexcept {
+        return to_mask(_mm256_cmpeq_epi8(_mm256_set1_epi8(static_cast<char>(hash)), ctrl));
+    }
+
+    mask_type match_empty() const noexcept {
+        return to_mask(_mm256_cmpeq_epi8(_mm256_set1_epi8(ctrl_empty), ctrl));
+    }
+
+    mask_type match_empty_or_deleted() const noexcept {
+        return to_mask(_mm256_cmpgt_epi8(_mm256_set1_epi8(ctrl_sentinel), ctrl));
+    }
+
+    static mask_type to_mask(__m256i bytes) noexcept {
+        return mask_type(static_cast<std::uint32_t>(_mm256_movemask_epi8(bytes)));
+    }
+
+    __m256i ctrl;
+};
+#endif
+
+#if defined(WHM_GROUP_AVX2)
+using group = group_avx2;
+#elif defined(WHM_GROUP_SSE2)
+using group = group_sse2;
+#else
+using group = group_portable;
+#endif
+
+// Triangular probing over groups. Visits every group exactly once when the
+// capacity is a power of two minus one.
+class probe_seq {
+public:
+    probe_seq(std::size_t hash, std::size_t mask) noexcept : mask_(mask), offset_(hash & mask) {}
+
+    std::size_t offset() const noexcept { return offset_; }
+    std::size_t offset(std::size_t i) const noexcept { return (offset_ + i) & mask_; }
+    std::size_t index() const noexcept { return index_; }
+
+    void next() noexcept {
+        index_ += group::width;
+        offset_ = (offset_ + index_) & mask_;
+    }
+
+private:
+    std::size_t mask_;
+    std::size_t offset_;
+    std::size_t index_ = 0;
+};
+
+// Control bytes of a table with no allocation: one sentinel followed by empty
+// bytes, so lookups terminate after a single group without a capacity check.
+alignas(32) inline constexpr ctrl_t empty_group[32] = {
+    ctrl_sentinel, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty,
+    ctrl_empty,    ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty,
+    ctrl_empty,    ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty,
+    ctrl_empty,    ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty, ctrl_empty};
+
+// Capacities are always 2^k - 1 so that `hash & capacity` is a valid index
+// and the sentinel fits at ctrl[capacity].
+constexpr std::size_t normalize_capacity(std::size_t n) noexcept {
+    return n ? ~std::size_t{} >> std::countl_zero(n) : 1;
+}
+
+constexpr std::size_t next_capacity(std::size_t capacity) noexcept { return capacity * 2 + 1; }
+
+// Maximum number of full slots for a capacity: a load factor of 7/8.
+constexpr std::size_t capacity_to_growth(std::size_t capacity) noexcept {
+    if (group::width == 8 && capacity == 7) {
+        return 6;
+    }
+    return capacity - capacity / 8;
+}
+
+// Smallest capacity whose growth limit holds `growth` elements.
+constexpr std::size_t growth_to_lower_bound_capacity(std::size_t growth) noexcept {
+    if (growth == 0) {
+        return 0;
+    }
+    if (group::width == 8 && growth == 7) {
+        return 8;
+    }
+    return growth + (growth - 1) / 7;
+}
+
+// Number of control bytes copied past the sentinel so that a group load
+// starting near the end of the array wraps around to the beginning.
+constexpr std::size_t num_cloned_bytes() noexcept { return group::width - 1; }
+
+// Finalizer from MurmurHash3. Pointer values have zero low bits and cluster
+// in a few pages, so they need mixing before the h1/h2 split.
+constexpr std::size_t mix(std::size_t h) noexcept {
+    std::uint64_t x = h;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return static_cast<std::size_t>(x);
+}
+
+}  // namespace whm::detail
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <memory>
+
+namespace whm::detail {
+
+// Lets operator-> return a pair of references built on the fly.
+template <class Ref>
+struct arrow_proxy {
+    Ref ref;
+    Ref* operator->() noexcept { return std::addressof(ref); }
+};
+
+}  // namespace whm::detail
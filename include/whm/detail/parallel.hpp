@@ -0,0 +1,61 @@
+#pragma once
+
+// Fan-out over a caller-supplied executor.
+//
+// An executor is any object `ex` for which `ex(task)` takes a copyable,
+// nullary callable and runs it once, on any thread, now or later: a thread
+// pool's submit wrapped in a lambda, or a function that runs the task at
+// once. parallel_for() waits for all of its tasks, so the executor must not
+// need the calling thread to make progress.
+
+#include <cstddef>
+#include <exception>
+#include <latch>
+#include <mutex>
+
+namespace whm::detail {
+
+template <class Executor>
+concept executor = requires(Executor& ex, void (*task)()) { ex(task); };
+
+// Calls f(0) ... f(n - 1) as tasks on `ex` and waits for them. A task the
+// executor refuses (by throwing) runs on the calling thread instead. The
+// first exception thrown by `f` is rethrown once every task has finished.
+template <executor Executor, class F>
+void parallel_for(Executor& ex, std::size_t n, F& f) {
+    struct shared_state {
+        explicit shared_state(std::size_t n, F& f) : done(static_cast<std::ptrdiff_t>(n)), f(f) {}
+
+        void run(std::size_t i) noexcept {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            done.count_down();
+        }
+
+        std::latch done;
+        F& f;
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+
+    shared_state state(n, f);
+    for (std::size_t i = 0; i != n; ++i) {
+        try {
+            ex([&state, i] { state.run(i); });
+        } catch (...) {
+            state.run(i);
+        }
+    }
+    state.done.wait();
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+}
+
+}  // namespace whm::detail
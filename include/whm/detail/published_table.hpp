@@ -0,0 +1,565 @@
+#pragma once
+
+// Open-addressing table that readers probe without taking any lock.
+//
+// Entries are immutable heap objects; the table stores pointers to them in
+// cache-line sized groups of seven, next to a 64-bit word holding the seven
+// control bytes (same encoding as raw_table). A lookup loads the control
+// word, matches the fingerprint with SWAR arithmetic and dereferences only
+// the candidates, so a hit usually touches one group line and one entry.
+//
+// All mutation happens under the owner's lock. Writers never modify an entry
+// or a bucket array after it may have been seen by a reader: replacing a
+// value publishes a new entry, growing publishes a new array, and the old
+// objects are retired to epoch-based reclamation. Readers must hold an
+// epoch_domain::guard on `domain()` while they use anything find() returns.
+//
+// Large tables grow by incremental migration instead of one rebuild: the
+// new array is published linked to the old one, and every write moves the
+// next migrate_step_groups groups across (migrate() must be called by the
+// owner for that). An entry is placed in the new array before its old
+// position is turned into a tombstone, and readers probe the old array
+// first, so a reader always meets a live entry in at least one of them.
+// A miss is confirmed by checking that no newer array was published
+// meanwhile.
+//
+// Entry requirements:
+//   std::size_t hash;                        // full hash, set before insert()
+//   bool expired() const noexcept;
+//   const void* address() const noexcept;    // weakly held object
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include "epoch.hpp"
+#include "group.hpp"
+
+namespace whm::detail {
+
+template <class Entry, class Alloc>
+class published_table {
+public:
+    using size_type = std::size_t;
+
+    struct alignas(64) entry_group {
+        static constexpr size_type width = 7;
+
+        // Byte i is the control byte of entries[i]; byte 7 is a permanent
+        // sentinel so that word-wide matches never report it.
+        std::atomic<std::uint64_t> tags;
+        std::atomic<Entry*> entries[width];
+    };
+
+    static_assert(sizeof(entry_group) == 64);
+
+    // Position of an entry found by a writer.
+    struct locator {
+        entry_group* group = nullptr;
+        unsigned index = 0;
+        Entry* entry = nullptr;
+
+        explicit operator bool() const noexcept { return entry != nullptr; }
+    };
+
+private:
+    struct bucket_array {
+        size_type mask;  // number of groups - 1
+        entry_group* groups;
+        std::atomic<bucket_array*> from{nullptr};  // array still migrating into this one
+    };
+
+    using traits = std::allocator_traits<Alloc>;
+    using entry_alloc = typename traits::template rebind_alloc<Entry>;
+    using group_alloc = typename traits::template rebind_alloc<entry_group>;
+    using array_alloc = typename traits::template rebind_alloc<bucket_array>;
+
+    static constexpr std::uint64_t byte_lsbs = 0x0001010101010101ULL;
+    static constexpr std::uint64_t byte_msbs = 0x0080808080808080ULL;
+    static constexpr std::uint64_t empty_tags =
+        0xFF00000000000000ULL | (byte_lsbs * static_cast<std::uint8_t>(ctrl_empty));
+
+    using mask_type = bitmask<std::uint64_t, 8, 3>;
+
+    static mask_type match(std::uint64_t tags, h2_t hash) noexcept {
+        const std::uint64_t x = tags ^ (byte_lsbs * hash);
+        return mask_type((x - byte_lsbs) & ~x & byte_msbs);
+    }
+
+    static mask_type match_empty(std::uint64_t tags) noexcept {
+        return mask_type((tags & (~tags << 6)) & byte_msbs);
+    }
+
+    static mask_type match_empty_or_deleted(std::uint64_t tags) noexcept {
+        return mask_type((tags & (~tags << 7)) & byte_msbs);
+    }
+
+    static std::uint64_t with_tag(std::uint64_t tags, unsigned index, std::uint8_t tag) noexcept {
+        const unsigned shift = index * 8;
+        return (tags & ~(std::uint64_t{0xFF} << shift)) | (std::uint64_t{tag} << shift);
+    }
+
+    static std::uint8_t tag_at(std::uint64_t tags, unsigned index) noexcept {
+        return static_cast<std::uint8_t>(tags >> (index * 8));
+    }
+
+public:
+    explicit published_table(const Alloc& alloc = Alloc(), epoch_domain& domain = epoch_domain::global())
+        : alloc_(alloc), domain_(&domain), retired_(alloc) {}
+
+    published_table(const published_table&) = delete;
+    published_table& operator=(const published_table&) = delete;
+
+    ~published_table() {
+        retired_.drain();
+        if (bucket_array* a = array_.load(std::memory_order_relaxed)) {
+            if (bucket_array* old = a->from.load(std::memory_order_relaxed)) {
+                for_each_entry(old, [this](Entry* e) { destroy_entry(e); });
+                destroy_array(old);
+            }
+            for_each_entry(a, [this](Entry* e) { destroy_entry(e); });
+            destroy_array(a);
+        }
+    }
+
+    // Growth of at least this many groups migrates incrementally.
+    static constexpr size_type migrate_min_groups = 64;
+    static constexpr size_type migrate_step_groups = 2;
+
+    epoch_domain& domain() const noexcept { return *domain_; }
+
+    // Entries stored, including expired ones not yet reclaimed.
+    size_type size() const noexcept { return size_.load(std::memory_order_relaxed); }
+    size_type capacity() const noexcept { return capacity_; }
+
+    // Lock-free lookup. Requires an epoch guard; the result stays valid
+    // until the guard is released.
+    template <class Eq>
+    const Entry* find(size_type hash, Eq&& eq) const noexcept {
+        const bucket_array* a = array_.load(std::memory_order_acquire);
+        while (a != nullptr) {
+            if (const bucket_array* old = a->from.load(std::memory_order_acquire)) {
+                if (locator loc = probe(old, hash, eq, std::memory_order_acquire)) {
+                    return loc.entry;
+                }
+            }
+            if (locator loc = probe(a, hash, eq, std::memory_order_acquire)) {
+                return loc.entry;
+            }
+            // Entries leave `a` only for a newer array, published before the
+            // first of them was moved.
+            const bucket_array* now = array_.load(std::memory_order_acquire);
+            if (now == a) {
+                return nullptr;
+            }
+            a = now;
+        }
+        return nullptr;
+    }
+
+    // The operations below require the owner's lock.
+
+    template <class Eq>
+    locator find_locked(size_type hash, Eq&& eq) noexcept {
+        bucket_array* a = array_.load(std::memory_order_relaxed);
+        if (a == nullptr) {
+            return {};
+        }
+        if (bucket_array* old = a->from.load(std::memory_order_relaxed)) {
+            if (locator loc = probe(old, hash, eq, std::memory_order_relaxed)) {
+                return loc;
+            }
+        }
+        return probe(a, hash, eq, std::memory_order_relaxed);
+    }
+
+    // Builds an entry with the table's allocator. It belongs to the caller
+    // until passed to insert() and must be given back with destroy_entry()
+    // if it is never inserted.
+    template <class... Args>
+    Entry* make_entry(Args&&... args) {
+        entry_alloc alloc(alloc_);
+        Entry* e = std::to_address(std::allocator_traits<entry_alloc>::allocate(alloc, 1));
+        try {
+            std::allocator_traits<entry_alloc>::construct(alloc, e, std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator_traits<entry_alloc>::deallocate(alloc, e, 1);
+            throw;
+        }
+        return e;
+    }
+
+    void destroy_entry(Entry* e) noexcept {
+        entry_alloc alloc(alloc_);
+        std::allocator_traits<entry_alloc>::destroy(alloc, e);
+        std::allocator_traits<entry_alloc>::deallocate(alloc, e, 1);
+    }
+
+    // Publishes `e`, whose key must not be present.
+    void insert(Entry* e) {
+        if (used_ + pending_ + 1 > growth_limit()) {
+            // Sized from the live count, so a table full of tombstones is
+            // rebuilt at about its current size rather than grown.
+            grow(size() + size() / 2 + 1);
+        }
+        publish(array_.load(std::memory_order_relaxed), e);
+        size_.store(size() + 1, std::memory_order_relaxed);
+    }
+
+    // Moves the next migrate_step_groups groups of a migration in progress
+    // into the new array, dropping expired entries on the way.
+    void migrate() { migrate(migrate_step_groups); }
+
+    bool migrating() const noexcept { return pending_array() != nullptr; }
+
+    // Swaps the entry at `loc` for `e` (same key) and retires the old one.
+    void replace(const locator& loc, Entry* e) {
+        assert(loc && e->hash == loc.entry->hash);
+        loc.group->entries[loc.index].store(e, std::memory_order_release);
+        retire_entry(loc.entry);
+    }
+
+    // Unlinks the entry at `loc` and retires it.
+    void erase(const locator& loc) {
+        const std::uint64_t tags = loc.group->tags.load(std::memory_order_relaxed);
+        // A group that still has an empty position was never full, so no
+        // probe sequence continued past it and no tombstone is needed.
+        const bool never_full = static_cast<bool>(match_empty(tags));
+        const auto tag = static_cast<std::uint8_t>(never_full ? ctrl_empty : ctrl_deleted);
+        loc.group->tags.store(with_tag(tags, loc.index, tag), std::memory_order_release);
+        loc.group->entries[loc.index].store(nullptr, std::memory_order_release);
+        if (const bucket_array* old = pending_array(); old && contains_group(old, loc.group)) {
+            --pending_;
+        } else {
+            used_ -= never_full;
+        }
+        size_.store(size() - 1, std::memory_order_relaxed);
+        retire_entry(loc.entry);
+    }
+
+    // Erases one expired entry whose weakly held object lived at `address`.
+    bool erase_expired(size_type hash, const void* address) {
+        const locator loc =
+            find_locked(hash, [address](const Entry& e) { return e.address() == address && e.expired(); });
+        if (!loc) {
+            return false;
+        }
+        erase(loc);
+        return true;
+    }
+
+    // Examines at most `budget` entry positions starting at `cursor` and
+    // erases the expired entries among them.
+    size_type sweep(size_type& cursor, size_type budget) {
+        bucket_array* a = array_.load(std::memory_order_relaxed);
+        if (a == nullptr || size() == 0) {
+            return 0;
+        }
+        if (cursor >= capacity_) {
+            cursor = 0;
+        }
+        size_type removed = 0;
+        for (budget = std::min(budget, capacity_); budget; --budget) {
+            entry_group& grp = a->groups[cursor / entry_group::width];
+            const auto i = static_cast<unsigned>(cursor % entry_group::width);
+            Entry* e = grp.entries[i].load(std::memory_order_relaxed);
+            if (e && e->expired()) {
+                erase({&grp, i, e});
+                ++removed;
+            }
+            if (++cursor == capacity_) {
+                cursor = 0;
+            }
+        }
+        return removed;
+    }
+
+    // Finishes a migration in progress first, so every entry is examined.
+    size_type purge() {
+        const size_type before = size();
+        finish_migration();
+        size_type cursor = 0;
+        sweep(cursor, capacity_);
+        return before - size();
+    }
+
+    // Grows (or shrinks) to fit at least `n` entries, dropping expired ones.
+    void reserve(size_type n) {
+        if (n > growth_limit()) {
+            rebuild(n);
+        }
+    }
+
+    // Rebuilds for max(n, size()) entries, dropping expired ones.
+    void rehash(size_type n) { rebuild(std::max(n, size())); }
+
+    void clear() {
+        bucket_array* a = array_.exchange(nullptr, std::memory_order_acq_rel);
+        if (a == nullptr) {
+            return;
+        }
+        if (bucket_array* old = a->from.load(std::memory_order_relaxed)) {
+            for_each_entry(old, [this](Entry* e) { retire_entry(e); });
+            retire_array(old);
+        }
+        for_each_entry(a, [this](Entry* e) { retire_entry(e); });
+        retire_array(a);
+        capacity_ = 0;
+        used_ = 0;
+        pending_ = 0;
+        migrate_cursor_ = 0;
+        size_.store(0, std::memory_order_relaxed);
+    }
+
+    // Calls `f(const Entry&)` for every stored entry.
+    template <class F>
+    void for_each(F&& f) const {
+        if (const bucket_array* a = array_.load(std::memory_order_acquire)) {
+            if (const bucket_array* old = a->from.load(std::memory_order_acquire)) {
+                for_each_entry(old, [&f](const Entry* e) { f(*e); });
+            }
+            for_each_entry(a, [&f](const Entry* e) { f(*e); });
+        }
+    }
+
+    // Frees retired objects that readers can no longer reach. Cheap when
+    // nothing is pending.
+    void reclaim() noexcept { retired_.reclaim(*domain_); }
+
+private:
+    size_type growth_limit() const noexcept { return capacity_ - capacity_ / 8; }
+
+    static size_type groups_for(size_type n) noexcept {
+        size_type groups = 1;
+        while ((groups * entry_group::width) - (groups * entry_group::width) / 8 < n) {
+            groups *= 2;
+        }
+        return groups;
+    }
+
+    static bool contains_group(const bucket_array* a, const entry_group* grp) noexcept {
+        return grp >= a->groups && grp <= a->groups + a->mask;
+    }
+
+    // The array being migrated from, if any. Owner only.
+    bucket_array* pending_array() const noexcept {
+        const bucket_array* a = array_.load(std::memory_order_relaxed);
+        return a ? a->from.load(std::memory_order_relaxed) : nullptr;
+    }
+
+    template <class Eq>
+    static locator probe(const bucket_array* a, size_type hash, Eq& eq, std::memory_order order) noexcept {
+        const h2_t fingerprint = h2(hash);
+        size_type g = h1(hash) & a->mask;
+        for (size_type step = 1;; ++step) {
+            entry_group& grp = a->groups[g];
+            const std::uint64_t tags = grp.tags.load(order);
+            for (unsigned i : match(tags, fingerprint)) {
+                Entry* e = grp.entries[i].load(order);
+                if (e && e->hash == hash && eq(*e)) {
+                    return {&grp, i, e};
+                }
+            }
+            if (match_empty(tags) || step > a->mask) {
+                return {};
+            }
+            g = (g + step) & a->mask;
+        }
+    }
+
+    // Stores `e` in a published array at the first free position of its
+    // probe sequence.
+    void publish(bucket_array* a, Entry* e) noexcept {
+        size_type g = h1(e->hash) & a->mask;
+        for (size_type step = 1;; ++step) {
+            entry_group& grp = a->groups[g];
+            const std::uint64_t tags = grp.tags.load(std::memory_order_relaxed);
+            if (auto free = match_empty_or_deleted(tags)) {
+                const unsigned i = free.lowest_bit_set();
+                used_ += tag_at(tags, i) == static_cast<std::uint8_t>(ctrl_empty);
+                grp.entries[i].store(e, std::memory_order_release);
+                grp.tags.store(with_tag(tags, i, h2(e->hash)), std::memory_order_release);
+                return;
+            }
+            assert(step <= a->mask && "published_table is full");
+            g = (g + step) & a->mask;
+        }
+    }
+
+    // Small tables are rebuilt at once; larger ones start a migration.
+    void grow(size_type n) {
+        finish_migration();
+        bucket_array* old = array_.load(std::memory_order_relaxed);
+        if (old == nullptr || old->mask + 1 < migrate_min_groups) {
+            rebuild(n);
+            return;
+        }
+        const size_type groups = groups_for(n);
+        bucket_array* fresh = make_array(groups);
+        fresh->from.store(old, std::memory_order_relaxed);
+        capacity_ = groups * entry_group::width;
+        pending_ = size();
+        used_ = 0;
+        migrate_cursor_ = 0;
+        array_.store(fresh, std::memory_order_release);
+    }
+
+    void migrate(size_type groups) {
+        bucket_array* a = array_.load(std::memory_order_relaxed);
+        bucket_array* old = a ? a->from.load(std::memory_order_relaxed) : nullptr;
+        if (old == nullptr) {
+            return;
+        }
+        for (; groups && migrate_cursor_ <= old->mask; --groups, ++migrate_cursor_) {
+            entry_group& grp = old->groups[migrate_cursor_];
+            std::uint64_t tags = grp.tags.load(std::memory_order_relaxed);
+            for (unsigned i = 0; i != entry_group::width; ++i) {
+                Entry* e = grp.entries[i].load(std::memory_order_relaxed);
+                if (e == nullptr) {
+                    continue;
+                }
+                const bool dead = e->expired();
+                if (!dead) {
+                    publish(a, e);
+                }
+                // A tombstone, not an empty position: probes for entries
+                // not yet moved must keep going past it.
+                tags = with_tag(tags, i, static_cast<std::uint8_t>(ctrl_deleted));
+                grp.tags.store(tags, std::memory_order_release);
+                grp.entries[i].store(nullptr, std::memory_order_release);
+                --pending_;
+                if (dead) {
+                    size_.store(size() - 1, std::memory_order_relaxed);
+                    retire_entry(e);
+                }
+            }
+        }
+        if (migrate_cursor_ > old->mask) {
+            a->from.store(nullptr, std::memory_order_release);
+            retire_array(old);
+            migrate_cursor_ = 0;
+            pending_ = 0;
+        }
+    }
+
+    void finish_migration() {
+        if (pending_array() != nullptr) {
+            migrate(std::numeric_limits<size_type>::max());
+        }
+    }
+
+    template <class F>
+    static void for_each_entry(const bucket_array* a, F&& f) {
+        for (size_type g = 0; g <= a->mask; ++g) {
+            for (auto& slot : a->groups[g].entries) {
+                if (Entry* e = slot.load(std::memory_order_acquire)) {
+                    f(e);
+                }
+            }
+        }
+    }
+
+    // Publishes a fresh array sized for `n` live entries. Expired entries are
+    // not carried over.
+    void rebuild(size_type n) {
+        finish_migration();
+        const size_type groups = groups_for(n);
+        bucket_array* fresh = make_array(groups);
+        bucket_array* old = array_.load(std::memory_order_relaxed);
+        size_type live = 0;
+        if (old) {
+            for_each_entry(old, [&](Entry* e) {
+                if (e->expired()) {
+                    retire_entry(e);
+                    return;
+                }
+                place(fresh, e);
+                ++live;
+            });
+        }
+        capacity_ = groups * entry_group::width;
+        used_ = live;
+        size_.store(live, std::memory_order_relaxed);
+        array_.store(fresh, std::memory_order_release);
+        if (old) {
+            retire_array(old);
+        }
+    }
+
+    // Insertion into an array no reader has seen yet.
+    static void place(bucket_array* a, Entry* e) noexcept {
+        size_type g = h1(e->hash) & a->mask;
+        for (size_type step = 1;; ++step) {
+            entry_group& grp = a->groups[g];
+            const std::uint64_t tags = grp.tags.load(std::memory_order_relaxed);
+            if (auto free = match_empty(tags)) {
+                const unsigned i = free.lowest_bit_set();
+                grp.entries[i].store(e, std::memory_order_relaxed);
+                grp.tags.store(with_tag(tags, i, h2(e->hash)), std::memory_order_relaxed);
+                return;
+            }
+            g = (g + step) & a->mask;
+        }
+    }
+
+    bucket_array* make_array(size_type groups) {
+        group_alloc galloc(alloc_);
+        entry_group* g = std::to_address(std::allocator_traits<group_alloc>::allocate(galloc, groups));
+        for (size_type i = 0; i != groups; ++i) {
+            ::new (static_cast<void*>(g + i)) entry_group{};
+            g[i].tags.store(empty_tags, std::memory_order_relaxed);
+        }
+        array_alloc aalloc(alloc_);
+        bucket_array* a;
+        try {
+            a = std::to_address(std::allocator_traits<array_alloc>::allocate(aalloc, 1));
+        } catch (...) {
+            std::allocator_traits<group_alloc>::deallocate(galloc, g, groups);
+            throw;
+        }
+        ::new (static_cast<void*>(a)) bucket_array{groups - 1, g};
+        return a;
+    }
+
+    void destroy_array(bucket_array* a) noexcept {
+        group_alloc galloc(alloc_);
+        std::allocator_traits<group_alloc>::deallocate(galloc, a->groups, a->mask + 1);
+        array_alloc aalloc(alloc_);
+        std::allocator_traits<array_alloc>::deallocate(aalloc, a, 1);
+    }
+
+    void retire_entry(Entry* e) {
+        retired_.retire(
+            *domain_, e,
+            [](void* obj, void* self) noexcept {
+                static_cast<published_table*>(self)->destroy_entry(static_cast<Entry*>(obj));
+            },
+            this);
+    }
+
+    void retire_array(bucket_array* a) {
+        retired_.retire(
+            *domain_, a,
+            [](void* obj, void* self) noexcept {
+                static_cast<published_table*>(self)->destroy_array(static_cast<bucket_array*>(obj));
+            },
+            this);
+    }
+
+    std::atomic<bucket_array*> array_{nullptr};
+    std::atomic<size_type> size_{0};
+    size_type capacity_ = 0;  // entry positions
+    size_type used_ = 0;      // full + tombstone positions
+    size_type pending_ = 0;   // entries left in the array being migrated from
+    size_type migrate_cursor_ = 0;
+    [[no_unique_address]] Alloc alloc_;
+    epoch_domain* domain_;
+    retire_list<Alloc> retired_;
+};
+
+}  // namespace whm::detail
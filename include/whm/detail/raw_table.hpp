@@ -0,0 +1,825 @@
+#pragma once
+
+// Open-addressing table shared by the weak containers.
+//
+// Layout: one allocation holding `capacity + 1 + num_cloned_bytes()` control
+// bytes followed by `capacity` slots. Slots are raw storage; the Policy says
+// how to construct, move, destroy and hash them and whether an entry has
+// expired. The table knows nothing about keys: lookups take a hash and a
+// predicate over slots.
+//
+// Policy requirements:
+//   using slot_type = ...;
+//   template <class A, class... Args> static void construct(A&, slot_type*, Args&&...);
+//   template <class A> static void destroy(A&, slot_type*);
+//   template <class A> static void transfer(A&, slot_type* dst, slot_type* src);
+//   template <class H> static std::size_t hash_slot(const H&, const slot_type&);
+//     (both noexcept when they cannot throw: see resize())
+//   static bool expired(const slot_type&) noexcept;
+//   static const void* address(const slot_type&) noexcept;  // weakly held object
+//
+// The Resize policy (see policy.hpp) decides whether a table that has run
+// out of room is rebuilt at the same capacity or a larger one. The Stats
+// policy (see stats.hpp) is told about every probe and rebuild. The Evict
+// policy (see policy.hpp) sees every hit, insertion and rebuild, and picks
+// the entries to give up when a memory budget stops the table from growing.
+//
+// Control bytes, counters and everything that only touches them live in
+// the non-template table_core base, shared by all instantiations, and so do
+// the loops over slots of purges, sweeps and rebuilds: the table passes
+// them what they do with each slot.
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "../policy.hpp"
+#include "../stats.hpp"
+#include "config.hpp"
+#include "group.hpp"
+#include "parallel.hpp"
+#include "table_core.hpp"
+
+namespace whm::detail {
+
+template <class Policy, class Hash, class Alloc, class Resize = default_resize_policy, class Stats = no_stats,
+          class Evict = no_eviction>
+class raw_table : public table_core {
+public:
+    using slot_type = typename Policy::slot_type;
+    using size_type = std::size_t;
+    using hasher = Hash;
+    using allocator_type = typename std::allocator_traits<Alloc>::template rebind_alloc<slot_type>;
+
+    raw_table() noexcept(std::is_nothrow_default_constructible_v<Hash> &&
+                         std::is_nothrow_default_constructible_v<allocator_type>) = default;
+
+    raw_table(size_type bucket_count, const Hash& hash, const allocator_type& alloc)
+        : hash_(hash), alloc_(alloc) {
+        if (bucket_count) {
+            initialize(normalize_capacity(bucket_count));
+        }
+    }
+
+    raw_table(const raw_table& other)
+        : raw_table(0, other.hash_,
+                    std::allocator_traits<allocator_type>::select_on_container_copy_construction(
+                        other.alloc_)) {
+        if constexpr (Evict::enabled) {
+            evict_ = other.evict_;
+        }
+        copy_from(other);
+    }
+
+    raw_table(raw_table&& other) noexcept(std::is_nothrow_move_constructible_v<Hash>)
+        : table_core(std::move(other)),
+          slots_(std::exchange(other.slots_, nullptr)),
+          hash_(std::move(other.hash_)),
+          alloc_(std::move(other.alloc_)),
+          evict_(std::move(other.evict_)) {}
+
+    // Assignment and swap follow the allocator's propagate_on_container_*
+    // traits. A move between tables whose allocators differ and do not
+    // propagate moves the entries one by one into this table's storage.
+    raw_table& operator=(const raw_table& other) {
+        if (this != &other) {
+            raw_table tmp(0, other.hash_, alloc_traits::propagate_on_container_copy_assignment::value ? other.alloc_ : alloc_);
+            if constexpr (Evict::enabled) {
+                tmp.evict_ = other.evict_;
+            }
+            tmp.copy_from(other);
+            swap_storage(tmp);
+            if constexpr (alloc_traits::propagate_on_container_copy_assignment::value) {
+                using std::swap;
+                swap(alloc_, tmp.alloc_);
+            }
+        }
+        return *this;
+    }
+
+    raw_table& operator=(raw_table&& other) noexcept(
+        std::is_nothrow_move_assignable_v<Hash> &&
+        (alloc_traits::propagate_on_container_move_assignment::value || alloc_traits::is_always_equal::value)) {
+        if (this == &other) {
+            return *this;
+        }
+        if constexpr (!alloc_traits::propagate_on_container_move_assignment::value &&
+                      !alloc_traits::is_always_equal::value) {
+            if (alloc_ != other.alloc_) {
+                clear();
+                hash_ = std::move(other.hash_);
+                move_from(other);
+                return *this;
+            }
+        }
+        destroy_and_deallocate();
+        take(other);
+        slots_ = std::exchange(other.slots_, nullptr);
+        hash_ = std::move(other.hash_);
+        evict_ = std::move(other.evict_);
+        if constexpr (alloc_traits::propagate_on_container_move_assignment::value) {
+            alloc_ = std::move(other.alloc_);
+        }
+        return *this;
+    }
+
+    ~raw_table() { destroy_and_deallocate(); }
+
+    // Without propagate_on_container_swap the allocators must compare equal.
+    void swap(raw_table& other) noexcept {
+        swap_storage(other);
+        if constexpr (alloc_traits::propagate_on_container_swap::value) {
+            using std::swap;
+            swap(alloc_, other.alloc_);
+        } else {
+            assert(alloc_ == other.alloc_ && "swapping tables with unequal allocators");
+        }
+    }
+
+    // Stored entries whose key or value has expired. Expiry happens without
+    // the table noticing, so this scans every slot.
+    size_type count_expired() const noexcept;
+
+    // Bytes of the table's allocation by slot state, and of the Evict
+    // policy's state. Telling live from expired entries scans every slot.
+    memory_footprint memory_usage() const noexcept;
+
+    size_type memory_budget() const noexcept
+        requires Evict::enabled
+    {
+        return evict_.budget_bytes;
+    }
+
+    // Caps the table's allocation plus the Evict policy's state at `bytes`,
+    // or at the smallest table if `bytes` is less. A table over the new cap
+    // is rebuilt within it at once, evicting live entries that do not fit.
+    void set_memory_budget(size_type bytes)
+        requires Evict::enabled
+    {
+        evict_.budget_bytes = bytes;
+        evict_.max_capacity = bytes == eviction_budget::unlimited ? bytes : budget_capacity(bytes);
+        if (capacity_ > evict_.max_capacity) {
+            evict_and_rebuild(evict_.max_capacity, size_ - count_expired());
+        }
+    }
+
+    const Hash& hash_ref() const noexcept { return hash_; }
+    const Stats& stats() const noexcept { return stats_; }
+
+    // Runs `f`, which removes entries and returns how many, and records it
+    // as one sweep when stats are collected.
+    template <class F>
+    size_type timed_sweep(F&& f) {
+        if constexpr (Stats::enabled) {
+            const auto start = std::chrono::steady_clock::now();
+            const size_type removed = f();
+            stats_.on_sweep(std::chrono::steady_clock::now() - start, removed);
+            return removed;
+        } else {
+            return f();
+        }
+    }
+
+    // One step of a container's Sweep policy, timed as above. no_sweep
+    // steps do nothing and are not recorded.
+    template <class Sweep>
+    void sweep_step(Sweep& sweep) {
+        if constexpr (!std::is_same_v<Sweep, no_sweep>) {
+            timed_sweep([this, &sweep] {
+                const size_type before = size_;
+                sweep.step(*this);
+                return before - size_;
+            });
+        }
+    }
+    const allocator_type& alloc_ref() const noexcept { return alloc_; }
+
+    slot_type& slot_at(size_type i) noexcept { return slots_[i]; }
+    const slot_type& slot_at(size_type i) const noexcept { return slots_[i]; }
+
+    // Index of a slot for which `eq(slot)` holds among the slots whose
+    // control byte matches `hash`, or npos.
+    template <class Eq>
+    size_type find(size_type hash, Eq&& eq) const {
+        probe_seq seq(h1(hash), capacity_);
+        const h2_t fingerprint = h2(hash);
+        while (true) {
+            const group g(ctrl_ + seq.offset());
+            for (unsigned i : g.match(fingerprint)) {
+                const size_type index = seq.offset(i);
+                if (eq(slots_[index])) {
+                    stats_.on_probe(seq.index() / group::width + 1);
+                    if constexpr (Evict::enabled) {
+                        evict_.touch(index);
+                    }
+                    return index;
+                }
+            }
+            if (g.match_empty()) {
+                stats_.on_probe(seq.index() / group::width + 1);
+                return npos;
+            }
+            seq.next();
+            assert(seq.index() <= capacity_ && "full table");
+        }
+    }
+
+    // Prefetches the first group a probe for `hash` reads and the slot at
+    // its start, which is where the entry lives unless the probe collided.
+    void prefetch(size_type hash) const noexcept {
+        if (capacity_ == 0) {
+            return;
+        }
+        const size_type offset = probe_seq(h1(hash), capacity_).offset();
+        detail::prefetch(ctrl_ + offset);
+        detail::prefetch(slots_ + offset);
+    }
+
+    // Either the index of the matching slot (second == false) or the index
+    // of a freshly reserved slot (second == true) that the caller must fill
+    // with construct_at() before any other operation on the table.
+    template <class Eq>
+    std::pair<size_type, bool> find_or_prepare_insert(size_type hash, Eq&& eq) {
+        const size_type index = find(hash, eq);
+        if (index != npos) {
+            return {index, false};
+        }
+        return {prepare_insert(hash), true};
+    }
+
+    size_type prepare_insert(size_type hash) {
+        size_type target = find_first_non_full(hash);
+        if (must_grow(target)) {
+            grow();
+            target = find_first_non_full(hash);
+        }
+        claim(target, hash);
+        if constexpr (Evict::enabled) {
+            evict_.touch(target);
+        }
+        return target;
+    }
+
+    template <class... Args>
+    void construct_at(size_type index, Args&&... args) {
+        try {
+            Policy::construct(alloc_, slots_ + index, std::forward<Args>(args)...);
+        } catch (...) {
+            erase_meta(index);
+            throw;
+        }
+    }
+
+    void erase_at(size_type index) {
+        assert(is_full(ctrl_[index]));
+        Policy::destroy(alloc_, slots_ + index);
+        erase_meta(index);
+    }
+
+    // Destroys every expired entry. Returns the number removed.
+    size_type purge();
+
+    // Tables of fewer slots than this are purged on the calling thread.
+    static constexpr size_type parallel_block = size_type{1} << 15;
+
+    // purge() with the expiry checks and destructors spread over executor
+    // tasks, one per block of parallel_block slots. A task writes only the
+    // control bytes of its own block, so every removed entry first becomes
+    // a tombstone; one pass over the control bytes afterwards turns back
+    // into empty positions those that erase_at() would not have needed.
+    // Values' destructors run concurrently for different entries.
+    template <executor Executor>
+    size_type purge(Executor& ex) {
+        if (capacity_ < 2 * parallel_block) {
+            return purge();
+        }
+        std::atomic<size_type> removed{0};
+        auto task = [this, &removed](size_type block) noexcept {
+            const size_type end = std::min(capacity_, (block + 1) * parallel_block);
+            removed.fetch_add(tombstone_full_if(block * parallel_block, end, destroy_if_expired, this),
+                              std::memory_order_relaxed);
+        };
+        parallel_for(ex, (capacity_ + parallel_block - 1) / parallel_block, task);
+        const size_type n = removed.load(std::memory_order_relaxed);
+        size_ -= n;
+        tombstones_ += n;
+        drop_tombstones();
+        return n;
+    }
+
+    // Erases one expired entry whose weakly held object lived at `address`.
+    // Used for death notifications, which know the hash but not the slot.
+    bool erase_expired(size_type hash, const void* address);
+
+    // Examines at most `budget` slots starting at `cursor`, destroying the
+    // expired entries among them, and leaves `cursor` just past the last slot
+    // examined. Returns the number removed.
+    size_type sweep(size_type& cursor, size_type budget);
+
+    void clear() noexcept {
+        if (capacity_ == 0) {
+            return;
+        }
+        destroy_slots();
+        clear_ctrl();
+    }
+
+    // Makes room for at least `n` entries without further allocation.
+    // Under a memory budget, only up to the largest capacity it allows.
+    void reserve(size_type n);
+
+    // Rebuilds the table at the smallest capacity that holds its live
+    // entries, or frees it if there are none.
+    void shrink_to_fit();
+
+    // Shrinks the table as the Resize policy asks when fewer than
+    // shrink_below_percent of its slots are occupied. size() counts expired
+    // entries too, so this never shrinks below what the live entries need.
+    void shrink_if_sparse();
+
+    // Rebuilds the table with capacity for at least max(n, size()) entries,
+    // within a memory budget. rehash(0) shrinks to the smallest capacity
+    // that fits.
+    void rehash(size_type n) { rehash_impl(n, true); }
+
+    // The expired entries are purged on `ex` first; the rebuild that follows
+    // then moves the survivors without checking them again.
+    template <executor Executor>
+    void rehash(size_type n, Executor& ex) {
+        purge(ex);
+        rehash_impl(n, false);
+    }
+
+private:
+    using alloc_traits = std::allocator_traits<allocator_type>;
+
+    void rehash_impl(size_type n, bool drop_expired);
+
+    void swap_storage(raw_table& other) noexcept {
+        swap_core(other);
+        using std::swap;
+        swap(slots_, other.slots_);
+        swap(hash_, other.hash_);
+        swap(evict_, other.evict_);
+    }
+
+    // Callbacks for the core's loops (see table_core). The first destroys
+    // the entry of slot `i` of the table at `table` if it has expired.
+    static bool destroy_if_expired(void* table, size_type i) {
+        raw_table& t = *static_cast<raw_table*>(table);
+        if (!Policy::expired(t.slots_[i])) {
+            return false;
+        }
+        Policy::destroy(t.alloc_, t.slots_ + i);
+        return true;
+    }
+
+    // The slots of a table being rebuilt or destroyed, which may no longer
+    // be `table`'s own. `next` is the slot being relocated.
+    struct old_slots_of {
+        raw_table* table;
+        slot_type* slots;
+        bool drop_expired;
+        size_type next;
+    };
+
+    static bool destroy_old(void* context, size_type i) {
+        old_slots_of& old = *static_cast<old_slots_of*>(context);
+        Policy::destroy(old.table->alloc_, old.slots + i);
+        return true;
+    }
+
+    static bool relocate_old(void* context, size_type i) {
+        old_slots_of& old = *static_cast<old_slots_of*>(context);
+        old.next = i;
+        old.table->relocate(i, old.slots + i, old.drop_expired);
+        return true;
+    }
+
+    void rehash_empty() noexcept {
+        destroy_and_deallocate();
+        reset_to_empty();
+        slots_ = nullptr;
+    }
+
+    static constexpr resize_thresholds thresholds{Resize::rehash_in_place_percent, Resize::shrink_below_percent,
+                                                  Resize::shrink_target_percent};
+
+    // Allocates storage for `capacity` slots and makes it the table's, all
+    // empty. The previous storage is left to the caller; if this throws, the
+    // table is unchanged.
+    void initialize(size_type capacity);
+
+    // Storage for the control bytes, measured in slot-sized units so that the
+    // slots that follow stay aligned.
+    static constexpr size_type ctrl_units(size_type capacity) noexcept {
+        const size_type bytes = capacity + 1 + num_cloned_bytes();
+        return (bytes + sizeof(slot_type) - 1) / sizeof(slot_type);
+    }
+
+    // What a memory budget counts for a table of `capacity`.
+    static size_type footprint(size_type capacity) noexcept {
+        size_type bytes = (ctrl_units(capacity) + capacity) * sizeof(slot_type);
+        if constexpr (Evict::enabled) {
+            bytes += Evict::state_bytes(capacity);
+        }
+        return bytes;
+    }
+
+    // The largest capacity whose footprint fits in `bytes`; at least 1.
+    static size_type budget_capacity(size_type bytes) noexcept {
+        size_type capacity = 1;
+        while (next_capacity(capacity) < eviction_budget::unlimited / (4 * sizeof(slot_type)) &&
+               footprint(next_capacity(capacity)) <= bytes) {
+            capacity = next_capacity(capacity);
+        }
+        return capacity;
+    }
+
+    size_type within_budget(size_type capacity) const noexcept {
+        return std::min(capacity, std::max(max_capacity(), capacity_));
+    }
+
+    size_type max_capacity() const noexcept {
+        if constexpr (Evict::enabled) {
+            return evict_.max_capacity;
+        } else {
+            return eviction_budget::unlimited;
+        }
+    }
+
+    // Called when an insertion finds no room; grown_capacity() decides
+    // between rebuilding in place, shrinking and doubling. Counting the live
+    // entries for it costs no more than the rebuild that follows.
+    void grow();
+
+    // Rebuilds the table at `capacity` with room to spare for at least
+    // 1 / evict_fraction of its growth limit, evicting the live entries that
+    // the Evict policy picks first if the `live` ones would leave less.
+    // Keys may die meanwhile (erasing an entry runs its destructors), so
+    // eviction also stops when the policy finds no live entry left.
+    void evict_and_rebuild(size_type capacity, size_type live);
+
+    // Whether moving an entry to a new table, hash included, cannot throw.
+    static constexpr bool nothrow_relocate =
+        noexcept(Policy::transfer(std::declval<allocator_type&>(), std::declval<slot_type*>(),
+                                  std::declval<slot_type*>())) &&
+        noexcept(Policy::hash_slot(std::declval<const Hash&>(), std::declval<const slot_type&>()));
+
+    // Rebuilds that may throw copy the entries and release the old table
+    // only once every copy has succeeded.
+    static constexpr bool copy_to_rebuild = !nothrow_relocate && std::is_copy_constructible_v<slot_type>;
+
+    // Moves every live entry into a fresh table of `new_capacity`. Expired
+    // entries are dropped on the way: nobody can look them up any more.
+    // Without `drop_expired` every entry is moved, unchecked.
+    //
+    // If hashing or moving an entry can throw, entries are copied instead,
+    // as std::vector does, so an exception leaves the table as it was.
+    // Entries that can be neither moved without throwing nor copied are
+    // moved anyway: an exception then destroys those not yet moved, and the
+    // table keeps the others.
+    void resize(size_type new_capacity, bool drop_expired = true);
+
+    // Puts the entry of old slot `from` into the new table, either moving it
+    // (which destroys the original) or copying it. Expired entries are left
+    // behind, and destroyed unless they are copied later.
+    void relocate(size_type from, slot_type* src, bool drop_expired) noexcept(nothrow_relocate);
+
+    // Counts the relocated entries and frees the old storage, whose slots
+    // have all been destroyed.
+    void finish_resize(slot_type* old_slots, size_type old_capacity) noexcept;
+
+    void copy_from(const raw_table& other);
+
+    // Moves the live entries of `other`, whose storage belongs to another
+    // allocator, into this table and leaves `other` empty.
+    void move_from(raw_table& other);
+
+    void destroy_slots() noexcept { destroy_slots(ctrl_, slots_, capacity_); }
+
+    void destroy_slots(const ctrl_t* ctrl, slot_type* slots, size_type capacity) noexcept;
+
+    void deallocate(slot_type* mem, size_type capacity) noexcept {
+        using traits = std::allocator_traits<allocator_type>;
+        traits::deallocate(alloc_, std::pointer_traits<typename traits::pointer>::pointer_to(*mem),
+                           ctrl_units(capacity) + capacity);
+    }
+
+    void destroy_and_deallocate() noexcept {
+        if (capacity_ == 0) {
+            return;
+        }
+        destroy_slots();
+        deallocate(slots_ - ctrl_units(capacity_), capacity_);
+    }
+
+    slot_type* slots_ = nullptr;
+    [[no_unique_address]] Hash hash_{};
+    [[no_unique_address]] allocator_type alloc_{};
+    [[no_unique_address]] Stats stats_{};
+    [[no_unique_address]] Evict evict_{};
+};
+
+// The members that are not on the lookup and insertion paths are defined
+// here, outside the class.
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+auto raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::count_expired() const noexcept -> size_type {
+    return count_full_if(
+        [](const void* table, size_type i) noexcept {
+            return Policy::expired(static_cast<const raw_table*>(table)->slots_[i]);
+        },
+        this);
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+memory_footprint raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::memory_usage() const noexcept {
+    memory_footprint m;
+    if (capacity_ == 0) {
+        return m;
+    }
+    const size_type expired = count_expired();
+    m.table = (ctrl_units(capacity_) + capacity_) * sizeof(slot_type);
+    m.control = ctrl_units(capacity_) * sizeof(slot_type);
+    m.live = (size_ - expired) * sizeof(slot_type);
+    m.expired = expired * sizeof(slot_type);
+    m.tombstones = tombstones_ * sizeof(slot_type);
+    m.free = (capacity_ - size_ - tombstones_) * sizeof(slot_type);
+    if constexpr (Evict::enabled) {
+        m.auxiliary = Evict::state_bytes(capacity_);
+    }
+    return m;
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+auto raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::purge() -> size_type {
+    return erase_full_if(0, capacity_, destroy_if_expired, this);
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+bool raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::erase_expired(size_type hash, const void* address) {
+    struct expired_key {
+        const raw_table* table;
+        const void* address;
+    };
+    const expired_key key{this, address};
+    const size_type index = find_full_if(
+        hash,
+        [](const void* context, size_type i) noexcept {
+            const expired_key& key = *static_cast<const expired_key*>(context);
+            const slot_type& slot = key.table->slots_[i];
+            return Policy::address(slot) == key.address && Policy::expired(slot);
+        },
+        &key);
+    if (index == npos) {
+        return false;
+    }
+    erase_at(index);
+    return true;
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+auto raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::sweep(size_type& cursor, size_type budget) -> size_type {
+    return sweep_full_if(cursor, budget, destroy_if_expired, this);
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::reserve(size_type n) {
+    if (n > size_ + growth_left_) {
+        const size_type new_capacity = within_budget(normalize_capacity(growth_to_lower_bound_capacity(n)));
+        if (new_capacity > capacity_) {
+            resize(new_capacity);
+        }
+    }
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::shrink_to_fit() {
+    const size_type live = size_ - count_expired();
+    if (live == 0) {
+        rehash_empty();
+        return;
+    }
+    const size_type new_capacity = normalize_capacity(growth_to_lower_bound_capacity(live));
+    if (new_capacity < capacity_ || live != size_) {
+        resize(std::min(new_capacity, capacity_));
+    }
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::shrink_if_sparse() {
+    if constexpr (Resize::shrink_below_percent != 0) {
+        if (capacity_ == 0 || size_ * 100 >= capacity_ * Resize::shrink_below_percent) {
+            return;
+        }
+        if (size_ == 0) {
+            rehash_empty();
+            return;
+        }
+        const size_type new_capacity = sparse_capacity(size_, Resize::shrink_target_percent);
+        if (new_capacity < capacity_) {
+            resize(new_capacity);
+        }
+    }
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::rehash_impl(size_type n, bool drop_expired) {
+    if (n == 0 && capacity_ == 0) {
+        return;
+    }
+    if (n == 0 && size_ == 0) {
+        rehash_empty();
+        return;
+    }
+    const size_type needed = std::max(n, growth_to_lower_bound_capacity(size_));
+    const size_type new_capacity = within_budget(normalize_capacity(needed));
+    if (n == 0 || new_capacity > capacity_) {
+        resize(new_capacity, drop_expired);
+    }
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::initialize(size_type capacity) {
+    const size_type units = ctrl_units(capacity) + capacity;
+    slot_type* mem = std::to_address(std::allocator_traits<allocator_type>::allocate(alloc_, units));
+    if constexpr (Evict::enabled) {
+        try {
+            evict_.rebuild(capacity);
+        } catch (...) {
+            deallocate(mem, capacity);
+            throw;
+        }
+    }
+    init_ctrl(reinterpret_cast<ctrl_t*>(mem), capacity);
+    slots_ = mem + ctrl_units(capacity);
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::grow() {
+    if (capacity_ == 0) {
+        resize(1);
+        return;
+    }
+    const size_type live = size_ - count_expired();
+    if (const size_type new_capacity = grown_capacity(live, thresholds, max_capacity())) {
+        resize(new_capacity);
+    } else {
+        evict_and_rebuild(capacity_, live);
+    }
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::evict_and_rebuild(size_type capacity, size_type live) {
+    if constexpr (Evict::enabled) {
+        const size_type growth = capacity_to_growth(capacity);
+        const size_type keep = growth - std::max<size_type>(1, growth / eviction_budget::evict_fraction);
+        const size_type wanted = live > keep ? live - keep : 0;
+        size_type evicted = 0;
+        while (evicted != wanted) {
+            const size_type index = evict_.victim(capacity_, [this](size_type i) {
+                return is_full(ctrl_[i]) && !Policy::expired(slots_[i]);
+            });
+            if (index == eviction_budget::npos) {
+                break;
+            }
+            erase_at(index);
+            ++evicted;
+        }
+        stats_.on_evict(evicted);
+        resize(capacity);
+    }
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::resize(size_type new_capacity, bool drop_expired) {
+    ctrl_t* old_ctrl = ctrl_;
+    slot_type* old_slots = slots_;
+    const size_type old_capacity = capacity_;
+    const size_type old_size = size_;
+    const size_type old_growth_left = growth_left_;
+    const size_type old_tombstones = tombstones_;
+
+    initialize(new_capacity);
+    old_slots_of old{this, old_slots, drop_expired, 0};
+    try {
+        for_each_full(old_ctrl, 0, old_capacity, relocate_old, &old);
+    } catch (...) {
+        if constexpr (copy_to_rebuild) {
+            destroy_slots(ctrl_, slots_, capacity_);
+            deallocate(slots_ - ctrl_units(capacity_), capacity_);
+            ctrl_ = old_ctrl;
+            slots_ = old_slots;
+            capacity_ = old_capacity;
+            size_ = old_size;
+            growth_left_ = old_growth_left;
+            tombstones_ = old_tombstones;
+            if constexpr (Evict::enabled) {
+                evict_.abandon_rebuild();
+            }
+        } else {
+            for_each_full(old_ctrl, old.next, old_capacity, destroy_old, &old);
+            finish_resize(old_slots, old_capacity);
+        }
+        throw;
+    }
+    stats_.on_rehash(old_capacity, new_capacity);
+    if constexpr (copy_to_rebuild) {
+        destroy_slots(old_ctrl, old_slots, old_capacity);
+    }
+    finish_resize(old_slots, old_capacity);
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::relocate(size_type from, slot_type* src,
+                                                                    bool drop_expired) noexcept(nothrow_relocate) {
+    if (drop_expired && Policy::expired(*src)) {
+        if constexpr (!copy_to_rebuild) {
+            Policy::destroy(alloc_, src);
+        }
+        return;
+    }
+    const size_type hash = Policy::hash_slot(hash_, *src);
+    const size_type target = find_first_non_full(hash);
+    if constexpr (copy_to_rebuild) {
+        Policy::construct(alloc_, slots_ + target, std::as_const(*src));
+    } else {
+        Policy::transfer(alloc_, slots_ + target, src);
+    }
+    set_ctrl(target, h2(hash));
+    if constexpr (Evict::enabled) {
+        evict_.moved(from, target);
+    }
+    ++size_;
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::finish_resize(slot_type* old_slots,
+                                                                         size_type old_capacity) noexcept {
+    growth_left_ = capacity_to_growth(capacity_) - size_;
+    if constexpr (Evict::enabled) {
+        evict_.rebuilt();
+    }
+    if (old_capacity) {
+        deallocate(old_slots - ctrl_units(old_capacity), old_capacity);
+    }
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::copy_from(const raw_table& other) {
+    if (other.size_ == 0) {
+        return;
+    }
+    reserve(other.size_);
+    old_slots_of from{this, other.slots_, true, 0};
+    for_each_full(
+        other.ctrl_, 0, other.capacity_,
+        [](void* context, size_type i) {
+            old_slots_of& from = *static_cast<old_slots_of*>(context);
+            const slot_type& slot = from.slots[i];
+            if (Policy::expired(slot)) {
+                return false;
+            }
+            raw_table& to = *from.table;
+            to.construct_at(to.prepare_insert(Policy::hash_slot(to.hash_, slot)), slot);
+            return true;
+        },
+        &from);
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::move_from(raw_table& other) {
+    reserve(other.size_);
+    old_slots_of from{this, other.slots_, true, 0};
+    for_each_full(
+        other.ctrl_, 0, other.capacity_,
+        [](void* context, size_type i) {
+            old_slots_of& from = *static_cast<old_slots_of*>(context);
+            slot_type& slot = from.slots[i];
+            if (Policy::expired(slot)) {
+                return false;
+            }
+            raw_table& to = *from.table;
+            to.construct_at(to.prepare_insert(Policy::hash_slot(to.hash_, slot)), std::move(slot));
+            return true;
+        },
+        &from);
+    other.clear();
+}
+
+template <class Policy, class Hash, class Alloc, class Resize, class Stats, class Evict>
+void raw_table<Policy, Hash, Alloc, Resize, Stats, Evict>::destroy_slots(const ctrl_t* ctrl, slot_type* slots,
+                                                                         size_type capacity) noexcept {
+    if constexpr (!std::is_trivially_destructible_v<slot_type>) {
+        old_slots_of old{this, slots, false, 0};
+        for_each_full(ctrl, 0, capacity, destroy_old, &old);
+    }
+}
+
+}  // namespace whm::detail
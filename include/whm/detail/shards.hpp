@@ -0,0 +1,347 @@
+#pragma once
+
+// Shard implementations for concurrent_weak_hash_map.
+//
+// Both shards take the key hash precomputed by the owning map (which needed
+// it to pick the shard) and expose the same value-based operations.
+//
+// locked_shard: a weak_hash_map behind a std::shared_mutex. Readers share the
+//   lock; entries are stored inline.
+// lock_free_shard: a published_table plus a writer mutex. Readers only pin an
+//   epoch; entries are immutable heap objects, so updates publish a copy.
+//   Growth migrates a few groups per write, so no write pays for a rehash
+//   of the whole shard.
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "../weak_hash_map.hpp"
+#include "config.hpp"
+#include "epoch.hpp"
+#include "published_table.hpp"
+
+namespace whm::detail {
+
+// `MapPolicies` are the trailing weak_hash_map parameters (Resize, Stats,
+// Layout) for the inner map.
+template <class K, class V, class Hash, class KeyEqual, class Alloc, class Sweep, class... MapPolicies>
+class alignas(cache_line_size) locked_shard {
+public:
+    using map_type = weak_hash_map<K, V, Hash, KeyEqual, Alloc, Sweep, MapPolicies...>;
+    using size_type = std::size_t;
+
+    locked_shard() = default;
+    locked_shard(const Hash& hash, const KeyEqual& eq, const Alloc& alloc) : map_(0, hash, eq, alloc) {}
+
+    size_type size() const {
+        std::shared_lock lock(mutex_);
+        return map_.size();
+    }
+
+    void clear() {
+        std::unique_lock lock(mutex_);
+        map_.clear();
+    }
+
+    void reserve(size_type n) {
+        std::unique_lock lock(mutex_);
+        map_.reserve(n);
+    }
+
+    void rehash(size_type n) {
+        std::unique_lock lock(mutex_);
+        map_.rehash(n);
+    }
+
+    size_type purge() {
+        std::unique_lock lock(mutex_);
+        return map_.purge();
+    }
+
+    std::optional<size_type> try_purge() {
+        std::unique_lock lock(mutex_, std::try_to_lock);
+        if (!lock) {
+            return std::nullopt;
+        }
+        return map_.purge();
+    }
+
+    template <class... Args>
+    bool try_emplace(size_type, const std::shared_ptr<K>& key, Args&&... args) {
+        std::unique_lock lock(mutex_);
+        return map_.try_emplace(key, std::forward<Args>(args)...).second;
+    }
+
+    template <class M>
+    bool insert_or_assign(size_type, const std::shared_ptr<K>& key, M&& value) {
+        std::unique_lock lock(mutex_);
+        return map_.insert_or_assign(key, std::forward<M>(value)).second;
+    }
+
+    std::optional<V> find(size_type, const K* p) const {
+        std::shared_lock lock(mutex_);
+        auto it = map_.find(p);
+        if (it == map_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    bool contains(size_type, const K* p) const {
+        std::shared_lock lock(mutex_);
+        return map_.contains(p);
+    }
+
+    template <class F>
+    bool visit(size_type, const K* p, F&& f) {
+        std::unique_lock lock(mutex_);
+        auto it = map_.find(p);
+        if (it == map_.end()) {
+            return false;
+        }
+        std::invoke(std::forward<F>(f), it->second);
+        return true;
+    }
+
+    template <class F>
+    bool visit(size_type, const K* p, F&& f) const {
+        std::shared_lock lock(mutex_);
+        auto it = map_.find(p);
+        if (it == map_.end()) {
+            return false;
+        }
+        std::invoke(std::forward<F>(f), it->second);
+        return true;
+    }
+
+    size_type erase(size_type, const K* p) {
+        std::unique_lock lock(mutex_);
+        return map_.erase(p);
+    }
+
+    template <class F>
+    void for_each(F&& f) const {
+        std::shared_lock lock(mutex_);
+        for (auto&& [key, value] : map_) {
+            std::invoke(f, key, value);
+        }
+    }
+
+    auto snapshot_live() const {
+        std::shared_lock lock(mutex_);
+        return map_.snapshot_live();
+    }
+
+    table_stats stats() const
+        requires map_type::stats_policy::enabled
+    {
+        std::shared_lock lock(mutex_);
+        return map_.stats();
+    }
+
+private:
+    mutable std::shared_mutex mutex_;
+    map_type map_;
+};
+
+template <class K, class V, class Hash, class KeyEqual, class Alloc, class Sweep, class... MapPolicies>
+class alignas(cache_line_size) lock_free_shard {
+    static_assert(sizeof...(MapPolicies) == 0, "lock_free_reads shards take no weak_hash_map policies");
+
+    struct entry {
+        template <class... Args>
+        entry(std::size_t h, const std::shared_ptr<K>& k, Args&&... args)
+            : hash(h), ptr(k.get()), key(k), value(std::forward<Args>(args)...) {}
+
+        bool expired() const noexcept { return key.expired(); }
+        const void* address() const noexcept { return ptr; }
+
+        std::size_t hash;
+        const K* ptr;
+        std::weak_ptr<K> key;
+        V value;
+    };
+
+    using table_type = published_table<entry, Alloc>;
+    using guard = epoch_domain::guard;
+
+public:
+    using size_type = std::size_t;
+
+    lock_free_shard() = default;
+    lock_free_shard(const Hash&, const KeyEqual& eq, const Alloc& alloc) : table_(alloc), eq_(eq) {}
+
+    size_type size() const { return table_.size(); }
+
+    void clear() {
+        std::lock_guard lock(mutex_);
+        table_.clear();
+        table_.reclaim();
+    }
+
+    void reserve(size_type n) {
+        std::lock_guard lock(mutex_);
+        table_.reserve(n);
+        table_.reclaim();
+    }
+
+    void rehash(size_type n) {
+        std::lock_guard lock(mutex_);
+        table_.rehash(n);
+        table_.reclaim();
+    }
+
+    size_type purge() {
+        std::lock_guard lock(mutex_);
+        const size_type removed = table_.purge();
+        table_.reclaim();
+        return removed;
+    }
+
+    std::optional<size_type> try_purge() {
+        std::unique_lock lock(mutex_, std::try_to_lock);
+        if (!lock) {
+            return std::nullopt;
+        }
+        const size_type removed = table_.purge();
+        table_.reclaim();
+        return removed;
+    }
+
+    template <class... Args>
+    bool try_emplace(size_type hash, const std::shared_ptr<K>& key, Args&&... args) {
+        std::lock_guard lock(mutex_);
+        write_step();
+        if (table_.find_locked(hash, matches(key.get()))) {
+            return false;
+        }
+        insert_new(table_.make_entry(hash, key, std::forward<Args>(args)...));
+        return true;
+    }
+
+    template <class M>
+    bool insert_or_assign(size_type hash, const std::shared_ptr<K>& key, M&& value) {
+        std::lock_guard lock(mutex_);
+        write_step();
+        entry* e = table_.make_entry(hash, key, std::forward<M>(value));
+        if (auto loc = table_.find_locked(hash, matches(key.get()))) {
+            table_.replace(loc, e);
+            return false;
+        }
+        insert_new(e);
+        return true;
+    }
+
+    std::optional<V> find(size_type hash, const K* p) const {
+        guard g(table_.domain());
+        if (const entry* e = table_.find(hash, matches(p))) {
+            return e->value;
+        }
+        return std::nullopt;
+    }
+
+    bool contains(size_type hash, const K* p) const {
+        guard g(table_.domain());
+        return table_.find(hash, matches(p)) != nullptr;
+    }
+
+    // Runs `f` on a private copy of the value and publishes the copy, so
+    // concurrent readers see either the old or the new value in full.
+    template <class F>
+    bool visit(size_type hash, const K* p, F&& f) {
+        std::lock_guard lock(mutex_);
+        write_step();
+        auto loc = table_.find_locked(hash, matches(p));
+        if (!loc) {
+            return false;
+        }
+        entry* copy = table_.make_entry(*loc.entry);
+        try {
+            std::invoke(std::forward<F>(f), copy->value);
+        } catch (...) {
+            table_.destroy_entry(copy);
+            throw;
+        }
+        table_.replace(loc, copy);
+        return true;
+    }
+
+    template <class F>
+    bool visit(size_type hash, const K* p, F&& f) const {
+        guard g(table_.domain());
+        const entry* e = table_.find(hash, matches(p));
+        if (e == nullptr) {
+            return false;
+        }
+        std::invoke(std::forward<F>(f), std::as_const(e->value));
+        return true;
+    }
+
+    size_type erase(size_type hash, const K* p) {
+        std::lock_guard lock(mutex_);
+        write_step();
+        auto loc = table_.find_locked(hash, matches(p));
+        if (!loc) {
+            return 0;
+        }
+        table_.erase(loc);
+        return 1;
+    }
+
+    // Visits the entries under the writer lock; readers are not blocked.
+    template <class F>
+    void for_each(F&& f) const {
+        std::lock_guard lock(mutex_);
+        table_.for_each([&f](const entry& e) { std::invoke(f, e.key, e.value); });
+    }
+
+    // Under the writer lock: during a migration an entry that is moving
+    // could be missed by an unlocked pass.
+    std::vector<std::pair<std::shared_ptr<K>, V>> snapshot_live() const {
+        std::vector<std::pair<std::shared_ptr<K>, V>> out;
+        std::lock_guard lock(mutex_);
+        out.reserve(table_.size());
+        table_.for_each([&out](const entry& e) {
+            if (std::shared_ptr<K> key = e.key.lock()) {
+                out.emplace_back(std::move(key), e.value);
+            }
+        });
+        return out;
+    }
+
+private:
+    auto matches(const K* p) const {
+        return [this, p](const entry& e) { return eq_(e.ptr, p) && !e.expired(); };
+    }
+
+    // Housekeeping done by every writer: the next step of a growth in
+    // progress, the Sweep policy's step and reclamation of objects retired
+    // by earlier writes.
+    void write_step() {
+        table_.migrate();
+        sweep_.step(table_);
+        table_.reclaim();
+    }
+
+    void insert_new(entry* e) {
+        try {
+            table_.insert(e);
+        } catch (...) {
+            table_.destroy_entry(e);
+            throw;
+        }
+    }
+
+    mutable std::mutex mutex_;
+    table_type table_;
+    [[no_unique_address]] KeyEqual eq_{};
+    [[no_unique_address]] Sweep sweep_{};
+};
+
+}  // namespace whm::detail
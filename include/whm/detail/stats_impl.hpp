@@ -0,0 +1,57 @@
+#pragma once
+
+// Definitions of the stats types' out-of-line members; see table_core.hpp
+// for when they are compiled inline and when once, into weak_hash_map_core.
+
+#include <algorithm>
+
+#include "../stats.hpp"
+
+namespace whm {
+
+table_stats& table_stats::operator+=(const table_stats& other) noexcept {
+    for (std::size_t i = 0; i != probe_buckets; ++i) {
+        probe_length[i] += other.probe_length[i];
+    }
+    hits += other.hits;
+    misses += other.misses;
+    expired_hits += other.expired_hits;
+    locks += other.locks;
+    sweeps += other.sweeps;
+    swept += other.swept;
+    sweep_time += other.sweep_time;
+    max_sweep_time = std::max(max_sweep_time, other.max_sweep_time);
+    rehash_grow += other.rehash_grow;
+    rehash_in_place += other.rehash_in_place;
+    rehash_shrink += other.rehash_shrink;
+    evictions += other.evictions;
+    size += other.size;
+    capacity += other.capacity;
+    tombstones += other.tombstones;
+    return *this;
+}
+
+table_stats collect_stats::snapshot(std::size_t size, std::size_t capacity, std::size_t tombstones) const noexcept {
+    table_stats s;
+    for (std::size_t i = 0; i != table_stats::probe_buckets; ++i) {
+        s.probe_length[i] = read(probe_length_[i]);
+    }
+    s.hits = read(hits_);
+    s.misses = read(misses_);
+    s.expired_hits = read(expired_hits_);
+    s.locks = read(locks_);
+    s.sweeps = read(sweeps_);
+    s.swept = read(swept_);
+    s.sweep_time = std::chrono::nanoseconds(read(sweep_ns_));
+    s.max_sweep_time = std::chrono::nanoseconds(read(max_sweep_ns_));
+    s.rehash_grow = read(rehash_grow_);
+    s.rehash_in_place = read(rehash_in_place_);
+    s.rehash_shrink = read(rehash_shrink_);
+    s.evictions = read(evictions_);
+    s.size = size;
+    s.capacity = capacity;
+    s.tombstones = tombstones;
+    return s;
+}
+
+}  // namespace whm
@@ -0,0 +1,165 @@
+#pragma once
+
+// The part of raw_table that does not depend on the slot type: the control
+// bytes, the counters, and the algorithms that only read or write those
+// (finding a free position, choosing between an empty byte and a tombstone,
+// choosing the capacity of a rebuild), and the loops over slots that do not
+// need to know their type. raw_table derives from it, so every
+// instantiation of the template shares one copy of that code.
+//
+// By default the core is compiled inline like the rest of the library.
+// Defining WHM_SEPARATE_CORE leaves only declarations in the headers; the
+// definitions are then compiled once, into the weak_hash_map_core library
+// (CMake option WHM_BUILD_CORE_LIBRARY, which defines it for its users).
+// Every translation unit of a program must make the same choice.
+
+#include <cstddef>
+
+#include "config.hpp"
+#include "group.hpp"
+
+namespace whm::detail {
+
+// The static members of a Resize policy (see policy.hpp), as values.
+struct resize_thresholds {
+    std::size_t rehash_in_place_percent;
+    std::size_t shrink_below_percent;
+    std::size_t shrink_target_percent;
+};
+
+class table_core {
+public:
+    using size_type = std::size_t;
+
+    static constexpr size_type npos = static_cast<size_type>(-1);
+
+    size_type size() const noexcept { return size_; }
+    size_type capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    // Erased slots still marked deleted. They are reused by insertions and
+    // cleared by every rebuild.
+    size_type tombstones() const noexcept { return tombstones_; }
+
+    bool is_full_at(size_type i) const noexcept { return is_full(ctrl_[i]); }
+    const ctrl_t* ctrl() const noexcept { return ctrl_; }
+
+    // Index of the first full slot at or after `i`, or `capacity()`.
+    WHM_CORE_API size_type next_full(size_type i) const noexcept;
+
+protected:
+    table_core() noexcept = default;
+    table_core(const table_core&) = delete;
+    table_core& operator=(const table_core&) = delete;
+    ~table_core() = default;
+
+    // Leaves `other` without storage.
+    table_core(table_core&& other) noexcept { take(other); }
+
+    // Takes the storage of `other`, which is left without any; the caller
+    // has released this table's own storage.
+    WHM_CORE_API void take(table_core& other) noexcept;
+
+    WHM_CORE_API void swap_core(table_core& other) noexcept;
+
+    // Forgets the storage: the table is empty and has no capacity.
+    WHM_CORE_API void reset_to_empty() noexcept;
+
+    // Adopts `ctrl`, storage for the control bytes of `capacity` slots, and
+    // marks every slot empty.
+    WHM_CORE_API void init_ctrl(ctrl_t* ctrl, size_type capacity) noexcept;
+
+    // Marks every slot empty and zeroes the counters, keeping the capacity.
+    WHM_CORE_API void clear_ctrl() noexcept;
+
+    void set_ctrl(size_type i, ctrl_t h) noexcept {
+        ctrl_[i] = h;
+        ctrl_[((i - num_cloned_bytes()) & capacity_) + (num_cloned_bytes() & capacity_)] = h;
+    }
+
+    void set_ctrl(size_type i, h2_t h) noexcept { set_ctrl(i, static_cast<ctrl_t>(h)); }
+
+    WHM_CORE_API size_type find_first_non_full(size_type hash) const noexcept;
+
+    // Whether an insertion at `target` needs the table rebuilt first.
+    bool must_grow(size_type target) const noexcept { return growth_left_ == 0 && !is_deleted(ctrl_[target]); }
+
+    // Counts a new entry at the free position `target`.
+    void claim(size_type target, size_type hash) noexcept {
+        ++size_;
+        growth_left_ -= is_empty(ctrl_[target]);
+        tombstones_ -= is_deleted(ctrl_[target]);
+        set_ctrl(target, h2(hash));
+    }
+
+    // A tombstone is only needed if some probe sequence may have passed over
+    // this slot while looking for a key further on. That can only happen if
+    // the window of `group::width` slots around it was ever full.
+    WHM_CORE_API bool was_never_full(size_type index) const noexcept;
+
+    // Turns every tombstone that erase_meta() would not need now back into
+    // an empty position. Only control bytes are read.
+    WHM_CORE_API void drop_tombstones() noexcept;
+
+    WHM_CORE_API void erase_meta(size_type index) noexcept;
+
+    // Capacity at which `n` entries fill at most `target_percent`.
+    WHM_CORE_API static size_type sparse_capacity(size_type n, size_type target_percent) noexcept;
+
+    // The capacity to rebuild at when an insertion finds no room and `live`
+    // of the entries are alive. Dead entries and tombstones use up the
+    // growth budget as well as live entries, so if the thresholds say the
+    // live ones fit, the table is rebuilt at the same capacity (or smaller),
+    // which drops the rest. Otherwise it doubles, unless that would exceed
+    // `max_capacity`: then the result is 0 and the caller must evict.
+    WHM_CORE_API size_type grown_capacity(size_type live, const resize_thresholds& resize,
+                                          size_type max_capacity) const noexcept;
+
+    // The loops of purges, sweeps, rebuilds and copies, which reach the
+    // slots through a function and a context that raw_table passes in. The
+    // call per slot is small next to the expiry check, destructor or move it
+    // makes, and the loops are compiled once for every slot type. Lookups
+    // and insertions stay in raw_table, inlined with their predicate.
+    using slot_test = bool (*)(const void* context, size_type index) noexcept;
+    using slot_visit = bool (*)(void* context, size_type index);
+
+    // Number of full slots for which `test` holds.
+    WHM_CORE_API size_type count_full_if(slot_test test, const void* context) const noexcept;
+
+    // Index of a slot for which `test` holds among the full slots whose
+    // control byte matches `hash`, or npos. Unlike raw_table::find(), this
+    // is not counted as a lookup.
+    WHM_CORE_API size_type find_full_if(size_type hash, slot_test test, const void* context) const noexcept;
+
+    // Calls `destroy_if` on each full slot in [begin, end), and erases the
+    // slots for which it returns true, having destroyed them. Returns the
+    // number erased.
+    WHM_CORE_API size_type erase_full_if(size_type begin, size_type end, slot_visit destroy_if, void* context);
+
+    // erase_full_if() over at most `budget` slots from `cursor` on, wrapping
+    // around at the end, and leaves `cursor` just past the last one.
+    WHM_CORE_API size_type sweep_full_if(size_type& cursor, size_type budget, slot_visit destroy_if, void* context);
+
+    // erase_full_if() that only marks the erased slots deleted, leaving the
+    // counters to the caller, so that tasks may run it concurrently on
+    // disjoint blocks.
+    WHM_CORE_API size_type tombstone_full_if(size_type begin, size_type end, slot_visit destroy_if,
+                                             void* context);
+
+    // Calls `visit` on each slot in [begin, end) that `ctrl` marks full, and
+    // returns the number of calls that returned true.
+    WHM_CORE_API static size_type for_each_full(const ctrl_t* ctrl, size_type begin, size_type end, slot_visit visit,
+                                                void* context);
+
+    ctrl_t* ctrl_ = const_cast<ctrl_t*>(empty_group);
+    size_type capacity_ = 0;
+    size_type size_ = 0;
+    size_type growth_left_ = 0;
+    size_type tombstones_ = 0;
+};
+
+}  // namespace whm::detail
+
+#if !defined(WHM_SEPARATE_CORE)
+#include "table_core_impl.hpp"
+#endif
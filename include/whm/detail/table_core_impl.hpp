@@ -0,0 +1,196 @@
+#pragma once
+
+// Definitions of table_core's out-of-line members. Included by
+// table_core.hpp unless WHM_SEPARATE_CORE is defined, and compiled once by
+// src/core.cpp when it is.
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include "table_core.hpp"
+
+namespace whm::detail {
+
+table_core::size_type table_core::next_full(size_type i) const noexcept {
+    while (i < capacity_ && !is_full(ctrl_[i])) {
+        ++i;
+    }
+    return i;
+}
+
+void table_core::take(table_core& other) noexcept {
+    ctrl_ = std::exchange(other.ctrl_, const_cast<ctrl_t*>(empty_group));
+    capacity_ = std::exchange(other.capacity_, 0);
+    size_ = std::exchange(other.size_, 0);
+    growth_left_ = std::exchange(other.growth_left_, 0);
+    tombstones_ = std::exchange(other.tombstones_, 0);
+}
+
+void table_core::swap_core(table_core& other) noexcept {
+    using std::swap;
+    swap(ctrl_, other.ctrl_);
+    swap(capacity_, other.capacity_);
+    swap(size_, other.size_);
+    swap(growth_left_, other.growth_left_);
+    swap(tombstones_, other.tombstones_);
+}
+
+void table_core::reset_to_empty() noexcept {
+    ctrl_ = const_cast<ctrl_t*>(empty_group);
+    capacity_ = 0;
+    size_ = 0;
+    growth_left_ = 0;
+    tombstones_ = 0;
+}
+
+void table_core::init_ctrl(ctrl_t* ctrl, size_type capacity) noexcept {
+    assert(capacity && ((capacity + 1) & capacity) == 0);
+    ctrl_ = ctrl;
+    capacity_ = capacity;
+    clear_ctrl();
+}
+
+void table_core::clear_ctrl() noexcept {
+    std::memset(ctrl_, ctrl_empty, capacity_ + 1 + num_cloned_bytes());
+    ctrl_[capacity_] = ctrl_sentinel;
+    size_ = 0;
+    growth_left_ = capacity_to_growth(capacity_);
+    tombstones_ = 0;
+}
+
+table_core::size_type table_core::find_first_non_full(size_type hash) const noexcept {
+    probe_seq seq(h1(hash), capacity_);
+    while (true) {
+        const group g(ctrl_ + seq.offset());
+        if (auto mask = g.match_empty_or_deleted()) {
+            return seq.offset(mask.lowest_bit_set());
+        }
+        seq.next();
+        assert(seq.index() <= capacity_ && "full table");
+    }
+}
+
+bool table_core::was_never_full(size_type index) const noexcept {
+    if (capacity_ < group::width) {
+        return true;
+    }
+    const size_type index_before = (index - group::width) & capacity_;
+    const auto empty_after = group(ctrl_ + index).match_empty();
+    const auto empty_before = group(ctrl_ + index_before).match_empty();
+    return empty_before && empty_after &&
+           (empty_after.trailing_zeros() + empty_before.leading_zeros()) < group::width;
+}
+
+void table_core::drop_tombstones() noexcept {
+    for (size_type i = 0; i != capacity_ && tombstones_ != 0; ++i) {
+        if (is_deleted(ctrl_[i]) && was_never_full(i)) {
+            set_ctrl(i, ctrl_empty);
+            ++growth_left_;
+            --tombstones_;
+        }
+    }
+}
+
+void table_core::erase_meta(size_type index) noexcept {
+    --size_;
+    const bool never_full = was_never_full(index);
+    set_ctrl(index, never_full ? ctrl_empty : ctrl_deleted);
+    growth_left_ += never_full;
+    tombstones_ += !never_full;
+}
+
+table_core::size_type table_core::sparse_capacity(size_type n, size_type target_percent) noexcept {
+    return normalize_capacity(
+        std::max(growth_to_lower_bound_capacity(n), (n * 100 + target_percent - 1) / target_percent));
+}
+
+table_core::size_type table_core::grown_capacity(size_type live, const resize_thresholds& resize,
+                                                 size_type max_capacity) const noexcept {
+    if (live * 100 < capacity_ * resize.shrink_below_percent) {
+        return std::min(capacity_, sparse_capacity(live + 1, resize.shrink_target_percent));
+    }
+    if (live < capacity_to_growth(capacity_) && live * 100 <= capacity_ * resize.rehash_in_place_percent) {
+        return capacity_;
+    }
+    return next_capacity(capacity_) > max_capacity ? 0 : next_capacity(capacity_);
+}
+
+table_core::size_type table_core::count_full_if(slot_test test, const void* context) const noexcept {
+    size_type n = 0;
+    for (size_type i = 0; i != capacity_; ++i) {
+        n += is_full(ctrl_[i]) && test(context, i);
+    }
+    return n;
+}
+
+table_core::size_type table_core::find_full_if(size_type hash, slot_test test, const void* context) const noexcept {
+    probe_seq seq(h1(hash), capacity_);
+    const h2_t fingerprint = h2(hash);
+    while (true) {
+        const group g(ctrl_ + seq.offset());
+        for (unsigned i : g.match(fingerprint)) {
+            if (test(context, seq.offset(i))) {
+                return seq.offset(i);
+            }
+        }
+        if (g.match_empty()) {
+            return npos;
+        }
+        seq.next();
+        assert(seq.index() <= capacity_ && "full table");
+    }
+}
+
+table_core::size_type table_core::erase_full_if(size_type begin, size_type end, slot_visit destroy_if,
+                                                void* context) {
+    size_type n = 0;
+    for (size_type i = begin; i != end; ++i) {
+        if (is_full(ctrl_[i]) && destroy_if(context, i)) {
+            erase_meta(i);
+            ++n;
+        }
+    }
+    return n;
+}
+
+table_core::size_type table_core::sweep_full_if(size_type& cursor, size_type budget, slot_visit destroy_if,
+                                                void* context) {
+    if (size_ == 0) {
+        return 0;
+    }
+    if (cursor >= capacity_) {
+        cursor = 0;
+    }
+    budget = std::min(budget, capacity_);
+    const size_type end = std::min(capacity_, cursor + budget);
+    const size_type wrapped = budget - (end - cursor);
+    size_type n = erase_full_if(cursor, end, destroy_if, context);
+    n += erase_full_if(0, wrapped, destroy_if, context);
+    cursor = wrapped != 0 || end == capacity_ ? wrapped : end;
+    return n;
+}
+
+table_core::size_type table_core::tombstone_full_if(size_type begin, size_type end, slot_visit destroy_if,
+                                                    void* context) {
+    size_type n = 0;
+    for (size_type i = begin; i != end; ++i) {
+        if (is_full(ctrl_[i]) && destroy_if(context, i)) {
+            set_ctrl(i, ctrl_deleted);
+            ++n;
+        }
+    }
+    return n;
+}
+
+table_core::size_type table_core::for_each_full(const ctrl_t* ctrl, size_type begin, size_type end, slot_visit visit,
+                                                void* context) {
+    size_type n = 0;
+    for (size_type i = begin; i != end; ++i) {
+        n += is_full(ctrl[i]) && visit(context, i);
+    }
+    return n;
+}
+
+}  // namespace whm::detail
@@ -0,0 +1,335 @@
+#pragma once
+
+// ephemeron_hash_map: weak keys whose values live exactly as long as the
+// key object.
+//
+// Keys are created by the map (make_key()) with a deleter that owns the
+// storage of their value: the value is destroyed together with the key,
+// just before the key object, and the entry is erased through the same
+// death notifications as tracked_sweep. Nothing else owns the value. A value
+// can refer back to its key with a plain pointer, a reference or a weak_ptr,
+// and the pointer or reference stays valid for the value's whole lifetime.
+// With weak_hash_map, whose values the map owns, a value that needs its key
+// has to own it, and then the entry never expires.
+//
+// A value must not own its key either: a shared_ptr from the value to its
+// own key is a reference cycle, which no reference count can see through,
+// so the key and the value would never be destroyed. try_emplace() refuses
+// such a value when it is created, by checking its arguments for owners of
+// the key and the key's use_count() for references taken while the value
+// is constructed. It cannot see ownership that the value acquires later.
+//
+// find() and try_emplace() return the value as a shared_ptr built with the
+// aliasing constructor over the key's control block: holding it pins the
+// key, and with it the value. Erasing an entry, clearing the map or
+// destroying it only removes the entries; each value still dies with its
+// key, so those pointers stay valid.
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "detail/expiry_queue.hpp"
+#include "detail/raw_table.hpp"
+#include "hash.hpp"
+#include "policy.hpp"
+#include "weak_hash_map.hpp"
+
+namespace whm {
+
+namespace detail {
+
+// Storage for one value inside a key's deleter. The deleter is only moved
+// while shared_ptr takes ownership, before any value exists.
+template <class V>
+class value_cell {
+public:
+    value_cell() = default;
+    value_cell([[maybe_unused]] value_cell&& other) noexcept { assert(!other.engaged_); }
+    value_cell& operator=(value_cell&&) = delete;
+
+    ~value_cell() { reset(); }
+
+    template <class... Args>
+    V& emplace(Args&&... args) {
+        assert(!engaged_);
+        V* v = ::new (static_cast<void*>(storage_)) V(std::forward<Args>(args)...);
+        engaged_ = true;
+        return *v;
+    }
+
+    void reset() noexcept {
+        if (engaged_) {
+            engaged_ = false;
+            std::launder(reinterpret_cast<V*>(storage_))->~V();
+        }
+    }
+
+    bool engaged() const noexcept { return engaged_; }
+    V* get() noexcept { return std::launder(reinterpret_cast<V*>(storage_)); }
+
+private:
+    alignas(V) unsigned char storage_[sizeof(V)];
+    bool engaged_ = false;
+};
+
+// Deleter installed by ephemeron_hash_map::make_key(). Independent of the
+// key's dynamic type so that std::get_deleter can find it from a
+// shared_ptr<K>.
+template <class K, class V>
+struct ephemeron_deleter {
+    void operator()(K*) noexcept {
+        value.reset();
+        destroy(object);
+        if (auto q = queue.lock()) {
+            q->push(node.release());
+        }
+    }
+
+    void* object;
+    void (*destroy)(void*) noexcept;
+    std::weak_ptr<expiry_queue> queue;
+    std::unique_ptr<expiry_node> node;
+    value_cell<V> value;
+};
+
+// Whether `arg` is a shared_ptr that shares ownership with `key`.
+template <class K, class Arg>
+bool shares_owner(const std::shared_ptr<K>& key, const Arg& arg) noexcept {
+    if constexpr (requires { typename Arg::element_type; }) {
+        if constexpr (std::is_same_v<Arg, std::shared_ptr<typename Arg::element_type>>) {
+            return !key.owner_before(arg) && !arg.owner_before(key);
+        }
+    }
+    return false;
+}
+
+}  // namespace detail
+
+template <class K, class V, class Hash = pointer_hash<K>, class KeyEqual = pointer_equal<K>,
+          class Alloc = std::allocator<std::pair<const std::weak_ptr<K>, V>>>
+class ephemeron_hash_map {
+    using deleter_type = detail::ephemeron_deleter<K, V>;
+    using policy = detail::weak_key_policy<K, V*>;
+    using table_type = detail::raw_table<policy, Hash, Alloc>;
+    using slot_type = typename policy::slot_type;
+
+public:
+    using key_type = std::weak_ptr<K>;
+    using element_type = K;
+    using mapped_type = V;
+    using size_type = std::size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Alloc;
+
+    ephemeron_hash_map() = default;
+
+    explicit ephemeron_hash_map(size_type bucket_count, const Hash& hash = Hash(), const KeyEqual& eq = KeyEqual(),
+                                const Alloc& alloc = Alloc())
+        : table_(bucket_count, hash, typename table_type::allocator_type(alloc)), eq_(eq) {}
+
+    explicit ephemeron_hash_map(const Alloc& alloc) : ephemeron_hash_map(0, Hash(), KeyEqual(), alloc) {}
+
+    // A key's value storage belongs to one map, so maps are not copyable.
+    ephemeron_hash_map(const ephemeron_hash_map&) = delete;
+    ephemeron_hash_map& operator=(const ephemeron_hash_map&) = delete;
+
+    ephemeron_hash_map(ephemeron_hash_map&&) noexcept = default;
+    ephemeron_hash_map& operator=(ephemeron_hash_map&&) noexcept = default;
+
+    // The values of keys that are still alive stay with their keys.
+    ~ephemeron_hash_map() = default;
+
+    // Number of stored entries, including those of keys that died since the
+    // last operation.
+    size_type size() const noexcept { return table_.size(); }
+    bool empty() const noexcept { return table_.empty(); }
+    size_type capacity() const noexcept { return table_.capacity(); }
+
+    void reserve(size_type n) { table_.reserve(n); }
+
+    // Removes every entry; the values stay with their keys.
+    void clear() noexcept { table_.clear(); }
+
+    // Erases the entries of dead keys. Returns the number removed.
+    size_type purge() {
+        sweep_.step(table_);
+        return table_.purge();
+    }
+
+    // Creates a key object that can carry a value in this map.
+    template <class T = K, class... Args>
+        requires std::is_convertible_v<T*, K*>
+    std::shared_ptr<T> make_key(Args&&... args) {
+        auto node = std::make_unique<detail::expiry_node>();
+        std::weak_ptr<detail::expiry_queue> queue = sweep_.get_queue();
+        auto object = std::make_unique<T>(std::forward<Args>(args)...);
+        const K* p = object.get();
+        node->address = p;
+        node->hash = hash_of(p);
+        // Only shared_ptr's own allocation can throw from here on, and it
+        // then calls the deleter, which frees the object.
+        T* raw = object.release();
+        deleter_type deleter{raw, [](void* q) noexcept { delete static_cast<T*>(q); }, std::move(queue),
+                             std::move(node), {}};
+        return std::shared_ptr<T>(raw, std::move(deleter));
+    }
+
+    // Constructs V(args...) as the value of `key`, unless it already has one,
+    // and enters it in the map. A key has one value for its whole life: if
+    // its entry was erased, the same value is entered again. Returns the
+    // value and whether it was created. Throws std::invalid_argument if `key`
+    // was not made by this map's make_key(), or if the new value would own
+    // `key`: if one of `args` shares ownership of it, or if constructing the
+    // value raised key.use_count(). The latter assumes that no other thread
+    // copies or releases `key` meanwhile.
+    template <class... Args>
+    std::pair<std::shared_ptr<V>, bool> try_emplace(const std::shared_ptr<K>& key, Args&&... args) {
+        sweep_.step(table_);
+        deleter_type* d = own_deleter(key);
+        if (d == nullptr) {
+            throw std::invalid_argument("ephemeron_hash_map: key not created by this map's make_key()");
+        }
+        const K* p = key.get();
+        if (find_index(p) != npos) {
+            return {std::shared_ptr<V>(key, d->value.get()), false};
+        }
+        const bool created = !d->value.engaged();
+        if (created) {
+            if ((detail::shares_owner(key, args) || ...)) {
+                throw std::invalid_argument("ephemeron_hash_map: value would own its key");
+            }
+            const long owners = key.use_count();
+            d->value.emplace(std::forward<Args>(args)...);
+            if (key.use_count() > owners) {
+                d->value.reset();
+                throw std::invalid_argument("ephemeron_hash_map: value would own its key");
+            }
+        }
+        V* value = d->value.get();
+        try {
+            const size_type index = table_.prepare_insert(hash_of(p));
+            table_.construct_at(index, std::in_place, key, value);
+        } catch (...) {
+            if (created) {
+                d->value.reset();
+            }
+            throw;
+        }
+        return {std::shared_ptr<V>(key, value), created};
+    }
+
+    // The value of `key`, aliasing the key's control block, or null.
+    std::shared_ptr<V> find(const K* p) {
+        sweep_.step(table_);
+        return pin(find_index(p));
+    }
+
+    std::shared_ptr<const V> find(const K* p) const { return pin(find_index(p)); }
+
+    template <detail::pointer_to<K> U>
+    std::shared_ptr<V> find(const std::shared_ptr<U>& key) {
+        return find(static_cast<const K*>(key.get()));
+    }
+
+    template <detail::pointer_to<K> U>
+    std::shared_ptr<const V> find(const std::shared_ptr<U>& key) const {
+        return find(static_cast<const K*>(key.get()));
+    }
+
+    bool contains(const K* p) const { return find_index(p) != npos; }
+
+    template <detail::pointer_to<K> U>
+    bool contains(const std::shared_ptr<U>& key) const {
+        return contains(static_cast<const K*>(key.get()));
+    }
+
+    // Erases the entry of `key`. Its value stays with the key, and
+    // try_emplace() enters it again.
+    size_type erase(const K* p) {
+        sweep_.step(table_);
+        const size_type index = find_index(p);
+        if (index == npos) {
+            return 0;
+        }
+        table_.erase_at(index);
+        return 1;
+    }
+
+    template <detail::pointer_to<K> U>
+    size_type erase(const std::shared_ptr<U>& key) {
+        return erase(static_cast<const K*>(key.get()));
+    }
+
+    // Calls `f(key, value)` for every entry whose key is alive, with the key
+    // pinned for the duration of the call.
+    template <class F>
+    void for_each(F&& f) {
+        for (size_type i = table_.next_full(0); i != table_.capacity(); i = table_.next_full(i + 1)) {
+            const slot_type& slot = table_.slot_at(i);
+            if (std::shared_ptr<K> key = slot.key.lock()) {
+                std::invoke(f, key, *slot.value);
+            }
+        }
+    }
+
+    template <class F>
+    void for_each(F&& f) const {
+        for (size_type i = table_.next_full(0); i != table_.capacity(); i = table_.next_full(i + 1)) {
+            const slot_type& slot = table_.slot_at(i);
+            if (std::shared_ptr<K> key = slot.key.lock()) {
+                std::invoke(f, key, std::as_const(*slot.value));
+            }
+        }
+    }
+
+    hasher hash_function() const { return table_.hash_ref(); }
+    key_equal key_eq() const { return eq_; }
+    allocator_type get_allocator() const { return allocator_type(table_.alloc_ref()); }
+
+private:
+    static constexpr size_type npos = table_type::npos;
+
+    size_type hash_of(const K* p) const { return table_.hash_ref()(p); }
+
+    auto matches(const K* p) const {
+        return [this, p](const slot_type& slot) { return eq_(slot.ptr, p) && !slot.key.expired(); };
+    }
+
+    size_type find_index(const K* p) const {
+        if (p == nullptr || table_.empty()) {
+            return npos;
+        }
+        return table_.find(hash_of(p), matches(p));
+    }
+
+    // The deleter of `key` if it was created by this map's make_key().
+    deleter_type* own_deleter(const std::shared_ptr<K>& key) const noexcept {
+        deleter_type* d = std::get_deleter<deleter_type>(key);
+        if (d == nullptr || d->queue.owner_before(sweep_.queue) || sweep_.queue.owner_before(d->queue)) {
+            return nullptr;
+        }
+        return d;
+    }
+
+    std::shared_ptr<V> pin(size_type index) const {
+        if (index == npos) {
+            return nullptr;
+        }
+        const slot_type& slot = table_.slot_at(index);
+        std::shared_ptr<K> key = slot.key.lock();
+        return key ? std::shared_ptr<V>(std::move(key), slot.value) : nullptr;
+    }
+
+    table_type table_;
+    [[no_unique_address]] KeyEqual eq_{};
+    tracked_sweep sweep_{};
+};
+
+}  // namespace whm
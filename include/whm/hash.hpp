@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+#include "detail/group.hpp"
+
+namespace whm {
+
+// Default hasher for weak keys. Entries are identified by the address of the
+// object the key points to, so the hash is a mixed pointer value. The
+// containers always hash a `const T*`; the shared_ptr overload is there for
+// callers that hash keys themselves and does not touch the reference count.
+template <class T>
+struct pointer_hash {
+    using is_transparent = void;
+
+    std::size_t operator()(const T* p) const noexcept {
+        return detail::mix(std::hash<const T*>{}(p));
+    }
+
+    std::size_t operator()(const std::shared_ptr<T>& p) const noexcept { return (*this)(p.get()); }
+};
+
+// Address equality between raw pointers and shared_ptrs, in any combination.
+template <class T>
+struct pointer_equal {
+    using is_transparent = void;
+
+    static const T* address(const T* p) noexcept { return p; }
+    static const T* address(const std::shared_ptr<T>& p) noexcept { return p.get(); }
+
+    template <class A, class B>
+    bool operator()(const A& a, const B& b) const noexcept {
+        return address(a) == address(b);
+    }
+};
+
+}  // namespace whm
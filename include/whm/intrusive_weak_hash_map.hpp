@@ -0,0 +1,437 @@
+#pragma once
+
+// intrusive_weak_hash_map: weak keys without any control block.
+//
+// Keys derive from weak_hash_map_trackable, which keeps an intrusive list of
+// the map entries naming the object. The object's destructor walks that
+// list and erases each entry from its map, so an entry disappears the moment
+// its key dies: there are no expired entries, no purge() and no sweeping,
+// and lookups are plain address comparisons with no reference counts.
+//
+// Entries are linked in place: a slot carries the list node, and moving a
+// slot during a rehash repoints its neighbours. Each map has a small heap
+// anchor that its nodes refer to, so that moving or swapping a map does not
+// have to visit its entries.
+//
+// Nothing here is synchronised. Key objects must be destroyed on the thread
+// that uses their maps, or under the same lock. The destructor of a value
+// runs while its key is being destroyed (from the base class destructor) and
+// must not touch the key or destroy other keys of the same map.
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "detail/iterator.hpp"
+#include "detail/raw_table.hpp"
+#include "hash.hpp"
+
+namespace whm {
+
+namespace detail {
+
+struct link_owner;
+
+// Node of a key object's list of entries. The object's head is a sentinel
+// with no owner; the list is circular.
+struct intrusive_link {
+    intrusive_link() noexcept = default;
+    intrusive_link(const intrusive_link&) = delete;
+    intrusive_link& operator=(const intrusive_link&) = delete;
+
+    bool linked() const noexcept { return next != this; }
+
+    void link_after(intrusive_link& pos, link_owner* o) noexcept {
+        prev = &pos;
+        next = pos.next;
+        next->prev = this;
+        pos.next = this;
+        owner = o;
+    }
+
+    // Takes over the list position of `other`, which is left unlinked.
+    void replace(intrusive_link& other) noexcept {
+        prev = other.prev;
+        next = other.next;
+        owner = other.owner;
+        prev->next = this;
+        next->prev = this;
+        other.prev = other.next = &other;
+    }
+
+    void unlink() noexcept {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+
+    intrusive_link* prev = this;
+    intrusive_link* next = this;
+    link_owner* owner = nullptr;
+};
+
+// What a node knows about its map: how to erase the entry holding it.
+struct link_owner {
+    void (*erase)(link_owner*, intrusive_link*) noexcept;
+};
+
+template <class K, class V>
+struct intrusive_key_policy;
+
+}  // namespace detail
+
+class weak_hash_map_trackable {
+protected:
+    weak_hash_map_trackable() noexcept = default;
+
+    // A copy is a different object and starts in no map.
+    weak_hash_map_trackable(const weak_hash_map_trackable&) noexcept {}
+    weak_hash_map_trackable& operator=(const weak_hash_map_trackable&) noexcept { return *this; }
+
+    // Erases the object from every map. Runs after the destructors of
+    // derived classes.
+    ~weak_hash_map_trackable() {
+        while (head_.linked()) {
+            detail::intrusive_link* link = head_.next;
+            link->owner->erase(link->owner, link);
+        }
+    }
+
+private:
+    template <class K, class V>
+    friend struct detail::intrusive_key_policy;
+
+    detail::intrusive_link head_;
+};
+
+namespace detail {
+
+template <class K, class V>
+struct intrusive_key_policy {
+    struct slot_type : intrusive_link {
+        template <class... Args>
+        slot_type(K* p, link_owner* owner, Args&&... args) : ptr(p), value(std::forward<Args>(args)...) {
+            link_after(static_cast<weak_hash_map_trackable*>(p)->head_, owner);
+        }
+
+        slot_type(slot_type&& other) noexcept(std::is_nothrow_move_constructible_v<V>)
+            : ptr(other.ptr), value(std::move(other.value)) {
+            replace(other);
+        }
+
+        ~slot_type() {
+            if (linked()) {
+                unlink();
+            }
+        }
+
+        K* ptr;
+        V value;
+    };
+
+    template <class A, class... Args>
+    static void construct(A& alloc, slot_type* slot, Args&&... args) {
+        std::allocator_traits<A>::construct(alloc, slot, std::forward<Args>(args)...);
+    }
+
+    template <class A>
+    static void destroy(A& alloc, slot_type* slot) noexcept {
+        std::allocator_traits<A>::destroy(alloc, slot);
+    }
+
+    template <class A>
+    static void transfer(A& alloc, slot_type* dst, slot_type* src) noexcept(
+        std::is_nothrow_move_constructible_v<slot_type>) {
+        construct(alloc, dst, std::move(*src));
+        destroy(alloc, src);
+    }
+
+    template <class H>
+    static std::size_t hash_slot(const H& hash, const slot_type& slot) noexcept(
+        std::is_nothrow_invocable_v<const H&, const K*>) {
+        return hash(static_cast<const K*>(slot.ptr));
+    }
+
+    static bool expired(const slot_type&) noexcept { return false; }
+
+    static const void* address(const slot_type& slot) noexcept { return slot.ptr; }
+};
+
+}  // namespace detail
+
+template <class K, class V, class Hash = pointer_hash<K>, class KeyEqual = pointer_equal<K>,
+          class Alloc = std::allocator<std::pair<K* const, V>>>
+class intrusive_weak_hash_map {
+    static_assert(std::is_base_of_v<weak_hash_map_trackable, K>,
+                  "intrusive_weak_hash_map keys must derive from weak_hash_map_trackable");
+
+    using policy = detail::intrusive_key_policy<K, V>;
+    using table_type = detail::raw_table<policy, Hash, Alloc>;
+    using slot_type = typename policy::slot_type;
+
+    struct anchor : detail::link_owner {
+        explicit anchor(intrusive_weak_hash_map* m) noexcept : link_owner{&erase_link}, map(m) {}
+
+        static void erase_link(detail::link_owner* owner, detail::intrusive_link* link) noexcept {
+            intrusive_weak_hash_map& m = *static_cast<anchor*>(owner)->map;
+            m.table_.erase_at(static_cast<size_type>(static_cast<slot_type*>(link) - &m.table_.slot_at(0)));
+        }
+
+        intrusive_weak_hash_map* map;
+    };
+
+public:
+    using key_type = K*;
+    using element_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K* const, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Alloc;
+    using reference = std::pair<K* const&, V&>;
+    using const_reference = std::pair<K* const&, const V&>;
+
+private:
+    template <bool Const>
+    class basic_iterator {
+        friend class intrusive_weak_hash_map;
+        using table_ptr = std::conditional_t<Const, const table_type*, table_type*>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = intrusive_weak_hash_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference =
+            std::conditional_t<Const, intrusive_weak_hash_map::const_reference, intrusive_weak_hash_map::reference>;
+        using pointer = detail::arrow_proxy<reference>;
+
+        basic_iterator() noexcept = default;
+
+        template <bool C = Const, class = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false>& other) noexcept
+            : table_(other.table_), index_(other.index_) {}
+
+        reference operator*() const noexcept {
+            auto& slot = table_->slot_at(index_);
+            return reference(slot.ptr, slot.value);
+        }
+
+        pointer operator->() const noexcept { return pointer{**this}; }
+
+        basic_iterator& operator++() noexcept {
+            index_ = table_->next_full(index_ + 1);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept {
+            basic_iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        friend bool operator==(const basic_iterator& a, const basic_iterator& b) noexcept {
+            return a.index_ == b.index_;
+        }
+
+    private:
+        basic_iterator(table_ptr table, size_type index) noexcept : table_(table), index_(index) {}
+
+        table_ptr table_ = nullptr;
+        size_type index_ = 0;
+    };
+
+public:
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    intrusive_weak_hash_map() = default;
+
+    explicit intrusive_weak_hash_map(size_type bucket_count, const Hash& hash = Hash(),
+                                     const KeyEqual& eq = KeyEqual(), const Alloc& alloc = Alloc())
+        : table_(bucket_count, hash, typename table_type::allocator_type(alloc)), eq_(eq) {}
+
+    explicit intrusive_weak_hash_map(const Alloc& alloc) : intrusive_weak_hash_map(0, Hash(), KeyEqual(), alloc) {}
+
+    intrusive_weak_hash_map(const intrusive_weak_hash_map& other)
+        : table_(0, other.table_.hash_ref(),
+                 std::allocator_traits<typename table_type::allocator_type>::select_on_container_copy_construction(
+                     other.table_.alloc_ref())),
+          eq_(other.eq_) {
+        insert_all(other);
+    }
+
+    intrusive_weak_hash_map(intrusive_weak_hash_map&& other) noexcept
+        : table_(std::move(other.table_)), eq_(std::move(other.eq_)), anchor_(std::move(other.anchor_)) {
+        rebind_anchor();
+    }
+
+    intrusive_weak_hash_map& operator=(const intrusive_weak_hash_map& other) {
+        if (this != &other) {
+            intrusive_weak_hash_map tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    // Entries moved from `other` keep pointing at its anchor, which moves
+    // along with them.
+    intrusive_weak_hash_map& operator=(intrusive_weak_hash_map&& other) noexcept {
+        if (this != &other) {
+            clear();
+            table_ = std::move(other.table_);
+            eq_ = std::move(other.eq_);
+            anchor_ = std::move(other.anchor_);
+            rebind_anchor();
+        }
+        return *this;
+    }
+
+    ~intrusive_weak_hash_map() { clear(); }
+
+    iterator begin() noexcept { return iterator(&table_, table_.next_full(0)); }
+    iterator end() noexcept { return iterator(&table_, table_.capacity()); }
+    const_iterator begin() const noexcept { return const_iterator(&table_, table_.next_full(0)); }
+    const_iterator end() const noexcept { return const_iterator(&table_, table_.capacity()); }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    // Every stored entry has a live key.
+    size_type size() const noexcept { return table_.size(); }
+    bool empty() const noexcept { return table_.empty(); }
+    size_type capacity() const noexcept { return table_.capacity(); }
+
+    void clear() noexcept { table_.clear(); }
+    void reserve(size_type n) { table_.reserve(n); }
+    void rehash(size_type n) { table_.rehash(n); }
+    void shrink_to_fit() { table_.shrink_to_fit(); }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K* key, Args&&... args) {
+        assert(key && "intrusive_weak_hash_map keys must not be null");
+        detail::link_owner* owner = get_anchor();
+        auto [index, inserted] = table_.find_or_prepare_insert(hash_of(key), matches(key));
+        if (inserted) {
+            table_.construct_at(index, key, owner, std::forward<Args>(args)...);
+        }
+        return {iterator(&table_, index), inserted};
+    }
+
+    std::pair<iterator, bool> insert(K* key, const V& value) { return try_emplace(key, value); }
+    std::pair<iterator, bool> insert(K* key, V&& value) { return try_emplace(key, std::move(value)); }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(K* key, M&& value) {
+        auto result = try_emplace(key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result;
+    }
+
+    V& operator[](K* key) { return try_emplace(key).first->second; }
+
+    iterator find(const K* p) { return make_iterator(find_index(p)); }
+    const_iterator find(const K* p) const { return make_iterator(find_index(p)); }
+
+    bool contains(const K* p) const { return find_index(p) != npos; }
+    size_type count(const K* p) const { return contains(p) ? 1 : 0; }
+
+    V& at(const K* p) {
+        const size_type index = find_index(p);
+        if (index == npos) {
+            throw std::out_of_range("intrusive_weak_hash_map::at: key not found");
+        }
+        return table_.slot_at(index).value;
+    }
+
+    const V& at(const K* p) const { return const_cast<intrusive_weak_hash_map*>(this)->at(p); }
+
+    size_type erase(const K* p) {
+        const size_type index = find_index(p);
+        if (index == npos) {
+            return 0;
+        }
+        table_.erase_at(index);
+        return 1;
+    }
+
+    iterator erase(const_iterator pos) {
+        table_.erase_at(pos.index_);
+        return iterator(&table_, table_.next_full(pos.index_ + 1));
+    }
+
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+    void swap(intrusive_weak_hash_map& other) noexcept {
+        table_.swap(other.table_);
+        using std::swap;
+        swap(eq_, other.eq_);
+        anchor_.swap(other.anchor_);
+        rebind_anchor();
+        other.rebind_anchor();
+    }
+
+    friend void swap(intrusive_weak_hash_map& a, intrusive_weak_hash_map& b) noexcept { a.swap(b); }
+
+    hasher hash_function() const { return table_.hash_ref(); }
+    key_equal key_eq() const { return eq_; }
+    allocator_type get_allocator() const { return allocator_type(table_.alloc_ref()); }
+
+private:
+    static constexpr size_type npos = table_type::npos;
+
+    size_type hash_of(const K* p) const { return table_.hash_ref()(p); }
+
+    auto matches(const K* p) const {
+        return [this, p](const slot_type& slot) { return eq_(static_cast<const K*>(slot.ptr), p); };
+    }
+
+    size_type find_index(const K* p) const {
+        if (p == nullptr || table_.empty()) {
+            return npos;
+        }
+        return table_.find(hash_of(p), matches(p));
+    }
+
+    iterator make_iterator(size_type index) noexcept {
+        return index == npos ? end() : iterator(&table_, index);
+    }
+
+    const_iterator make_iterator(size_type index) const noexcept {
+        return index == npos ? end() : const_iterator(&table_, index);
+    }
+
+    anchor* get_anchor() {
+        if (!anchor_) {
+            anchor_ = std::make_unique<anchor>(this);
+        }
+        return anchor_.get();
+    }
+
+    void rebind_anchor() noexcept {
+        if (anchor_) {
+            anchor_->map = this;
+        }
+    }
+
+    void insert_all(const intrusive_weak_hash_map& other) {
+        table_.reserve(other.size());
+        for (size_type i = other.table_.next_full(0); i != other.table_.capacity(); i = other.table_.next_full(i + 1)) {
+            const slot_type& slot = other.table_.slot_at(i);
+            try_emplace(slot.ptr, slot.value);
+        }
+    }
+
+    table_type table_;
+    [[no_unique_address]] KeyEqual eq_{};
+    std::unique_ptr<anchor> anchor_;
+};
+
+}  // namespace whm
@@ -0,0 +1,132 @@
+#pragma once
+
+// Policy bundles: one type that fixes every compile-time choice of a weak
+// map, so that each role gets its own specialised container.
+//
+//   map_config<KeyKind, Threading, Sweep, Stats, Layout, Resize, Evict>
+//     KeyKind    weak_keys (weak_hash_map) or weak_values (weak_value_hash_map)
+//     Threading  single_threaded, or sharded<Reads> for concurrent_weak_hash_map
+//     Sweep      no_sweep, incremental_sweep<N>, or tracked_sweep for
+//                single-threaded maps (policy.hpp)
+//     Stats      no_stats or collect_stats (stats.hpp)
+//     Layout     slot_layout<Key, CacheHash> (policy.hpp)
+//     Resize     default_resize_policy or shrink_on_sparse<> (policy.hpp)
+//     Evict      no_eviction, or clock_eviction for single-threaded maps
+//                given a memory budget (policy.hpp)
+//
+//   whm::configured_map<Object, Metadata, whm::registry_config> registry;
+//
+// Everything is resolved at compile time. With the defaults a single-threaded
+// map holds no atomics, stats counters or cached hashes and tests no runtime
+// flags; disabled policies are empty members. Combinations a container does
+// not support are rejected by static_assert. Maps that need a custom hasher
+// or allocator use the container templates directly.
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "concurrent_weak_hash_map.hpp"
+#include "policy.hpp"
+#include "stats.hpp"
+#include "weak_hash_map.hpp"
+#include "weak_value_hash_map.hpp"
+
+namespace whm {
+
+// Threading models.
+struct single_threaded {};
+
+template <class Reads = locked_reads>
+struct sharded {
+    using read_policy = Reads;
+};
+
+// Key kinds.
+struct weak_keys {};
+struct weak_values {};
+
+template <class KeyKind = weak_keys, class Threading = single_threaded, class Sweep = no_sweep, class Stats = no_stats,
+          class Layout = slot_layout<>, class Resize = default_resize_policy, class Evict = no_eviction>
+struct map_config {
+    using key_kind = KeyKind;
+    using threading = Threading;
+    using sweep_policy = Sweep;
+    using stats_policy = Stats;
+    using slot_layout_policy = Layout;
+    using resize_policy = Resize;
+    using eviction_policy = Evict;
+};
+
+// A per-frame table: one thread, expired entries left to purge().
+using frame_table_config = map_config<>;
+
+// A process-wide registry shared by many threads, swept as it is used.
+using registry_config = map_config<weak_keys, sharded<locked_reads>, incremental_sweep<8>>;
+
+// A cache deduplicating shared resources by key.
+using cache_config = map_config<weak_values, single_threaded, incremental_sweep<8>>;
+
+// The same cache held to a memory budget; see set_memory_budget().
+using bounded_cache_config = map_config<weak_values, single_threaded, incremental_sweep<8>, no_stats, slot_layout<>,
+                                        default_resize_policy, clock_eviction>;
+
+namespace detail {
+
+template <class Config>
+inline constexpr bool default_table_policies =
+    std::is_same_v<typename Config::stats_policy, no_stats> &&
+    std::is_same_v<typename Config::slot_layout_policy, slot_layout<>> &&
+    std::is_same_v<typename Config::resize_policy, default_resize_policy> &&
+    std::is_same_v<typename Config::eviction_policy, no_eviction>;
+
+template <class K, class V, class Config, class KeyKind = typename Config::key_kind,
+          class Threading = typename Config::threading>
+struct configured_map;
+
+template <class K, class V, class Config>
+struct configured_map<K, V, Config, weak_keys, single_threaded> {
+    using type = weak_hash_map<K, V, pointer_hash<K>, pointer_equal<K>,
+                               std::allocator<std::pair<const std::weak_ptr<K>, V>>, typename Config::sweep_policy,
+                               typename Config::resize_policy, typename Config::stats_policy,
+                               typename Config::slot_layout_policy, typename Config::eviction_policy>;
+};
+
+template <class K, class V, class Config>
+struct configured_map<K, V, Config, weak_keys, sharded<locked_reads>> {
+    static_assert(std::is_same_v<typename Config::eviction_policy, no_eviction>,
+                  "concurrent_weak_hash_map has no memory budget: Evict must be no_eviction");
+
+    using type = concurrent_weak_hash_map<K, V, pointer_hash<K>, pointer_equal<K>,
+                                          std::allocator<std::pair<const std::weak_ptr<K>, V>>,
+                                          typename Config::sweep_policy, locked_reads, typename Config::resize_policy,
+                                          typename Config::stats_policy, typename Config::slot_layout_policy>;
+};
+
+template <class K, class V, class Config>
+struct configured_map<K, V, Config, weak_keys, sharded<lock_free_reads>> {
+    static_assert(default_table_policies<Config>,
+                  "lock_free_reads keeps its own entries: Stats, Layout, Resize and Evict must be the defaults");
+
+    using type = concurrent_weak_hash_map<K, V, pointer_hash<K>, pointer_equal<K>,
+                                          std::allocator<std::pair<const std::weak_ptr<K>, V>>,
+                                          typename Config::sweep_policy, lock_free_reads>;
+};
+
+template <class K, class V, class Config>
+struct configured_map<K, V, Config, weak_values, single_threaded> {
+    static_assert(std::is_same_v<typename Config::slot_layout_policy, slot_layout<>>,
+                  "weak_value_hash_map has a single slot layout");
+
+    using type = weak_value_hash_map<K, V, std::hash<K>, std::equal_to<K>,
+                                     std::allocator<std::pair<const K, std::weak_ptr<V>>>,
+                                     typename Config::sweep_policy, typename Config::resize_policy,
+                                     typename Config::stats_policy, typename Config::eviction_policy>;
+};
+
+}  // namespace detail
+
+template <class K, class V, class Config = map_config<>>
+using configured_map = typename detail::configured_map<K, V, Config>::type;
+
+}  // namespace whm
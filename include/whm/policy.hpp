@@ -0,0 +1,284 @@
+#pragma once
+
+// Policies that tune how a weak container reclaims expired entries.
+//
+// Besides purge() and table rebuilds, a sweep policy gets a chance to do a
+// bounded amount of cleanup at the start of every mutating operation
+// (insertion, erase, non-const find). Keeping that work bounded keeps the
+// cost of each operation independent of the table size.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "detail/expiry_queue.hpp"
+
+namespace whm {
+
+// Thresholds for rebuilding a table that has run out of room. Erased and
+// expired entries use up room just like live ones, so the table counts them
+// first. If live entries fill at most `rehash_in_place_percent` percent of
+// the capacity, the table is rebuilt at the same capacity, which drops the
+// dead entries and tombstones. Otherwise it doubles. A custom policy is any
+// type with the same static members.
+//
+// Tables never shrink on their own with this policy (shrink_below_percent
+// is 0); see shrink_on_sparse.
+struct default_resize_policy {
+    static constexpr std::size_t rehash_in_place_percent = 50;
+    static constexpr std::size_t shrink_below_percent = 0;
+    static constexpr std::size_t shrink_target_percent = 50;
+};
+
+// Also shrinks the table after purge() or erase() leave fewer than
+// `BelowPercent` percent of its slots occupied. It is rebuilt at the smallest
+// capacity that the remaining entries fill to at most `TargetPercent`
+// percent. The gap between the two thresholds is the hysteresis: after
+// shrinking, the load is at least about TargetPercent / 2 percent, well
+// above the shrink threshold and well below the 87.5% that triggers growth.
+template <std::size_t BelowPercent = 12, std::size_t TargetPercent = 50>
+struct shrink_on_sparse : default_resize_policy {
+    static_assert(BelowPercent > 0 && BelowPercent * 2 < TargetPercent && TargetPercent < 87,
+                  "shrink_on_sparse needs 0 < 2 * BelowPercent < TargetPercent < 87");
+
+    static constexpr std::size_t shrink_below_percent = BelowPercent;
+    static constexpr std::size_t shrink_target_percent = TargetPercent;
+};
+
+// How the slots of a table are used. live + expired is size().
+struct slot_counts {
+    std::size_t live = 0;
+    std::size_t expired = 0;     // dead keys (or values) not yet reclaimed
+    std::size_t tombstones = 0;  // erased slots still marked deleted
+};
+
+// How weak_hash_map slots hold their keys.
+//   automatic  weak_ref for keys derived from weak_trackable, else weak_ptr
+//   weak_ptr   cached address plus std::weak_ptr, whatever the key type
+//   weak_ref   weak_ref; keys must derive from weak_trackable
+// With CacheHash, slots also keep their key's hash, so rebuilding a table
+// does not call the hasher again; worth it only for costly hashers.
+enum class slot_key { automatic, weak_ptr, weak_ref };
+
+template <slot_key Key = slot_key::automatic, bool CacheHash = false>
+struct slot_layout {
+    static constexpr slot_key key = Key;
+    static constexpr bool cache_hash = CacheHash;
+};
+
+// Expired entries are reclaimed only by purge() and when the table is rebuilt.
+struct no_sweep {
+    template <class Table>
+    void step(Table&) noexcept {}
+};
+
+// Every operation examines the next `SlotsPerOp` slots in table order and
+// erases the expired entries among them, so a full pass over the table is
+// spread across capacity / SlotsPerOp operations.
+template <std::size_t SlotsPerOp = 8>
+struct incremental_sweep {
+    static_assert(SlotsPerOp > 0, "incremental_sweep needs a positive budget");
+
+    static constexpr std::size_t budget = SlotsPerOp;
+
+    template <class Table>
+    void step(Table& table) {
+        table.sweep(cursor, budget);
+    }
+
+    std::size_t cursor = 0;
+};
+
+// Keys created by the container's make_tracked() report their own death, and
+// each operation erases exactly the entries that were reported since the
+// previous one. Keys inserted any other way still expire lazily.
+//
+// The queue is created by the first make_tracked() call and belongs to this
+// container only: a copy starts with no queue of its own. The queue and its
+// nodes come from the global heap, not the container's allocator, because
+// the key objects' deleters may reach them after the container is gone.
+struct tracked_sweep {
+    tracked_sweep() = default;
+    tracked_sweep(const tracked_sweep&) noexcept {}
+    tracked_sweep(tracked_sweep&&) noexcept = default;
+    tracked_sweep& operator=(const tracked_sweep&) noexcept { return *this; }
+    tracked_sweep& operator=(tracked_sweep&&) noexcept = default;
+
+    template <class Table>
+    void step(Table& table) {
+        if (!queue) {
+            return;
+        }
+        detail::expiry_node* list = queue->take_all();
+        for (detail::expiry_node* node = list; node; node = node->next) {
+            table.erase_expired(node->hash, node->address);
+        }
+        detail::expiry_queue::free_list(list);
+    }
+
+    const std::shared_ptr<detail::expiry_queue>& get_queue() {
+        if (!queue) {
+            queue = std::make_shared<detail::expiry_queue>();
+        }
+        return queue;
+    }
+
+    // Bytes of the queue and the notifications waiting in it.
+    std::size_t memory_usage() const noexcept {
+        return queue ? sizeof(detail::expiry_queue) + queue->pending() * sizeof(detail::expiry_node) : 0;
+    }
+
+    std::shared_ptr<detail::expiry_queue> queue;
+};
+
+// Eviction policies: which live entries a map with a memory budget gives up.
+//
+// With no_eviction, the default, tables grow as far as their entries need.
+// Otherwise the map's set_memory_budget(bytes) caps the table: it grows only
+// while the larger table, with the policy's own state, fits in `bytes`; a
+// lower budget shrinks it at once. An insertion that finds the capped table
+// full first rebuilds it in place, which drops the expired entries and
+// tombstones. If the live entries would still leave less than
+// 1 / evict_fraction of its room free, the policy picks live entries to
+// evict until they do, so evictions come in batches and each insertion pays
+// a bounded share of the rebuilds. The budget covers the table, not the
+// objects the keys or values point to.
+//
+// An eviction policy is either no_eviction or a type like clock_eviction:
+//   static constexpr bool enabled = true;
+//   static std::size_t state_bytes(std::size_t capacity) noexcept;
+//   void touch(std::size_t index) const noexcept;     // hit or insertion
+//   void rebuild(std::size_t capacity);               // table rebuilt at capacity
+//   void moved(std::size_t from, std::size_t to) noexcept;  // during the rebuild
+//   void rebuilt() noexcept;                          // after the last moved()
+//   void abandon_rebuild() noexcept;                  // rebuild failed: back to before it
+//   template <class Live> std::size_t victim(std::size_t capacity, Live&& live);
+// where victim() returns an index for which live(index) holds, or npos once
+// it has looked long enough to be sure that none does, and the budget is
+// kept by an eviction_budget base. Copies keep the budget only.
+struct no_eviction {
+    static constexpr bool enabled = false;
+};
+
+struct eviction_budget {
+    static constexpr std::size_t unlimited = static_cast<std::size_t>(-1);
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    static constexpr std::size_t evict_fraction = 16;
+
+    std::size_t budget_bytes = unlimited;
+    std::size_t max_capacity = unlimited;  // largest capacity within budget_bytes
+};
+
+// CLOCK, or second chance: every slot has a reference bit, set when a lookup
+// hits its entry or the entry is inserted. The hand goes round the slots,
+// clearing the bits that are set, and evicts the first live entry whose bit
+// was already clear: entries used since the hand last passed them survive.
+// The bits take one bit per slot and follow the entries when the table is
+// rebuilt. A rebuild at the same capacity leaves the hand where it was,
+// although entries may move to other slots, so in that turn the hand can
+// pass an entry twice or miss it once. The bits are set with relaxed
+// atomics, so const lookups may still run concurrently.
+class clock_eviction : public eviction_budget {
+    using word = std::atomic<std::uint64_t>;
+
+public:
+    static constexpr bool enabled = true;
+
+    clock_eviction() = default;
+    clock_eviction(const clock_eviction& other) noexcept : eviction_budget(other) {}
+
+    clock_eviction(clock_eviction&& other) noexcept
+        : eviction_budget(other),
+          bits_(std::move(other.bits_)),
+          capacity_(std::exchange(other.capacity_, 0)),
+          hand_(std::exchange(other.hand_, 0)) {}
+
+    clock_eviction& operator=(const clock_eviction& other) noexcept {
+        eviction_budget::operator=(other);
+        return *this;
+    }
+
+    clock_eviction& operator=(clock_eviction&& other) noexcept {
+        eviction_budget::operator=(other);
+        bits_ = std::move(other.bits_);
+        capacity_ = std::exchange(other.capacity_, 0);
+        hand_ = std::exchange(other.hand_, 0);
+        return *this;
+    }
+
+    static std::size_t state_bytes(std::size_t capacity) noexcept { return words(capacity) * sizeof(word); }
+
+    void touch(std::size_t index) const noexcept {
+        if (index >= capacity_) {
+            return;
+        }
+        word& w = bits_[index / 64];
+        const std::uint64_t bit = std::uint64_t{1} << (index % 64);
+        if (!(w.load(std::memory_order_relaxed) & bit)) {
+            w.fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+
+    void rebuild(std::size_t capacity) {
+        auto bits = std::make_unique<word[]>(words(capacity));
+        old_bits_ = std::exchange(bits_, std::move(bits));
+        old_capacity_ = std::exchange(capacity_, capacity);
+        if (capacity != old_capacity_) {
+            hand_ = 0;
+        }
+    }
+
+    void moved(std::size_t from, std::size_t to) noexcept {
+        if (from < old_capacity_ && (old_bits_[from / 64].load(std::memory_order_relaxed) >> (from % 64) & 1)) {
+            touch(to);
+        }
+    }
+
+    void rebuilt() noexcept {
+        old_bits_.reset();
+        old_capacity_ = 0;
+    }
+
+    void abandon_rebuild() noexcept {
+        bits_ = std::move(old_bits_);
+        capacity_ = std::exchange(old_capacity_, 0);
+    }
+
+    // The first turn of the hand clears every bit it passes, so the second
+    // evicts the first live entry it meets; after two turns there is none.
+    template <class Live>
+    std::size_t victim(std::size_t capacity, Live&& live) {
+        for (std::size_t steps = 2 * capacity; steps != 0; --steps) {
+            if (hand_ >= capacity) {
+                hand_ = 0;
+            }
+            const std::size_t index = hand_++;
+            if (!live(index)) {
+                continue;
+            }
+            if (index < capacity_) {
+                word& w = bits_[index / 64];
+                const std::uint64_t bit = std::uint64_t{1} << (index % 64);
+                if (w.load(std::memory_order_relaxed) & bit) {
+                    w.fetch_and(~bit, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+            return index;
+        }
+        return npos;
+    }
+
+private:
+    static std::size_t words(std::size_t capacity) noexcept { return (capacity + 63) / 64; }
+
+    std::unique_ptr<word[]> bits_;
+    std::unique_ptr<word[]> old_bits_;
+    std::size_t capacity_ = 0;
+    std::size_t old_capacity_ = 0;
+    std::size_t hand_ = 0;
+};
+
+}  // namespace whm
@@ -0,0 +1,169 @@
+#pragma once
+
+// Stats policies: what a container records about its own behaviour.
+//
+// no_stats, the default, records nothing; its hooks are empty inline
+// functions and the container only reads the clock when Stats::enabled.
+// collect_stats counts probes, lookups, weak_ptr locks, sweeps, rehashes and
+// evictions, and the container's stats() returns a table_stats snapshot of
+// them.
+//
+// The counters are relaxed atomics updated with a load and a store rather
+// than a read-modify-write, so recording never contends. Const lookups that
+// run at the same time (concurrent_weak_hash_map readers) may lose an
+// increment now and then; the counts are for tuning, not accounting.
+//
+// Counters belong to one container object: a copy starts from zero.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "detail/config.hpp"
+
+namespace whm {
+
+struct table_stats {
+    static constexpr std::size_t probe_buckets = 8;
+
+    // probe_length[i] counts probes that read i + 1 groups of control
+    // bytes; the last bucket holds the longer ones.
+    std::array<std::uint64_t, probe_buckets> probe_length{};
+
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t expired_hits = 0;  // address matched an entry whose key had died
+    std::uint64_t locks = 0;         // weak_ptr::lock() calls made by the container
+
+    std::uint64_t sweeps = 0;  // sweep steps and purges that ran
+    std::uint64_t swept = 0;   // entries they removed
+    std::chrono::nanoseconds sweep_time{0};
+    std::chrono::nanoseconds max_sweep_time{0};
+
+    std::uint64_t rehash_grow = 0;
+    std::uint64_t rehash_in_place = 0;
+    std::uint64_t rehash_shrink = 0;
+
+    std::uint64_t evictions = 0;  // live entries given up to a memory budget
+
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+    std::size_t tombstones = 0;
+
+    double tombstone_ratio() const noexcept {
+        return capacity ? static_cast<double>(tombstones) / static_cast<double>(capacity) : 0.0;
+    }
+
+    // Adds the counters and shape of another table, e.g. another shard.
+    WHM_CORE_API table_stats& operator+=(const table_stats& other) noexcept;
+};
+
+// Bytes a container uses, by what they hold. The table's one allocation is
+// split by slot state, so control + live + expired + tombstones + free ==
+// table; sizeof the container object itself is not included.
+struct memory_footprint {
+    std::size_t table = 0;       // control bytes and slots
+    std::size_t control = 0;     // control bytes, padded to a whole number of slots
+    std::size_t live = 0;        // slots of live entries
+    std::size_t expired = 0;     // slots of entries whose key or value has died
+    std::size_t tombstones = 0;  // erased slots still marked deleted
+    std::size_t free = 0;        // empty slots
+    std::size_t auxiliary = 0;   // pending expiry notifications, eviction state
+    std::size_t heap = 0;        // owned by keys or values, as reported by the caller
+
+    std::size_t total() const noexcept { return table + auxiliary + heap; }
+
+    // Adds the footprint of another table, e.g. another cache.
+    memory_footprint& operator+=(const memory_footprint& other) noexcept {
+        table += other.table;
+        control += other.control;
+        live += other.live;
+        expired += other.expired;
+        tombstones += other.tombstones;
+        free += other.free;
+        auxiliary += other.auxiliary;
+        heap += other.heap;
+        return *this;
+    }
+};
+
+struct no_stats {
+    static constexpr bool enabled = false;
+
+    void on_probe(std::size_t) const noexcept {}
+    void on_lookup(bool) const noexcept {}
+    void on_expired_hit() const noexcept {}
+    void on_lock() const noexcept {}
+    void on_sweep(std::chrono::nanoseconds, std::size_t) const noexcept {}
+    void on_rehash(std::size_t, std::size_t) const noexcept {}
+    void on_evict(std::size_t) const noexcept {}
+};
+
+class collect_stats {
+public:
+    static constexpr bool enabled = true;
+
+    collect_stats() noexcept = default;
+    collect_stats(const collect_stats&) noexcept {}
+    collect_stats& operator=(const collect_stats&) noexcept { return *this; }
+
+    void on_probe(std::size_t groups) const noexcept {
+        bump(probe_length_[std::min(groups, table_stats::probe_buckets) - 1]);
+    }
+
+    void on_lookup(bool hit) const noexcept { bump(hit ? hits_ : misses_); }
+    void on_expired_hit() const noexcept { bump(expired_hits_); }
+    void on_lock() const noexcept { bump(locks_); }
+
+    void on_sweep(std::chrono::nanoseconds time, std::size_t removed) const noexcept {
+        bump(sweeps_);
+        bump(swept_, removed);
+        bump(sweep_ns_, static_cast<std::uint64_t>(time.count()));
+        if (static_cast<std::uint64_t>(time.count()) > max_sweep_ns_.load(std::memory_order_relaxed)) {
+            max_sweep_ns_.store(static_cast<std::uint64_t>(time.count()), std::memory_order_relaxed);
+        }
+    }
+
+    void on_rehash(std::size_t old_capacity, std::size_t new_capacity) const noexcept {
+        bump(new_capacity > old_capacity   ? rehash_grow_
+             : new_capacity < old_capacity ? rehash_shrink_
+                                           : rehash_in_place_);
+    }
+
+    void on_evict(std::size_t evicted) const noexcept { bump(evictions_, evicted); }
+
+    // The counters, plus the table's current shape.
+    WHM_CORE_API table_stats snapshot(std::size_t size, std::size_t capacity, std::size_t tombstones) const noexcept;
+
+private:
+    using counter = std::atomic<std::uint64_t>;
+
+    static void bump(counter& c, std::uint64_t n = 1) noexcept {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static std::uint64_t read(const counter& c) noexcept { return c.load(std::memory_order_relaxed); }
+
+    mutable std::array<counter, table_stats::probe_buckets> probe_length_{};
+    mutable counter hits_{0};
+    mutable counter misses_{0};
+    mutable counter expired_hits_{0};
+    mutable counter locks_{0};
+    mutable counter sweeps_{0};
+    mutable counter swept_{0};
+    mutable counter sweep_ns_{0};
+    mutable counter max_sweep_ns_{0};
+    mutable counter rehash_grow_{0};
+    mutable counter rehash_in_place_{0};
+    mutable counter rehash_shrink_{0};
+    mutable counter evictions_{0};
+};
+
+}  // namespace whm
+
+#if !defined(WHM_SEPARATE_CORE)
+#include "detail/stats_impl.hpp"
+#endif
@@ -0,0 +1,1071 @@
+#pragma once
+
+// weak_hash_map: an associative container whose keys are held through
+// std::weak_ptr and therefore do not keep their objects alive.
+//
+// Keys are identified by the address of the object they point to. An entry
+// whose key object has died is "expired": it can no longer be found, but it
+// still occupies a slot until purge() runs or the table is rebuilt.
+//
+// Entries live inline in a flat open-addressing table (see
+// detail/raw_table.hpp): there is no per-entry allocation and a lookup
+// usually reads one group of control bytes and one slot.
+//
+// Keys of a type derived from weak_trackable are held through weak_ref
+// instead (see weak_trackable.hpp): a slot then needs 16 bytes for its key
+// rather than 24, and keys may also be inserted as plain pointers to objects
+// that are not owned by a shared_ptr.
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "detail/iterator.hpp"
+#include "detail/parallel.hpp"
+#include "detail/raw_table.hpp"
+#include "hash.hpp"
+#include "policy.hpp"
+#include "stats.hpp"
+#include "weak_trackable.hpp"
+
+namespace whm {
+
+namespace detail {
+
+// First constructor argument of a slot: the hash of its key, kept if the
+// slot layout caches hashes.
+struct with_hash {
+    std::size_t hash;
+};
+
+// Last constructor argument of a slot whose value is the result of `f()`.
+// The value is initialised from the call itself, so a prvalue result is
+// built directly in the slot.
+template <class F>
+struct computed {
+    F& f;
+};
+
+template <bool Cached>
+struct slot_hash {
+    explicit slot_hash(std::size_t) noexcept {}
+};
+
+template <>
+struct slot_hash<true> {
+    explicit slot_hash(std::size_t h) noexcept : hash(h) {}
+    std::size_t hash;
+};
+
+template <class K, class V, bool CacheHash = false>
+struct weak_key_policy {
+    using key_type = std::weak_ptr<K>;
+
+    // `ptr` caches the key's address taken while the key was still pinned.
+    // Hashing and comparing use it directly, so probing, rehashing and
+    // purging never lock the weak_ptr; an expired entry is recognised with
+    // weak_ptr::expired(), which only loads the use count.
+    struct slot_type : slot_hash<CacheHash> {
+        template <class... Args>
+        slot_type(with_hash h, const std::shared_ptr<K>& k, Args&&... args)
+            : slot_hash<CacheHash>(h.hash), ptr(k.get()), key(k), value(std::forward<Args>(args)...) {}
+
+        template <class F>
+        slot_type(with_hash h, const std::shared_ptr<K>& k, computed<F> c)
+            : slot_hash<CacheHash>(h.hash), ptr(k.get()), key(k), value(std::invoke(c.f)) {}
+
+        template <class... Args>
+            requires(!CacheHash)
+        slot_type(std::in_place_t, const std::shared_ptr<K>& k, Args&&... args)
+            : slot_type(with_hash{0}, k, std::forward<Args>(args)...) {}
+
+        const K* ptr;
+        std::weak_ptr<K> key;
+        V value;
+    };
+
+    template <class A, class... Args>
+    static void construct(A& alloc, slot_type* slot, Args&&... args) {
+        std::allocator_traits<A>::construct(alloc, slot, std::forward<Args>(args)...);
+    }
+
+    template <class A>
+    static void destroy(A& alloc, slot_type* slot) noexcept {
+        std::allocator_traits<A>::destroy(alloc, slot);
+    }
+
+    template <class A>
+    static void transfer(A& alloc, slot_type* dst, slot_type* src) noexcept(
+        std::is_nothrow_move_constructible_v<slot_type>) {
+        construct(alloc, dst, std::move(*src));
+        destroy(alloc, src);
+    }
+
+    template <class H>
+    static std::size_t hash_slot(const H& hash, const slot_type& slot) noexcept(
+        CacheHash || std::is_nothrow_invocable_v<const H&, const K*>) {
+        if constexpr (CacheHash) {
+            return slot.hash;
+        } else {
+            return hash(slot.ptr);
+        }
+    }
+
+    static bool expired(const slot_type& slot) noexcept { return slot.key.expired(); }
+
+    // The slot's weak_ptr keeps its control block allocated, so no later
+    // object can share it: the control block is the entry's generation tag.
+    // Comparing owners reads two pointers and no reference count.
+    template <class U>
+    static bool same_owner(const slot_type& slot, const std::shared_ptr<U>& key) noexcept {
+        return !slot.key.owner_before(key) && !key.owner_before(slot.key);
+    }
+
+    static const void* address(const slot_type& slot) noexcept { return slot.ptr; }
+
+    static const K* key_address(const slot_type& slot) noexcept { return slot.ptr; }
+};
+
+// Slots for keys derived from weak_trackable. The weak_ref holds the cached
+// address itself, so a slot is the reference and the value.
+template <class K, class V, bool CacheHash = false>
+struct trackable_key_policy {
+    using key_type = weak_ref<K>;
+
+    struct slot_type : slot_hash<CacheHash> {
+        template <class... Args>
+        slot_type(with_hash h, K* p, Args&&... args)
+            : slot_hash<CacheHash>(h.hash), key(p), value(std::forward<Args>(args)...) {}
+
+        template <class F>
+        slot_type(with_hash h, K* p, computed<F> c)
+            : slot_hash<CacheHash>(h.hash), key(p), value(std::invoke(c.f)) {}
+
+        template <class... Args>
+        slot_type(with_hash h, const std::shared_ptr<K>& k, Args&&... args)
+            : slot_type(h, k.get(), std::forward<Args>(args)...) {}
+
+        weak_ref<K> key;
+        V value;
+    };
+
+    template <class A, class... Args>
+    static void construct(A& alloc, slot_type* slot, Args&&... args) {
+        std::allocator_traits<A>::construct(alloc, slot, std::forward<Args>(args)...);
+    }
+
+    template <class A>
+    static void destroy(A& alloc, slot_type* slot) noexcept {
+        std::allocator_traits<A>::destroy(alloc, slot);
+    }
+
+    template <class A>
+    static void transfer(A& alloc, slot_type* dst, slot_type* src) noexcept(
+        std::is_nothrow_move_constructible_v<slot_type>) {
+        construct(alloc, dst, std::move(*src));
+        destroy(alloc, src);
+    }
+
+    template <class H>
+    static std::size_t hash_slot(const H& hash, const slot_type& slot) noexcept(
+        CacheHash || std::is_nothrow_invocable_v<const H&, const K*>) {
+        if constexpr (CacheHash) {
+            return slot.hash;
+        } else {
+            return hash(slot.key.address());
+        }
+    }
+
+    static bool expired(const slot_type& slot) noexcept { return slot.key.expired(); }
+
+    // Here the tag is the weak_ref's cell, which the slot keeps allocated.
+    template <class U>
+    static bool same_owner(const slot_type& slot, const std::shared_ptr<U>& key) noexcept {
+        return slot.key.refers_to(static_cast<const K*>(key.get()));
+    }
+
+    static bool same_owner(const slot_type& slot, const K* p) noexcept { return slot.key.refers_to(p); }
+
+    static const void* address(const slot_type& slot) noexcept { return slot.key.address(); }
+
+    static const K* key_address(const slot_type& slot) noexcept { return slot.key.address(); }
+};
+
+template <class K, class V, class Layout>
+struct key_policy_for_impl {
+    static constexpr bool trackable = Layout::key == slot_key::weak_ref ||
+                                      (Layout::key == slot_key::automatic && std::is_base_of_v<weak_trackable, K>);
+    static_assert(!trackable || std::is_base_of_v<weak_trackable, K>,
+                  "slot_key::weak_ref needs keys derived from weak_trackable");
+
+    using type = std::conditional_t<trackable, trackable_key_policy<K, V, Layout::cache_hash>,
+                                    weak_key_policy<K, V, Layout::cache_hash>>;
+};
+
+template <class K, class V, class Layout = slot_layout<>>
+using key_policy_for = typename key_policy_for_impl<K, V, Layout>::type;
+
+// U can be used to look up keys of type K: a U* converts to a const K*.
+template <class U, class K>
+concept pointer_to = std::is_convertible_v<U*, const K*>;
+
+// What find_or_compute() builds a value from: `factory(key)` if the
+// factory takes the key, else `factory()`.
+template <class F, class K>
+using factory_result_t =
+    typename std::conditional_t<std::is_invocable_v<F&, const std::shared_ptr<K>&>,
+                                std::invoke_result<F&, const std::shared_ptr<K>&>, std::invoke_result<F&>>::type;
+
+}  // namespace detail
+
+// `Sweep` decides whether mutating operations also reclaim expired entries
+// in bounded steps (see policy.hpp); the default leaves that to purge().
+// `Resize` holds the thresholds for rebuilding a full table at the same
+// capacity rather than a larger one. `Stats` selects what the map records
+// for stats() (see stats.hpp); the default records nothing. `Layout` picks
+// how keys are held and whether slots cache their hash (see policy.hpp).
+// `Evict` makes set_memory_budget() available and picks the entries given
+// up to it (see policy.hpp). map_config.hpp bundles these for common roles.
+template <class K, class V, class Hash = pointer_hash<K>, class KeyEqual = pointer_equal<K>,
+          class Alloc = std::allocator<std::pair<const std::weak_ptr<K>, V>>, class Sweep = no_sweep,
+          class Resize = default_resize_policy, class Stats = no_stats, class Layout = slot_layout<>,
+          class Evict = no_eviction>
+class weak_hash_map {
+    using policy = detail::key_policy_for<K, V, Layout>;
+    using table_type = detail::raw_table<policy, Hash, Alloc, Resize, Stats, Evict>;
+    using slot_type = typename policy::slot_type;
+
+    static constexpr bool trackable_keys = std::is_same_v<typename policy::key_type, weak_ref<K>>;
+
+public:
+    // std::weak_ptr<K>, or weak_ref<K> for keys derived from weak_trackable.
+    using key_type = typename policy::key_type;
+    using element_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const key_type, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Alloc;
+    using sweep_policy = Sweep;
+    using resize_policy = Resize;
+    using stats_policy = Stats;
+    using slot_layout_policy = Layout;
+    using eviction_policy = Evict;
+    using reference = std::pair<const key_type&, V&>;
+    using const_reference = std::pair<const key_type&, const V&>;
+
+private:
+    template <bool Const>
+    class basic_iterator {
+        friend class weak_hash_map;
+        using table_ptr = std::conditional_t<Const, const table_type*, table_type*>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = weak_hash_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, weak_hash_map::const_reference, weak_hash_map::reference>;
+        using pointer = detail::arrow_proxy<reference>;
+
+        basic_iterator() noexcept = default;
+
+        template <bool C = Const, class = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false>& other) noexcept
+            : table_(other.table_), index_(other.index_) {}
+
+        reference operator*() const noexcept {
+            auto& slot = table_->slot_at(index_);
+            return reference(slot.key, slot.value);
+        }
+
+        pointer operator->() const noexcept { return pointer{**this}; }
+
+        basic_iterator& operator++() noexcept {
+            index_ = table_->next_full(index_ + 1);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept {
+            basic_iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        friend bool operator==(const basic_iterator& a, const basic_iterator& b) noexcept {
+            return a.index_ == b.index_;
+        }
+
+    private:
+        basic_iterator(table_ptr table, size_type index) noexcept : table_(table), index_(index) {}
+
+        table_ptr table_ = nullptr;
+        size_type index_ = 0;
+    };
+
+public:
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    // What dereferencing a live_view iterator pins: a shared_ptr, or a plain
+    // pointer for keys derived from weak_trackable.
+    using locked_key = std::conditional_t<trackable_keys, K*, std::shared_ptr<K>>;
+
+    // Result of the get-or-create operations on a weak_ptr key: the key,
+    // pinned, and its value. Both are null if the key had expired.
+    struct locked_entry {
+        std::shared_ptr<K> key;
+        V* value = nullptr;
+        bool inserted = false;
+
+        explicit operator bool() const noexcept { return value != nullptr; }
+    };
+
+private:
+    // Skips expired entries using expired(), which only loads the use count;
+    // the key is locked when the iterator is dereferenced. It can still die
+    // between the two, in which case the locked key is null.
+    template <bool Const>
+    class basic_live_iterator {
+        friend class weak_hash_map;
+        using table_ptr = std::conditional_t<Const, const table_type*, table_type*>;
+
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::pair<locked_key, V>;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::pair<locked_key, std::conditional_t<Const, const V&, V&>>;
+        using pointer = detail::arrow_proxy<reference>;
+
+        basic_live_iterator() noexcept = default;
+
+        reference operator*() const {
+            auto& slot = table_->slot_at(index_);
+            return reference(lock_slot(*table_, slot), slot.value);
+        }
+
+        pointer operator->() const { return pointer{**this}; }
+
+        basic_live_iterator& operator++() noexcept {
+            index_ = next_live(*table_, index_ + 1);
+            return *this;
+        }
+
+        basic_live_iterator operator++(int) noexcept {
+            basic_live_iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        friend bool operator==(const basic_live_iterator& a, const basic_live_iterator& b) noexcept {
+            return a.index_ == b.index_;
+        }
+
+    private:
+        basic_live_iterator(table_ptr table, size_type index) noexcept : table_(table), index_(index) {}
+
+        table_ptr table_ = nullptr;
+        size_type index_ = 0;
+    };
+
+    template <bool Const>
+    class basic_live_view {
+        friend class weak_hash_map;
+        using table_ptr = std::conditional_t<Const, const table_type*, table_type*>;
+
+    public:
+        using iterator = basic_live_iterator<Const>;
+
+        iterator begin() const noexcept { return iterator(table_, next_live(*table_, 0)); }
+        iterator end() const noexcept { return iterator(table_, table_->capacity()); }
+
+    private:
+        explicit basic_live_view(table_ptr table) noexcept : table_(table) {}
+
+        table_ptr table_;
+    };
+
+public:
+    using live_iterator = basic_live_iterator<false>;
+    using const_live_iterator = basic_live_iterator<true>;
+    using live_view_type = basic_live_view<false>;
+    using const_live_view_type = basic_live_view<true>;
+
+    weak_hash_map() = default;
+
+    explicit weak_hash_map(size_type bucket_count, const Hash& hash = Hash(),
+                           const KeyEqual& eq = KeyEqual(), const Alloc& alloc = Alloc())
+        : table_(bucket_count, hash, typename table_type::allocator_type(alloc)), eq_(eq) {}
+
+    explicit weak_hash_map(const Alloc& alloc) : weak_hash_map(0, Hash(), KeyEqual(), alloc) {}
+
+    iterator begin() noexcept { return iterator(&table_, table_.next_full(0)); }
+    iterator end() noexcept { return iterator(&table_, table_.capacity()); }
+    const_iterator begin() const noexcept { return const_iterator(&table_, table_.next_full(0)); }
+    const_iterator end() const noexcept { return const_iterator(&table_, table_.capacity()); }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    // Range over the entries whose keys are alive. The view is lazy: it
+    // filters as it goes and is invalidated like an iterator.
+    live_view_type live_view() noexcept { return live_view_type(&table_); }
+    const_live_view_type live_view() const noexcept { return const_live_view_type(&table_); }
+
+    // Calls `f(key, value)` for every entry whose key is alive, with the
+    // stored key_type; nothing is locked. `f` must not modify the map.
+    template <class F>
+    void for_each_live(F&& f) {
+        for_each_live_impl(table_, f);
+    }
+
+    template <class F>
+    void for_each_live(F&& f) const {
+        for_each_live_impl(table_, f);
+    }
+
+    // The live entries, each key pinned, with copies of their values, in a
+    // contiguous vector that can be processed after the map has moved on
+    // (e.g. with std::execution::par). Keys that die during the pass are
+    // left out. Not available for weak_ref keys, which cannot be pinned.
+    using live_snapshot = std::vector<std::pair<std::shared_ptr<K>, V>>;
+
+    live_snapshot snapshot_live() const
+        requires(!trackable_keys)
+    {
+        live_snapshot out;
+        out.reserve(size());
+        for (size_type i = table_.next_full(0); i != table_.capacity(); i = table_.next_full(i + 1)) {
+            const slot_type& slot = table_.slot_at(i);
+            if (std::shared_ptr<K> key = lock_key(slot.key)) {
+                out.emplace_back(std::move(key), slot.value);
+            }
+        }
+        return out;
+    }
+
+    // Number of stored entries, including expired ones not yet purged.
+    size_type size() const noexcept { return table_.size(); }
+    bool empty() const noexcept { return table_.empty(); }
+    size_type capacity() const noexcept { return table_.capacity(); }
+
+    // Live entries, expired entries and tombstones. Keys die without the map
+    // noticing, so telling live from expired scans the table.
+    slot_counts counts() const noexcept {
+        const size_type expired = table_.count_expired();
+        return {table_.size() - expired, expired, table_.tombstones()};
+    }
+
+    void clear() noexcept { table_.clear(); }
+    void reserve(size_type n) { table_.reserve(n); }
+    void rehash(size_type n) { table_.rehash(n); }
+
+    // Rebuilds the table at the smallest capacity that holds the live
+    // entries, dropping the expired ones; frees it if none are left.
+    void shrink_to_fit() { table_.shrink_to_fit(); }
+
+    // Removes every entry whose key has expired. Returns the number removed.
+    //
+    // With a shrinking Resize policy (shrink_on_sparse), purge(), erase(key)
+    // and erase_many() may also shrink the table, invalidating iterators.
+    size_type purge() {
+        return table_.timed_sweep([this] {
+            const size_type removed = table_.purge();
+            table_.shrink_if_sparse();
+            return removed;
+        });
+    }
+
+    // purge() and rehash() that split large tables into blocks and work on
+    // them as tasks of `ex`: any callable that runs the task it is given
+    // once, on some thread (see detail/parallel.hpp). They return when all
+    // tasks are done. Values of different entries are destroyed
+    // concurrently. The rebuild itself runs on the calling thread.
+    template <detail::executor Executor>
+    size_type purge(Executor&& ex) {
+        return table_.timed_sweep([this, &ex] {
+            const size_type removed = table_.purge(ex);
+            table_.shrink_if_sparse();
+            return removed;
+        });
+    }
+
+    template <detail::executor Executor>
+    void rehash(size_type n, Executor&& ex) {
+        table_.rehash(n, ex);
+    }
+
+    // Snapshot of the counters kept by a collecting Stats policy, together
+    // with the table's size, capacity and tombstones.
+    table_stats stats() const noexcept
+        requires Stats::enabled
+    {
+        return table_.stats().snapshot(table_.size(), table_.capacity(), table_.tombstones());
+    }
+
+    // Bytes of the table by slot state, plus tracked_sweep's pending
+    // notifications and the Evict policy's state (see memory_footprint).
+    // Scans the table. The overload also adds up `heap_bytes(value)` over
+    // the live entries, for values that own memory outside the table.
+    memory_footprint memory_usage() const noexcept {
+        memory_footprint m = table_.memory_usage();
+        if constexpr (std::is_same_v<Sweep, tracked_sweep>) {
+            m.auxiliary += sweep_.memory_usage();
+        }
+        return m;
+    }
+
+    template <class F>
+    memory_footprint memory_usage(F&& heap_bytes) const {
+        memory_footprint m = memory_usage();
+        auto add = [&m, &heap_bytes](const key_type&, const V& value) { m.heap += std::invoke(heap_bytes, value); };
+        for_each_live_impl(table_, add);
+        return m;
+    }
+
+    // Caps the table's footprint (memory_usage().table plus the Evict
+    // policy's state) at `bytes`; see policy.hpp for how entries are evicted
+    // when an insertion needs room. A lower budget than the table uses now
+    // rebuilds it at once. memory_budget() is eviction_budget::unlimited
+    // until set.
+    void set_memory_budget(size_type bytes)
+        requires Evict::enabled
+    {
+        table_.set_memory_budget(bytes);
+    }
+
+    size_type memory_budget() const noexcept
+        requires Evict::enabled
+    {
+        return table_.memory_budget();
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const std::shared_ptr<K>& key, Args&&... args) {
+        return emplace_key(key.get(), key, std::forward<Args>(args)...);
+    }
+
+    // Keys derived from weak_trackable can also be inserted by pointer,
+    // whatever owns the object.
+    template <class... Args>
+        requires trackable_keys
+    std::pair<iterator, bool> try_emplace(K* key, Args&&... args) {
+        return emplace_key(key, key, std::forward<Args>(args)...);
+    }
+
+    // Creates a key object whose death erases its entry at the start of the
+    // next operation on this map. Only available with tracked_sweep.
+    template <class T = K, class... Args>
+        requires std::is_same_v<Sweep, tracked_sweep> && std::is_convertible_v<T*, K*>
+    std::shared_ptr<T> make_tracked(Args&&... args) {
+        auto node = std::make_unique<detail::expiry_node>();
+        std::weak_ptr<detail::expiry_queue> queue = sweep_.get_queue();
+        auto object = std::make_unique<T>(std::forward<Args>(args)...);
+        const K* p = object.get();
+        node->address = p;
+        node->hash = hash_of(p);
+        // Only shared_ptr's own allocation can throw from here on, and it
+        // then calls the deleter, which frees the object.
+        return std::shared_ptr<T>(object.release(), detail::tracked_deleter<T>{std::move(queue), std::move(node)});
+    }
+
+    std::pair<iterator, bool> insert(const std::shared_ptr<K>& key, const V& value) {
+        return try_emplace(key, value);
+    }
+
+    std::pair<iterator, bool> insert(const std::shared_ptr<K>& key, V&& value) {
+        return try_emplace(key, std::move(value));
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const std::shared_ptr<K>& key, M&& value) {
+        auto result = try_emplace(key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result;
+    }
+
+    V& operator[](const std::shared_ptr<K>& key) { return try_emplace(key).first->second; }
+
+    std::pair<iterator, bool> insert(K* key, const V& value)
+        requires trackable_keys
+    {
+        return try_emplace(key, value);
+    }
+
+    std::pair<iterator, bool> insert(K* key, V&& value)
+        requires trackable_keys
+    {
+        return try_emplace(key, std::move(value));
+    }
+
+    template <class M>
+        requires trackable_keys
+    std::pair<iterator, bool> insert_or_assign(K* key, M&& value) {
+        auto result = try_emplace(key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result;
+    }
+
+    V& operator[](K* key)
+        requires trackable_keys
+    {
+        return try_emplace(key).first->second;
+    }
+
+    // Get-or-create in one probe: locks `key` once and, if it has no entry
+    // yet, constructs V(args...) in place. Replaces find(), insert() and a
+    // second lock(). Nothing is inserted for an expired key.
+    template <class... Args>
+    locked_entry try_emplace_locked(const std::weak_ptr<K>& key, Args&&... args) {
+        std::shared_ptr<K> pinned = lock_key(key);
+        if (!pinned) {
+            return {};
+        }
+        auto [it, inserted] = emplace_key(pinned.get(), pinned, std::forward<Args>(args)...);
+        return {std::move(pinned), &it->second, inserted};
+    }
+
+    // Like try_emplace_locked, but on a miss the value is initialised from
+    // `factory(key)` (or `factory()`), called with the key pinned; a V
+    // returned by value is built directly in the slot. A factory that
+    // throws leaves the map unchanged; it must not use the map.
+    template <class F>
+        requires std::is_constructible_v<V, detail::factory_result_t<F, K>>
+    locked_entry find_or_compute(const std::weak_ptr<K>& key, F&& factory) {
+        std::shared_ptr<K> pinned = lock_key(key);
+        if (!pinned) {
+            return {};
+        }
+        auto [it, inserted] = compute_key(pinned, factory);
+        return {std::move(pinned), &it->second, inserted};
+    }
+
+    template <class F>
+        requires std::is_constructible_v<V, detail::factory_result_t<F, K>>
+    locked_entry find_or_compute(const std::shared_ptr<K>& key, F&& factory) {
+        auto [it, inserted] = compute_key(key, factory);
+        return {key, &it->second, inserted};
+    }
+
+    // Lookups accept the key as a raw pointer, a shared_ptr or a weak_ptr to
+    // K or a class derived from it. Pointers and shared_ptrs are hashed and
+    // compared by address without touching any reference count; a weak_ptr
+    // argument has to be locked once to learn its address. The stored key is
+    // never locked: callers lock it only if they need to pin the object.
+    //
+    // Non-const lookups run a sweep step first. It only erases expired
+    // entries, so iterators to live entries stay valid.
+    iterator find(const K* p) {
+        sweep_step();
+        return make_iterator(find_index(p));
+    }
+
+    const_iterator find(const K* p) const { return make_iterator(find_index(p)); }
+
+    template <detail::pointer_to<K> U>
+    iterator find(const std::shared_ptr<U>& key) {
+        sweep_step();
+        return make_iterator(find_index(key));
+    }
+
+    template <detail::pointer_to<K> U>
+    const_iterator find(const std::shared_ptr<U>& key) const {
+        return make_iterator(find_index(key));
+    }
+
+    template <detail::pointer_to<K> U>
+    iterator find(const std::weak_ptr<U>& key) {
+        return find(lock_key(key));
+    }
+
+    template <detail::pointer_to<K> U>
+    const_iterator find(const std::weak_ptr<U>& key) const {
+        return find(lock_key(key));
+    }
+
+    bool contains(const K* p) const { return find_index(p) != npos; }
+
+    template <detail::pointer_to<K> U>
+    bool contains(const std::shared_ptr<U>& key) const {
+        return find_index(key) != npos;
+    }
+
+    template <detail::pointer_to<K> U>
+    bool contains(const std::weak_ptr<U>& key) const {
+        return contains(lock_key(key));
+    }
+
+    // Hot-path lookups for a key the caller keeps alive. An entry matches
+    // only if it holds this very object (same owner, see same_owner()), so
+    // no reference count is read, let alone changed. The value pointer
+    // stays valid while the key lives and the map is not modified. Weak_ref
+    // keys can also be given as a raw pointer to the live object.
+    template <detail::pointer_to<K> U>
+    bool contains_live(const std::shared_ptr<U>& key) const {
+        return find_live_index(static_cast<const K*>(key.get()), key) != npos;
+    }
+
+    bool contains_live(const K* p) const
+        requires trackable_keys
+    {
+        return find_live_index(p, p) != npos;
+    }
+
+    template <detail::pointer_to<K> U>
+    V* find_unpinned(const std::shared_ptr<U>& key) {
+        return value_ptr(find_live_index(static_cast<const K*>(key.get()), key));
+    }
+
+    template <detail::pointer_to<K> U>
+    const V* find_unpinned(const std::shared_ptr<U>& key) const {
+        return const_cast<weak_hash_map*>(this)->find_unpinned(key);
+    }
+
+    V* find_unpinned(const K* p)
+        requires trackable_keys
+    {
+        return value_ptr(find_live_index(p, p));
+    }
+
+    const V* find_unpinned(const K* p) const
+        requires trackable_keys
+    {
+        return const_cast<weak_hash_map*>(this)->find_unpinned(p);
+    }
+
+    template <class Key>
+    size_type count(const Key& key) const
+        requires requires(const weak_hash_map& m) { m.contains(key); }
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    V& at(const K* p) { return value_at(find_index(p)); }
+
+    const V& at(const K* p) const { return const_cast<weak_hash_map*>(this)->at(p); }
+
+    template <detail::pointer_to<K> U>
+    V& at(const std::shared_ptr<U>& key) {
+        return value_at(find_index(key));
+    }
+
+    template <detail::pointer_to<K> U>
+    const V& at(const std::shared_ptr<U>& key) const {
+        return const_cast<weak_hash_map*>(this)->at(key);
+    }
+
+    size_type erase(const K* p) {
+        sweep_step();
+        return erase_index(find_index(p));
+    }
+
+    template <detail::pointer_to<K> U>
+    size_type erase(const std::shared_ptr<U>& key) {
+        sweep_step();
+        return erase_index(find_index(key));
+    }
+
+    template <detail::pointer_to<K> U>
+    size_type erase(const std::weak_ptr<U>& key) {
+        return erase(lock_key(key));
+    }
+
+    iterator erase(const_iterator pos) {
+        table_.erase_at(pos.index_);
+        return iterator(&table_, table_.next_full(pos.index_ + 1));
+    }
+
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+    // Bulk operations over spans of keys, given as raw pointers or
+    // shared_ptrs. Keys are handled in windows of bulk_window: the whole
+    // window is hashed and the first group and slot of every probe are
+    // prefetched before any key is probed, so the cache misses of a window
+    // overlap instead of being taken one after another. Results are those of
+    // the single-key operations applied in order, except that non-const
+    // bulk operations run a single sweep step, before the first key. No step
+    // runs between results, so every iterator stored by find_many() stays
+    // valid, even if its key dies during the call.
+    static constexpr size_type bulk_window = 16;
+
+    // Stores find(keys[i]) in out[i]; `out` must hold keys.size() elements.
+    void find_many(std::span<const K* const> keys, std::span<iterator> out) { find_many_impl(keys, out); }
+    void find_many(std::span<const std::shared_ptr<K>> keys, std::span<iterator> out) { find_many_impl(keys, out); }
+
+    void find_many(std::span<const K* const> keys, std::span<const_iterator> out) const {
+        find_many_impl(keys, out);
+    }
+
+    void find_many(std::span<const std::shared_ptr<K>> keys, std::span<const_iterator> out) const {
+        find_many_impl(keys, out);
+    }
+
+    // Inserts (keys[i], values[i]) for every key not already present and
+    // returns the number inserted. Reserves room for all keys up front, so
+    // the table grows at most once.
+    size_type insert_many(std::span<const std::shared_ptr<K>> keys, std::span<const V> values) {
+        assert(keys.size() == values.size());
+        return insert_many_impl(keys, [&values](size_type i) -> const V& { return values[i]; });
+    }
+
+    // Inserts (key, value) for every key in `keys` not already present.
+    size_type insert_many(std::span<const std::shared_ptr<K>> keys, const V& value) {
+        return insert_many_impl(keys, [&value](size_type) -> const V& { return value; });
+    }
+
+    // Erases every key in `keys` and returns the number of entries removed.
+    size_type erase_many(std::span<const K* const> keys) { return erase_many_impl(keys); }
+    size_type erase_many(std::span<const std::shared_ptr<K>> keys) { return erase_many_impl(keys); }
+
+    void swap(weak_hash_map& other) noexcept {
+        table_.swap(other.table_);
+        using std::swap;
+        swap(eq_, other.eq_);
+        swap(sweep_, other.sweep_);
+    }
+
+    friend void swap(weak_hash_map& a, weak_hash_map& b) noexcept { a.swap(b); }
+
+    hasher hash_function() const { return table_.hash_ref(); }
+    key_equal key_eq() const { return eq_; }
+    allocator_type get_allocator() const { return allocator_type(table_.alloc_ref()); }
+
+private:
+    static constexpr size_type npos = table_type::npos;
+
+    size_type hash_of(const K* p) const { return table_.hash_ref()(p); }
+
+    // A dead key's address may have been reused by the object we are
+    // looking for, so an address match only counts while the entry is live.
+    // When the caller pins the key (`owner` is its shared_ptr), an entry with
+    // the same owner is live without looking at its reference count, and
+    // only entries with another owner are checked for expiry.
+    template <class Owner = std::nullptr_t>
+    auto matches(const K* p, const Owner& owner = nullptr) const {
+        return [this, p, &owner](const slot_type& slot) {
+            if (!eq_(policy::key_address(slot), p)) {
+                return false;
+            }
+            if constexpr (!std::is_null_pointer_v<Owner>) {
+                if (policy::same_owner(slot, owner)) {
+                    return true;
+                }
+            }
+            if (policy::expired(slot)) {
+                table_.stats().on_expired_hit();
+                return false;
+            }
+            return true;
+        };
+    }
+
+    // The Sweep policy's step, timed when stats are collected.
+    void sweep_step() { table_.sweep_step(sweep_); }
+
+    static locked_key lock_slot(const table_type& table, const slot_type& slot) {
+        if constexpr (trackable_keys) {
+            return slot.key.get();
+        } else {
+            table.stats().on_lock();
+            return slot.key.lock();
+        }
+    }
+
+    static size_type next_live(const table_type& table, size_type i) noexcept {
+        for (i = table.next_full(i); i != table.capacity() && policy::expired(table.slot_at(i));
+             i = table.next_full(i + 1)) {
+        }
+        return i;
+    }
+
+    template <class Table, class F>
+    static void for_each_live_impl(Table& table, F& f) {
+        const size_type capacity = table.capacity();
+        for (size_type i = 0; i != capacity; ++i) {
+            if (table.is_full_at(i)) {
+                auto& slot = table.slot_at(i);
+                if (!policy::expired(slot)) {
+                    std::invoke(f, std::as_const(slot.key), slot.value);
+                }
+            }
+        }
+    }
+
+    template <class U>
+    std::shared_ptr<U> lock_key(const std::weak_ptr<U>& key) const {
+        table_.stats().on_lock();
+        return key.lock();
+    }
+
+    // `owner` is the key's shared_ptr, or for weak_ref keys the key itself.
+    template <class Owner>
+    size_type find_live_index(const K* p, const Owner& owner) const {
+        if (p == nullptr || table_.empty()) {
+            table_.stats().on_lookup(false);
+            return npos;
+        }
+        const size_type index = table_.find(hash_of(p), [this, p, &owner](const slot_type& slot) {
+            return eq_(policy::key_address(slot), p) && policy::same_owner(slot, owner);
+        });
+        table_.stats().on_lookup(index != npos);
+        return index;
+    }
+
+    V* value_ptr(size_type index) noexcept { return index == npos ? nullptr : &table_.slot_at(index).value; }
+
+    V& value_at(size_type index) {
+        if (index == npos) {
+            throw std::out_of_range("weak_hash_map::at: key not found");
+        }
+        return table_.slot_at(index).value;
+    }
+
+    size_type erase_index(size_type index) {
+        if (index == npos) {
+            return 0;
+        }
+        table_.erase_at(index);
+        table_.shrink_if_sparse();
+        return 1;
+    }
+
+    template <class Key, class... Args>
+    std::pair<iterator, bool> emplace_key(const K* p, const Key& key, Args&&... args) {
+        assert(p && "weak_hash_map keys must not be null");
+        sweep_step();
+        const size_type hash = hash_of(p);
+        auto [index, inserted] = table_.find_or_prepare_insert(hash, matches(p, owner_of(key)));
+        if (inserted) {
+            table_.construct_at(index, detail::with_hash{hash}, key, std::forward<Args>(args)...);
+        }
+        return {iterator(&table_, index), inserted};
+    }
+
+    template <class F>
+    std::pair<iterator, bool> compute_key(const std::shared_ptr<K>& key, F& factory) {
+        auto compute = [&]() -> decltype(auto) {
+            if constexpr (std::is_invocable_v<F&, const std::shared_ptr<K>&>) {
+                return std::invoke(factory, key);
+            } else {
+                return std::invoke(factory);
+            }
+        };
+        return emplace_key(key.get(), key, detail::computed<decltype(compute)>{compute});
+    }
+
+    size_type find_index(const K* p) const { return find_index(p, p ? hash_of(p) : 0); }
+
+    template <class U>
+    size_type find_index(const std::shared_ptr<U>& key) const {
+        const K* p = key.get();
+        return find_index(p, p ? hash_of(p) : 0, key);
+    }
+
+    template <class Owner = std::nullptr_t>
+    size_type find_index(const K* p, size_type hash, const Owner& owner = nullptr) const {
+        const size_type index = p == nullptr || table_.empty() ? npos : table_.find(hash, matches(p, owner));
+        table_.stats().on_lookup(index != npos);
+        return index;
+    }
+
+    static const K* address_of(const K* p) noexcept { return p; }
+    static const K* address_of(const std::shared_ptr<K>& p) noexcept { return p.get(); }
+
+    // What matches() can compare entries' owners with: nothing for a raw
+    // pointer, which may point to an object that no shared_ptr owns.
+    static std::nullptr_t owner_of(const K*) noexcept { return nullptr; }
+    static const std::shared_ptr<K>& owner_of(const std::shared_ptr<K>& p) noexcept { return p; }
+
+    // Calls `f(i, p, hash)` for the keys of each window once all of them are
+    // hashed and prefetched.
+    template <class Key, class F>
+    void probe_many(std::span<const Key> keys, F&& f) const {
+        size_type hashes[bulk_window];
+        for (size_type base = 0; base < keys.size(); base += bulk_window) {
+            const size_type n = std::min(bulk_window, keys.size() - base);
+            for (size_type i = 0; i != n; ++i) {
+                hashes[i] = hash_of(address_of(keys[base + i]));
+                table_.prefetch(hashes[i]);
+            }
+            for (size_type i = 0; i != n; ++i) {
+                f(base + i, address_of(keys[base + i]), hashes[i]);
+            }
+        }
+    }
+
+    template <class Key>
+    void find_many_impl(std::span<const Key> keys, std::span<iterator> out) {
+        assert(out.size() >= keys.size());
+        sweep_step();
+        probe_many(keys, [this, keys, out](size_type i, const K* p, size_type hash) {
+            out[i] = make_iterator(find_index(p, hash, owner_of(keys[i])));
+        });
+    }
+
+    template <class Key>
+    void find_many_impl(std::span<const Key> keys, std::span<const_iterator> out) const {
+        assert(out.size() >= keys.size());
+        probe_many(keys, [this, keys, out](size_type i, const K* p, size_type hash) {
+            out[i] = make_iterator(find_index(p, hash, owner_of(keys[i])));
+        });
+    }
+
+    template <class ValueAt>
+    size_type insert_many_impl(std::span<const std::shared_ptr<K>> keys, ValueAt&& value_at) {
+        sweep_step();
+        table_.reserve(size() + keys.size());
+        size_type inserted = 0;
+        probe_many(keys, [&](size_type i, const K* p, size_type hash) {
+            assert(p && "weak_hash_map keys must not be null");
+            auto [index, fresh] = table_.find_or_prepare_insert(hash, matches(p, keys[i]));
+            if (fresh) {
+                table_.construct_at(index, detail::with_hash{hash}, keys[i], value_at(i));
+                ++inserted;
+            }
+        });
+        return inserted;
+    }
+
+    template <class Key>
+    size_type erase_many_impl(std::span<const Key> keys) {
+        sweep_step();
+        size_type erased = 0;
+        probe_many(keys, [&](size_type, const K* p, size_type hash) {
+            const size_type index = find_index(p, hash);
+            if (index != npos) {
+                table_.erase_at(index);
+                ++erased;
+            }
+        });
+        table_.shrink_if_sparse();
+        return erased;
+    }
+
+    iterator make_iterator(size_type index) noexcept {
+        return index == npos ? end() : iterator(&table_, index);
+    }
+
+    const_iterator make_iterator(size_type index) const noexcept {
+        return index == npos ? end() : const_iterator(&table_, index);
+    }
+
+    table_type table_;
+    [[no_unique_address]] KeyEqual eq_{};
+    [[no_unique_address]] Sweep sweep_{};
+};
+
+}  // namespace whm
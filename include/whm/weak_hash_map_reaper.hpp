@@ -0,0 +1,169 @@
+#pragma once
+
+// weak_hash_map_reaper: a background thread that purges expired entries
+// from concurrent_weak_hash_maps, so request threads never have to.
+//
+// Every `interval` the thread visits each attached map and purges its next
+// `shards_per_tick` shards in round-robin order. A shard is only try-locked:
+// one that a writer (or a reader, with locked_reads) holds at that moment is
+// skipped and examined again on the map's next turn, so the reaper never
+// makes a request thread wait.
+//
+//   whm::weak_hash_map_reaper reaper(std::chrono::milliseconds(5));
+//   auto registration = reaper.attach(sessions);  // detaches when destroyed
+//
+// A map must stay alive while it is attached. Detaching (destroying the
+// registration) waits for a purge of that map in progress to finish.
+// Destroying the reaper stops and joins the thread; registrations that
+// outlive it do nothing when destroyed.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace whm {
+
+class weak_hash_map_reaper {
+    struct target {
+        std::uint64_t id;
+        void* map;
+        std::size_t (*shard_count)(void*) noexcept;
+        std::optional<std::size_t> (*try_purge_shard)(void*, std::size_t);
+        std::size_t cursor = 0;
+    };
+
+    // Shared with the registrations, which may outlive the reaper.
+    struct registry {
+        std::mutex mutex;
+        std::vector<target> targets;
+        std::uint64_t next_id = 0;
+    };
+
+public:
+    using size_type = std::size_t;
+
+    // Keeps a map attached to the reaper; destroying it detaches the map.
+    class registration {
+    public:
+        registration() noexcept = default;
+
+        registration(registration&& other) noexcept
+            : registry_(std::move(other.registry_)), id_(other.id_) {}
+
+        registration& operator=(registration&& other) noexcept {
+            if (this != &other) {
+                reset();
+                registry_ = std::move(other.registry_);
+                id_ = other.id_;
+            }
+            return *this;
+        }
+
+        ~registration() { reset(); }
+
+        // Detaches the map now, waiting for a purge of it in progress.
+        void reset() noexcept {
+            if (auto r = registry_.lock()) {
+                std::lock_guard lock(r->mutex);
+                std::erase_if(r->targets, [this](const target& t) { return t.id == id_; });
+            }
+            registry_.reset();
+        }
+
+    private:
+        friend class weak_hash_map_reaper;
+
+        registration(std::weak_ptr<registry> r, std::uint64_t id) noexcept : registry_(std::move(r)), id_(id) {}
+
+        std::weak_ptr<registry> registry_;
+        std::uint64_t id_ = 0;
+    };
+
+    explicit weak_hash_map_reaper(std::chrono::nanoseconds interval = std::chrono::milliseconds(10),
+                                  size_type shards_per_tick = 1)
+        : interval_(interval),
+          shards_per_tick_(shards_per_tick ? shards_per_tick : 1),
+          registry_(std::make_shared<registry>()),
+          thread_([this](std::stop_token stop) { run(stop); }) {}
+
+    weak_hash_map_reaper(const weak_hash_map_reaper&) = delete;
+    weak_hash_map_reaper& operator=(const weak_hash_map_reaper&) = delete;
+
+    ~weak_hash_map_reaper() { stop(); }
+
+    // Attaches a concurrent_weak_hash_map (or any type with shard_count()
+    // and try_purge_shard()).
+    template <class Map>
+    [[nodiscard]] registration attach(Map& map) {
+        std::lock_guard lock(registry_->mutex);
+        const std::uint64_t id = registry_->next_id++;
+        registry_->targets.push_back(target{
+            id, &map, [](void* m) noexcept -> size_type { return static_cast<Map*>(m)->shard_count(); },
+            [](void* m, size_type i) -> std::optional<size_type> { return static_cast<Map*>(m)->try_purge_shard(i); }});
+        return registration(registry_, id);
+    }
+
+    // Stops the thread after the current tick. Idempotent.
+    void stop() noexcept {
+        thread_.request_stop();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // Entries removed and busy shards skipped since the reaper started.
+    size_type removed() const noexcept { return removed_.load(std::memory_order_relaxed); }
+    size_type skipped() const noexcept { return skipped_.load(std::memory_order_relaxed); }
+
+private:
+    void run(std::stop_token stop) {
+        std::mutex sleep_mutex;
+        std::condition_variable_any wake;
+        while (!stop.stop_requested()) {
+            tick();
+            std::unique_lock lock(sleep_mutex);
+            wake.wait_for(lock, stop, interval_, [] { return false; });
+        }
+    }
+
+    // The registry lock is held while purging, which is what lets a
+    // registration wait for a purge of its map to finish.
+    void tick() {
+        std::lock_guard lock(registry_->mutex);
+        for (target& t : registry_->targets) {
+            const size_type shards = t.shard_count(t.map);
+            for (size_type n = 0; n != shards_per_tick_ && n != shards; ++n) {
+                t.cursor = t.cursor < shards ? t.cursor : 0;
+                try {
+                    if (auto r = t.try_purge_shard(t.map, t.cursor)) {
+                        removed_.fetch_add(*r, std::memory_order_relaxed);
+                    } else {
+                        skipped_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                } catch (...) {
+                    // A failed rebuild leaves the shard as it was; try again
+                    // on a later pass.
+                }
+                ++t.cursor;
+            }
+        }
+    }
+
+    std::chrono::nanoseconds interval_;
+    size_type shards_per_tick_;
+    std::atomic<size_type> removed_{0};
+    std::atomic<size_type> skipped_{0};
+    std::shared_ptr<registry> registry_;
+    std::jthread thread_;
+};
+
+}  // namespace whm
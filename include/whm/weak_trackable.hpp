@@ -0,0 +1,150 @@
+#pragma once
+
+// Intrusive weak references for objects that derive from weak_trackable.
+//
+// A std::weak_ptr is two pointers wide, and a weak_hash_map slot also caches
+// the key's address next to it. A weak_ref<T> is the cached address plus a
+// pointer to a small liveness cell owned jointly by the object and its weak
+// references, so it takes the place of both. The cell is allocated the first
+// time a weak_ref to the object is made and outlives the object for as long
+// as weak references to it remain.
+//
+// weak_ref does not pin its object: get() says whether the object was alive
+// at the time of the call, nothing more. The object may be owned in any way
+// (shared_ptr, unique_ptr, a member, the stack); whoever destroys it must not
+// race with users of its weak references, as with any raw pointer.
+//
+// weak_hash_map stores keys as weak_ref<K> whenever K derives from
+// weak_trackable.
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace whm {
+
+namespace detail {
+
+struct weak_cell {
+    std::atomic<std::uint32_t> refs{1};  // the object's reference plus one per weak_ref
+    std::atomic<bool> alive{true};
+
+    void retain() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+
+    void release() noexcept {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+};
+
+}  // namespace detail
+
+class weak_trackable {
+protected:
+    weak_trackable() noexcept = default;
+
+    // A copy is a different object with weak references of its own.
+    weak_trackable(const weak_trackable&) noexcept {}
+    weak_trackable& operator=(const weak_trackable&) noexcept { return *this; }
+
+    // Runs after the destructors of derived classes: until then the object
+    // still counts as alive.
+    ~weak_trackable() {
+        if (detail::weak_cell* cell = cell_.load(std::memory_order_acquire)) {
+            cell->alive.store(false, std::memory_order_release);
+            cell->release();
+        }
+    }
+
+private:
+    template <class T>
+    friend class weak_ref;
+
+    // The object's cell, created on first use. Racing creators agree on one.
+    detail::weak_cell* cell() const {
+        detail::weak_cell* cell = cell_.load(std::memory_order_acquire);
+        if (cell == nullptr) {
+            auto* fresh = new detail::weak_cell;
+            if (cell_.compare_exchange_strong(cell, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                cell = fresh;
+            } else {
+                delete fresh;
+            }
+        }
+        return cell;
+    }
+
+    mutable std::atomic<detail::weak_cell*> cell_{nullptr};
+};
+
+template <class T>
+class weak_ref {
+    static_assert(std::is_base_of_v<weak_trackable, T>, "weak_ref<T> needs T to derive from weak_trackable");
+
+public:
+    using element_type = T;
+
+    weak_ref() noexcept = default;
+
+    // A null `p` gives an empty reference. Allocates the object's cell if it
+    // has none yet.
+    explicit weak_ref(T* p) : ptr_(p), cell_(p ? static_cast<const weak_trackable*>(p)->cell() : nullptr) {
+        if (cell_) {
+            cell_->retain();
+        }
+    }
+
+    weak_ref(const weak_ref& other) noexcept : ptr_(other.ptr_), cell_(other.cell_) {
+        if (cell_) {
+            cell_->retain();
+        }
+    }
+
+    weak_ref(weak_ref&& other) noexcept
+        : ptr_(std::exchange(other.ptr_, nullptr)), cell_(std::exchange(other.cell_, nullptr)) {}
+
+    weak_ref& operator=(weak_ref other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~weak_ref() {
+        if (cell_) {
+            cell_->release();
+        }
+    }
+
+    void reset() noexcept { weak_ref().swap(*this); }
+
+    void swap(weak_ref& other) noexcept {
+        std::swap(ptr_, other.ptr_);
+        std::swap(cell_, other.cell_);
+    }
+
+    friend void swap(weak_ref& a, weak_ref& b) noexcept { a.swap(b); }
+
+    // True once the object has been destroyed, and for an empty reference.
+    bool expired() const noexcept { return cell_ == nullptr || !cell_->alive.load(std::memory_order_acquire); }
+
+    // The object, or null if it has been destroyed.
+    T* get() const noexcept { return expired() ? nullptr : ptr_; }
+
+    // The object's address, kept after its death.
+    const T* address() const noexcept { return ptr_; }
+
+    // True if this refers to `p` itself rather than to an earlier object
+    // at its address. `p` must be alive; only its cell is read, never the
+    // referenced object's.
+    bool refers_to(const T* p) const noexcept {
+        return cell_ != nullptr && p != nullptr &&
+               cell_ == static_cast<const weak_trackable*>(p)->cell_.load(std::memory_order_acquire);
+    }
+
+private:
+    T* ptr_ = nullptr;
+    detail::weak_cell* cell_ = nullptr;
+};
+
+}  // namespace whm
@@ -0,0 +1,445 @@
+#pragma once
+
+// weak_value_hash_map: the inverse of weak_hash_map. Keys are ordinary
+// values; mapped values are held through std::weak_ptr, so an entry lives
+// only as long as somebody else owns its value. Suited to caches that
+// deduplicate shared resources (e.g. assets by path) without keeping them
+// alive.
+//
+// An entry whose value has died is "expired": lookups treat it as absent,
+// inserting under its key reuses the slot, and it is reclaimed by purge(),
+// the Sweep policy, a rebuild of the table, or a non-const find() that
+// lands on it. The table is the same flat raw_table as weak_hash_map's.
+
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "detail/iterator.hpp"
+#include "detail/raw_table.hpp"
+#include "policy.hpp"
+#include "stats.hpp"
+
+namespace whm {
+
+namespace detail {
+
+template <class K, class V>
+struct weak_value_policy {
+    // `ptr` caches the value's address while it was pinned, so that death
+    // notifications (which name the dead object) can find their entry.
+    struct slot_type {
+        template <class Key>
+        slot_type(std::in_place_t, Key&& k, const std::shared_ptr<V>& v)
+            : key(std::forward<Key>(k)), ptr(v.get()), value(v) {}
+
+        void assign(const std::shared_ptr<V>& v) noexcept {
+            ptr = v.get();
+            value = v;
+        }
+
+        K key;
+        const V* ptr;
+        std::weak_ptr<V> value;
+    };
+
+    template <class A, class... Args>
+    static void construct(A& alloc, slot_type* slot, Args&&... args) {
+        std::allocator_traits<A>::construct(alloc, slot, std::forward<Args>(args)...);
+    }
+
+    template <class A>
+    static void destroy(A& alloc, slot_type* slot) noexcept {
+        std::allocator_traits<A>::destroy(alloc, slot);
+    }
+
+    template <class A>
+    static void transfer(A& alloc, slot_type* dst, slot_type* src) noexcept(
+        std::is_nothrow_move_constructible_v<slot_type>) {
+        construct(alloc, dst, std::move(*src));
+        destroy(alloc, src);
+    }
+
+    // User hashes (std::hash of an integer is the identity) are mixed so
+    // that both halves of the value carry entropy for h1 and h2.
+    template <class H>
+    static std::size_t hash_slot(const H& hash, const slot_type& slot) noexcept(
+        std::is_nothrow_invocable_v<const H&, const K&>) {
+        return mix(hash(slot.key));
+    }
+
+    static bool expired(const slot_type& slot) noexcept { return slot.value.expired(); }
+
+    static const void* address(const slot_type& slot) noexcept { return slot.ptr; }
+};
+
+// Lookups by any type the hasher and key_equal accept, as for the standard
+// unordered containers.
+template <class Hash, class KeyEqual>
+concept transparent_lookup = requires {
+    typename Hash::is_transparent;
+    typename KeyEqual::is_transparent;
+};
+
+}  // namespace detail
+
+// `Resize`, `Stats` and `Evict` are as for weak_hash_map.
+template <class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+          class Alloc = std::allocator<std::pair<const K, std::weak_ptr<V>>>, class Sweep = no_sweep,
+          class Resize = default_resize_policy, class Stats = no_stats, class Evict = no_eviction>
+class weak_value_hash_map {
+    using policy = detail::weak_value_policy<K, V>;
+    using table_type = detail::raw_table<policy, Hash, Alloc, Resize, Stats, Evict>;
+    using slot_type = typename policy::slot_type;
+
+public:
+    using key_type = K;
+    using element_type = V;
+    using mapped_type = std::weak_ptr<V>;
+    using value_type = std::pair<const K, std::weak_ptr<V>>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Alloc;
+    using sweep_policy = Sweep;
+    using resize_policy = Resize;
+    using stats_policy = Stats;
+    using eviction_policy = Evict;
+    using reference = std::pair<const K&, const std::weak_ptr<V>&>;
+    using const_reference = reference;
+
+private:
+    // Values are only replaced through the map, which keeps the cached
+    // address in step, so both iterators hand out const references.
+    template <bool Const>
+    class basic_iterator {
+        friend class weak_value_hash_map;
+        using table_ptr = std::conditional_t<Const, const table_type*, table_type*>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = weak_value_hash_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = weak_value_hash_map::reference;
+        using pointer = detail::arrow_proxy<reference>;
+
+        basic_iterator() noexcept = default;
+
+        template <bool C = Const, class = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false>& other) noexcept
+            : table_(other.table_), index_(other.index_) {}
+
+        reference operator*() const noexcept {
+            const auto& slot = table_->slot_at(index_);
+            return reference(slot.key, slot.value);
+        }
+
+        pointer operator->() const noexcept { return pointer{**this}; }
+
+        basic_iterator& operator++() noexcept {
+            index_ = table_->next_full(index_ + 1);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept {
+            basic_iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        friend bool operator==(const basic_iterator& a, const basic_iterator& b) noexcept {
+            return a.index_ == b.index_;
+        }
+
+    private:
+        basic_iterator(table_ptr table, size_type index) noexcept : table_(table), index_(index) {}
+
+        table_ptr table_ = nullptr;
+        size_type index_ = 0;
+    };
+
+public:
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    weak_value_hash_map() = default;
+
+    explicit weak_value_hash_map(size_type bucket_count, const Hash& hash = Hash(), const KeyEqual& eq = KeyEqual(),
+                                 const Alloc& alloc = Alloc())
+        : table_(bucket_count, hash, typename table_type::allocator_type(alloc)), eq_(eq) {}
+
+    explicit weak_value_hash_map(const Alloc& alloc) : weak_value_hash_map(0, Hash(), KeyEqual(), alloc) {}
+
+    // Iteration visits expired entries too; check value.expired() or lock().
+    iterator begin() noexcept { return iterator(&table_, table_.next_full(0)); }
+    iterator end() noexcept { return iterator(&table_, table_.capacity()); }
+    const_iterator begin() const noexcept { return const_iterator(&table_, table_.next_full(0)); }
+    const_iterator end() const noexcept { return const_iterator(&table_, table_.capacity()); }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    // Number of stored entries, including expired ones not yet reclaimed.
+    size_type size() const noexcept { return table_.size(); }
+    bool empty() const noexcept { return table_.empty(); }
+    size_type capacity() const noexcept { return table_.capacity(); }
+
+    void clear() noexcept { table_.clear(); }
+    void reserve(size_type n) { table_.reserve(n); }
+    void rehash(size_type n) { table_.rehash(n); }
+
+    // Rebuilds the table at the smallest capacity that holds the live
+    // entries, dropping the expired ones; frees it if none are left.
+    void shrink_to_fit() { table_.shrink_to_fit(); }
+
+    // Removes every entry whose value has expired. Returns the number removed.
+    //
+    // With a shrinking Resize policy (shrink_on_sparse), purge() and
+    // erase(key) may also shrink the table, invalidating iterators.
+    size_type purge() {
+        return table_.timed_sweep([this] {
+            const size_type removed = table_.purge();
+            table_.shrink_if_sparse();
+            return removed;
+        });
+    }
+
+    // Counters of a collecting Stats policy.
+    table_stats stats() const noexcept
+        requires Stats::enabled
+    {
+        return table_.stats().snapshot(table_.size(), table_.capacity(), table_.tombstones());
+    }
+
+    // As for weak_hash_map, except that `heap_bytes` is called with the keys
+    // of the live entries: the map owns its keys, not its values. An expired
+    // entry still keeps its value's control block allocated (and with
+    // std::make_shared the value's storage too) until it is reclaimed.
+    memory_footprint memory_usage() const noexcept {
+        memory_footprint m = table_.memory_usage();
+        if constexpr (std::is_same_v<Sweep, tracked_sweep>) {
+            m.auxiliary += sweep_.memory_usage();
+        }
+        return m;
+    }
+
+    template <class F>
+    memory_footprint memory_usage(F&& heap_bytes) const {
+        memory_footprint m = memory_usage();
+        for (size_type i = table_.next_full(0); i != table_.capacity(); i = table_.next_full(i + 1)) {
+            if (const slot_type& slot = table_.slot_at(i); !slot.value.expired()) {
+                m.heap += std::invoke(heap_bytes, slot.key);
+            }
+        }
+        return m;
+    }
+
+    // As for weak_hash_map: a cap on the table, with the Evict policy
+    // picking the live entries given up to it.
+    void set_memory_budget(size_type bytes)
+        requires Evict::enabled
+    {
+        table_.set_memory_budget(bytes);
+    }
+
+    size_type memory_budget() const noexcept
+        requires Evict::enabled
+    {
+        return table_.memory_budget();
+    }
+
+    // Maps `key` to `value` unless a live value is already mapped to it; an
+    // expired entry for `key` is reused. Returns the value mapped afterwards
+    // and whether it is `value`.
+    std::pair<std::shared_ptr<V>, bool> try_emplace(const K& key, const std::shared_ptr<V>& value) {
+        return emplace_impl(key, value, false);
+    }
+
+    std::pair<std::shared_ptr<V>, bool> try_emplace(K&& key, const std::shared_ptr<V>& value) {
+        return emplace_impl(std::move(key), value, false);
+    }
+
+    std::pair<std::shared_ptr<V>, bool> insert(const K& key, const std::shared_ptr<V>& value) {
+        return try_emplace(key, value);
+    }
+
+    // Maps `key` to `value`, replacing any current value. Returns true if a
+    // new entry was created.
+    bool insert_or_assign(const K& key, const std::shared_ptr<V>& value) {
+        return emplace_impl(key, value, true).second;
+    }
+
+    bool insert_or_assign(K&& key, const std::shared_ptr<V>& value) {
+        return emplace_impl(std::move(key), value, true).second;
+    }
+
+    // Creates a value whose death erases the entry for `key` at the start of
+    // the next operation on this map. The value still has to be inserted.
+    // Only available with tracked_sweep.
+    template <class T = V, class... Args>
+        requires std::is_same_v<Sweep, tracked_sweep> && std::is_convertible_v<T*, V*>
+    std::shared_ptr<T> make_tracked(const K& key, Args&&... args) {
+        auto node = std::make_unique<detail::expiry_node>();
+        node->hash = hash_of(key);
+        std::weak_ptr<detail::expiry_queue> queue = sweep_.get_queue();
+        T* object = new T(std::forward<Args>(args)...);
+        node->address = static_cast<const V*>(object);
+        // If shared_ptr's allocation throws, it calls the deleter, which
+        // frees the object.
+        return std::shared_ptr<T>(object, detail::tracked_deleter<T>{std::move(queue), std::move(node)});
+    }
+
+    // The live value mapped to `key`, or null. The non-const overload runs a
+    // sweep step first and erases the entry if its value has expired.
+    std::shared_ptr<V> find(const K& key) { return find_impl(key); }
+    std::shared_ptr<V> find(const K& key) const { return find_impl(key); }
+
+    template <class Q>
+        requires detail::transparent_lookup<Hash, KeyEqual>
+    std::shared_ptr<V> find(const Q& key) {
+        return find_impl(key);
+    }
+
+    template <class Q>
+        requires detail::transparent_lookup<Hash, KeyEqual>
+    std::shared_ptr<V> find(const Q& key) const {
+        return find_impl(key);
+    }
+
+    // True if a live value is mapped to `key`.
+    bool contains(const K& key) const { return contains_impl(key); }
+
+    template <class Q>
+        requires detail::transparent_lookup<Hash, KeyEqual>
+    bool contains(const Q& key) const {
+        return contains_impl(key);
+    }
+
+    size_type count(const K& key) const { return contains(key) ? 1 : 0; }
+
+    // Erases the entry for `key`, live or expired.
+    size_type erase(const K& key) { return erase_impl(key); }
+
+    template <class Q>
+        requires detail::transparent_lookup<Hash, KeyEqual>
+    size_type erase(const Q& key) {
+        return erase_impl(key);
+    }
+
+    iterator erase(const_iterator pos) {
+        table_.erase_at(pos.index_);
+        return iterator(&table_, table_.next_full(pos.index_ + 1));
+    }
+
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+    void swap(weak_value_hash_map& other) noexcept {
+        table_.swap(other.table_);
+        using std::swap;
+        swap(eq_, other.eq_);
+        swap(sweep_, other.sweep_);
+    }
+
+    friend void swap(weak_value_hash_map& a, weak_value_hash_map& b) noexcept { a.swap(b); }
+
+    hasher hash_function() const { return table_.hash_ref(); }
+    key_equal key_eq() const { return eq_; }
+    allocator_type get_allocator() const { return allocator_type(table_.alloc_ref()); }
+
+private:
+    static constexpr size_type npos = table_type::npos;
+
+    template <class Q>
+    size_type hash_of(const Q& key) const {
+        return detail::mix(table_.hash_ref()(key));
+    }
+
+    template <class Q>
+    auto matches(const Q& key) const {
+        return [this, &key](const slot_type& slot) { return eq_(slot.key, key); };
+    }
+
+    template <class Q>
+    size_type find_index(const Q& key) const {
+        const size_type index = table_.empty() ? npos : table_.find(hash_of(key), matches(key));
+        table_.stats().on_lookup(index != npos);
+        return index;
+    }
+
+    std::shared_ptr<V> lock_value(const slot_type& slot) const {
+        table_.stats().on_lock();
+        std::shared_ptr<V> value = slot.value.lock();
+        if (!value) {
+            table_.stats().on_expired_hit();
+        }
+        return value;
+    }
+
+    template <class Key>
+    std::pair<std::shared_ptr<V>, bool> emplace_impl(Key&& key, const std::shared_ptr<V>& value, bool assign) {
+        assert(value && "weak_value_hash_map values must not be null");
+        table_.sweep_step(sweep_);
+        auto [index, inserted] = table_.find_or_prepare_insert(hash_of(key), matches(key));
+        if (inserted) {
+            table_.construct_at(index, std::in_place, std::forward<Key>(key), value);
+            return {value, true};
+        }
+        slot_type& slot = table_.slot_at(index);
+        if (!assign) {
+            if (std::shared_ptr<V> current = slot.value.lock()) {
+                return {std::move(current), false};
+            }
+        }
+        slot.assign(value);
+        return {value, !assign};
+    }
+
+    template <class Q>
+    std::shared_ptr<V> find_impl(const Q& key) {
+        table_.sweep_step(sweep_);
+        const size_type index = find_index(key);
+        if (index == npos) {
+            return nullptr;
+        }
+        std::shared_ptr<V> value = lock_value(table_.slot_at(index));
+        if (!value) {
+            table_.erase_at(index);
+        }
+        return value;
+    }
+
+    template <class Q>
+    std::shared_ptr<V> find_impl(const Q& key) const {
+        const size_type index = find_index(key);
+        return index == npos ? nullptr : lock_value(table_.slot_at(index));
+    }
+
+    template <class Q>
+    bool contains_impl(const Q& key) const {
+        const size_type index = find_index(key);
+        return index != npos && !table_.slot_at(index).value.expired();
+    }
+
+    template <class Q>
+    size_type erase_impl(const Q& key) {
+        table_.sweep_step(sweep_);
+        const size_type index = find_index(key);
+        if (index == npos) {
+            return 0;
+        }
+        table_.erase_at(index);
+        table_.shrink_if_sparse();
+        return 1;
+    }
+
+    table_type table_;
+    [[no_unique_address]] KeyEqual eq_{};
+    [[no_unique_address]] Sweep sweep_{};
+};
+
+}  // namespace whm
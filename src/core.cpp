@@ -0,0 +1,10 @@
+// The non-template core of the weak containers, compiled once for programs
+// that link weak_hash_map_core instead of inline in each of their
+// translation units (see include/whm/detail/table_core.hpp).
+
+#if !defined(WHM_SEPARATE_CORE)
+#error "weak_hash_map_core must be built with WHM_SEPARATE_CORE"
+#endif
+
+#include <whm/detail/stats_impl.hpp>
+#include <whm/detail/table_core_impl.hpp>
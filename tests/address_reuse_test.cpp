@@ -0,0 +1,150 @@
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include <whm/policy.hpp>
+#include <whm/weak_hash_map.hpp>
+#include <whm/weak_trackable.hpp>
+
+// A key dies while its entry is still stored, and a new object is created
+// at the same address. The stale entry must neither match the new key nor
+// be mistaken for it when it is reclaimed.
+
+namespace {
+
+struct object {
+    int id = 0;
+};
+
+// Larger than the map's own bookkeeping allocations, so that the allocator
+// hands a freed key's memory to the next key rather than to those.
+struct large_object {
+    char bytes[256] = {};
+};
+
+struct trackable_object : whm::weak_trackable {
+    explicit trackable_object(int i) : id(i) {}
+    int id;
+};
+
+// Storage for one object at a time, so that every object made from it has
+// the same address.
+template <class T>
+class reused_storage {
+public:
+    template <class... Args>
+    T* construct(Args&&... args) {
+        return ::new (static_cast<void*>(bytes_)) T(std::forward<Args>(args)...);
+    }
+
+    // Owns the object through a separate control block, which outlives it
+    // for as long as weak_ptrs to it remain.
+    template <class... Args>
+    std::shared_ptr<T> make_shared(Args&&... args) {
+        return std::shared_ptr<T>(construct(std::forward<Args>(args)...), [](T* p) { p->~T(); });
+    }
+
+private:
+    alignas(T) unsigned char bytes_[sizeof(T)];
+};
+
+TEST(AddressReuse, NewKeyDoesNotMatchTheStaleEntry) {
+    whm::weak_hash_map<object, std::string> map;
+    reused_storage<object> storage;
+    auto old_key = storage.make_shared(object{1});
+    map.try_emplace(old_key, "old");
+    const object* address = old_key.get();
+    old_key.reset();
+
+    auto new_key = storage.make_shared(object{2});
+    ASSERT_EQ(new_key.get(), address);
+    EXPECT_EQ(map.find(new_key), map.end());
+    EXPECT_FALSE(map.contains(new_key.get()));
+    EXPECT_FALSE(map.contains(std::weak_ptr<object>(new_key)));
+    EXPECT_EQ(map.counts().expired, 1u);
+}
+
+// The unpinned lookups compare ownership too, not just the address.
+TEST(AddressReuse, UnpinnedLookupsMissTheNewKey) {
+    whm::weak_hash_map<object, std::string> map;
+    reused_storage<object> storage;
+    auto old_key = storage.make_shared(object{1});
+    map.try_emplace(old_key, "old");
+    EXPECT_TRUE(map.contains_live(old_key));
+    const object* address = old_key.get();
+    old_key.reset();
+
+    auto new_key = storage.make_shared(object{2});
+    ASSERT_EQ(new_key.get(), address);
+    EXPECT_FALSE(map.contains_live(new_key));
+    EXPECT_EQ(map.find_unpinned(new_key), nullptr);
+    EXPECT_EQ(std::as_const(map).find_unpinned(new_key), nullptr);
+}
+
+// Inserting the new key takes over the stale entry rather than adding a
+// second one at the same address.
+TEST(AddressReuse, InsertReplacesTheStaleEntry) {
+    whm::weak_hash_map<object, std::string> map;
+    reused_storage<object> storage;
+    auto key = storage.make_shared(object{0});
+    for (int i = 1; i != 8; ++i) {
+        map.insert_or_assign(key, std::to_string(i));
+        key = nullptr;
+        key = storage.make_shared(object{i});
+        EXPECT_FALSE(map.contains(key));
+    }
+    EXPECT_TRUE(map.try_emplace(key, "new").second);
+    EXPECT_EQ(map.size(), 1u);
+    EXPECT_EQ(map.at(key), "new");
+    EXPECT_EQ(map.at(key.get()), "new");
+    EXPECT_EQ(map.purge(), 0u);
+
+    map.rehash(0);
+    EXPECT_EQ(map.at(key.get()), "new");
+}
+
+TEST(AddressReuse, TrackableKeys) {
+    whm::weak_hash_map<trackable_object, std::string> map;
+    reused_storage<trackable_object> storage;
+    trackable_object* old_key = storage.construct(1);
+    map.try_emplace(old_key, "old");
+    old_key->~trackable_object();
+
+    trackable_object* new_key = storage.construct(2);
+    ASSERT_EQ(new_key, old_key);
+    EXPECT_FALSE(map.contains(new_key));
+    EXPECT_FALSE(map.contains_live(new_key));
+    EXPECT_EQ(map.find_unpinned(new_key), nullptr);
+    EXPECT_TRUE(map.try_emplace(new_key, "new").second);
+    EXPECT_EQ(map.size(), 1u);
+    EXPECT_EQ(map.at(new_key), "new");
+    new_key->~trackable_object();
+}
+
+// The dead key's notification names only its address and hash, and is
+// handled when the new key at that address is inserted.
+TEST(AddressReuse, TrackedSweepSparesTheNewKey) {
+    using map_type = whm::weak_hash_map<large_object, std::string, whm::pointer_hash<large_object>,
+                                        whm::pointer_equal<large_object>,
+                                        std::allocator<std::pair<const std::weak_ptr<large_object>, std::string>>,
+                                        whm::tracked_sweep>;
+    map_type map;
+    auto old_key = map.make_tracked();
+    map.try_emplace(old_key, "old");
+    const large_object* address = old_key.get();
+    old_key.reset();
+
+    auto new_key = map.make_tracked();
+    if (new_key.get() != address) {
+        GTEST_SKIP() << "the allocator did not reuse the address";
+    }
+    EXPECT_FALSE(map.contains(new_key.get()));
+    map.try_emplace(new_key, "new");
+    EXPECT_EQ(map.size(), 1u);
+    EXPECT_EQ(map.at(new_key), "new");
+}
+
+}  // namespace
@@ -0,0 +1,251 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/arena.hpp>
+#include <whm/concurrent_weak_hash_map.hpp>
+#include <whm/weak_hash_map.hpp>
+#include <whm/weak_value_hash_map.hpp>
+
+namespace {
+
+struct object {
+    int id = 0;
+};
+
+// The blocks a counting_allocator has handed out and not yet taken back.
+struct allocation_log {
+    std::map<std::uintptr_t, std::size_t> blocks;  // address -> bytes
+    std::size_t allocations = 0;
+
+    // Whether [p, p + bytes) lies inside one live block.
+    bool holds(const void* p, std::size_t bytes) const {
+        const auto address = reinterpret_cast<std::uintptr_t>(p);
+        auto it = blocks.upper_bound(address);
+        if (it == blocks.begin()) {
+            return false;
+        }
+        --it;
+        return address + bytes <= it->first + it->second;
+    }
+};
+
+// Stateful and not propagated, like most arena or pool handles.
+template <class T>
+class counting_allocator {
+public:
+    using value_type = T;
+
+    explicit counting_allocator(allocation_log& log) noexcept : log_(&log) {}
+
+    template <class U>
+    counting_allocator(const counting_allocator<U>& other) noexcept : log_(other.log_) {}
+
+    T* allocate(std::size_t n) {
+        T* p = std::allocator<T>().allocate(n);
+        log_->blocks[reinterpret_cast<std::uintptr_t>(p)] = n * sizeof(T);
+        ++log_->allocations;
+        return p;
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        auto it = log_->blocks.find(reinterpret_cast<std::uintptr_t>(p));
+        EXPECT_NE(it, log_->blocks.end()) << "freed a block this allocator did not hand out";
+        if (it != log_->blocks.end()) {
+            EXPECT_EQ(it->second, n * sizeof(T));
+            log_->blocks.erase(it);
+        }
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    allocation_log& log() const noexcept { return *log_; }
+
+    template <class U>
+    friend bool operator==(const counting_allocator& a, const counting_allocator<U>& b) noexcept {
+        return &a.log() == &b.log();
+    }
+
+private:
+    template <class U>
+    friend class counting_allocator;
+
+    allocation_log* log_;
+};
+
+template <class V>
+using counting_map = whm::weak_hash_map<object, V, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                        counting_allocator<std::pair<const std::weak_ptr<object>, V>>>;
+
+template <class V>
+using arena_map = whm::weak_hash_map<object, V, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                     whm::arena_allocator<std::pair<const std::weak_ptr<object>, V>>>;
+
+std::vector<std::shared_ptr<object>> make_objects(std::size_t n) {
+    std::vector<std::shared_ptr<object>> objects;
+    for (std::size_t i = 0; i != n; ++i) {
+        objects.push_back(std::make_shared<object>(object{static_cast<int>(i)}));
+    }
+    return objects;
+}
+
+TEST(Allocator, SlotsAndValuesLiveInAllocatedStorage) {
+    allocation_log log;
+    auto objects = make_objects(1000);
+    {
+        counting_map<int> map(counting_allocator<int>{log});
+        for (const auto& o : objects) {
+            map.try_emplace(o, o->id);
+        }
+        EXPECT_GT(log.allocations, 1u);
+        // Every rebuild handed its old storage back.
+        EXPECT_EQ(log.blocks.size(), 1u);
+        for (const auto& o : objects) {
+            EXPECT_TRUE(log.holds(&map.at(o), sizeof(int)));
+        }
+
+        objects.resize(100);
+        map.shrink_to_fit();
+        EXPECT_EQ(log.blocks.size(), 1u);
+        EXPECT_TRUE(log.holds(&map.at(objects[0]), sizeof(int)));
+        EXPECT_EQ(&map.get_allocator().log(), &log);
+    }
+    EXPECT_TRUE(log.blocks.empty());
+}
+
+TEST(Allocator, CopiesAndMovesKeepTheirOwnAllocator) {
+    allocation_log a_log;
+    allocation_log b_log;
+    auto objects = make_objects(100);
+    {
+        counting_map<int> a(counting_allocator<int>{a_log});
+        counting_map<int> b(counting_allocator<int>{b_log});
+        for (const auto& o : objects) {
+            b.try_emplace(o, o->id);
+        }
+
+        counting_map<int> copy(b);
+        EXPECT_EQ(&copy.get_allocator().log(), &b_log);
+
+        // The allocators differ and do not propagate, so the entries are
+        // moved one by one into storage from a's allocator.
+        a = std::move(b);
+        EXPECT_EQ(&a.get_allocator().log(), &a_log);
+        EXPECT_EQ(a.size(), objects.size());
+        for (const auto& o : objects) {
+            EXPECT_TRUE(a_log.holds(&a.at(o), sizeof(int)));
+        }
+        a = copy;
+        EXPECT_EQ(&a.get_allocator().log(), &a_log);
+        EXPECT_TRUE(a_log.holds(&a.at(objects[0]), sizeof(int)));
+    }
+    EXPECT_TRUE(a_log.blocks.empty());
+    EXPECT_TRUE(b_log.blocks.empty());
+}
+
+TEST(Allocator, WeakValueMapUsesItsAllocator) {
+    allocation_log log;
+    auto objects = make_objects(200);
+    {
+        whm::weak_value_hash_map<int, object, std::hash<int>, std::equal_to<int>,
+                                 counting_allocator<std::pair<const int, std::weak_ptr<object>>>>
+            cache(counting_allocator<int>{log});
+        for (const auto& o : objects) {
+            cache.try_emplace(o->id, o);
+        }
+        EXPECT_EQ(log.blocks.size(), 1u);
+        objects.clear();
+        EXPECT_EQ(cache.purge(), 200u);
+    }
+    EXPECT_TRUE(log.blocks.empty());
+}
+
+template <class Reads>
+void fill_concurrent_map(allocation_log& log) {
+    auto objects = make_objects(500);
+    {
+        whm::concurrent_weak_hash_map<object, int, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                      counting_allocator<std::pair<const std::weak_ptr<object>, int>>, whm::no_sweep,
+                                      Reads>
+            map(8, {}, {}, counting_allocator<int>{log});
+        for (const auto& o : objects) {
+            map.try_emplace(o, o->id);
+        }
+        for (std::size_t i = 0; i < objects.size(); i += 2) {
+            map.insert_or_assign(objects[i], -1);
+        }
+        EXPECT_GT(log.allocations, 8u);
+        objects.resize(10);
+        map.purge();
+        EXPECT_EQ(map.find(objects[1]), 1);
+    }
+    EXPECT_TRUE(log.blocks.empty());
+}
+
+TEST(Allocator, ConcurrentMapUsesItsAllocatorForShardsAndTables) {
+    allocation_log log;
+    fill_concurrent_map<whm::locked_reads>(log);
+}
+
+// Entries are published and retired through the same allocator.
+TEST(Allocator, LockFreeShardsUseItsAllocatorForEntries) {
+    allocation_log log;
+    fill_concurrent_map<whm::lock_free_reads>(log);
+}
+
+TEST(Arena, MapWorksUntilTheArenaIsReleased) {
+    whm::arena arena(256);
+    auto objects = make_objects(1000);
+    using alloc = whm::arena_allocator<std::pair<const std::weak_ptr<object>, std::string>>;
+    auto* map = ::new (arena.allocate(sizeof(arena_map<std::string>), alignof(arena_map<std::string>)))
+        arena_map<std::string>(alloc(arena));
+    for (const auto& o : objects) {
+        map->try_emplace(o, std::to_string(o->id));
+    }
+    const std::size_t reserved = arena.bytes_reserved();
+    EXPECT_GT(reserved, 1000 * sizeof(std::weak_ptr<object>));
+
+    // Rebuilds take fresh memory from the arena and give none back.
+    objects.resize(500);
+    EXPECT_EQ(map->purge(), 500u);
+    map->rehash(0);
+    EXPECT_GE(arena.bytes_reserved(), reserved);
+    for (const auto& o : objects) {
+        EXPECT_EQ(map->at(o), std::to_string(o->id));
+    }
+    EXPECT_EQ(&map->get_allocator().resource(), &arena);
+
+    // Destroying the map releases the weak references; the arena frees the
+    // memory.
+    const std::weak_ptr<object> watched = objects[0];
+    std::destroy_at(map);
+    objects.clear();
+    EXPECT_TRUE(watched.expired());
+    arena.release();
+    EXPECT_EQ(arena.bytes_reserved(), 0u);
+}
+
+TEST(Arena, AllocationsAreAlignedAndChunksGrow) {
+    whm::arena arena(64);
+    void* a = arena.allocate(1, 1);
+    void* b = arena.allocate(8, 64);
+    void* c = arena.allocate(10000, 16);
+    EXPECT_NE(a, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b) % 64, 0u);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(c) % 16, 0u);
+    EXPECT_GE(arena.bytes_reserved(), 10000u);
+
+    whm::arena_allocator<int> ints(arena);
+    whm::arena_allocator<double> doubles(ints);
+    EXPECT_TRUE(ints == doubles);
+    whm::arena other;
+    EXPECT_FALSE(ints == whm::arena_allocator<int>(other));
+}
+
+}  // namespace
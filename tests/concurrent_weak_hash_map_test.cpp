@@ -0,0 +1,501 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <semaphore>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/concurrent_weak_hash_map.hpp>
+
+namespace {
+
+struct object {
+    explicit object(std::uint64_t s) noexcept : serial(s) {}
+    std::uint64_t serial;
+};
+
+template <class Reads>
+using map_for = whm::concurrent_weak_hash_map<object, std::uint64_t, whm::pointer_hash<object>,
+                                              whm::pointer_equal<object>,
+                                              std::allocator<std::pair<const std::weak_ptr<object>, std::uint64_t>>,
+                                              whm::incremental_sweep<8>, Reads>;
+
+template <class Reads>
+class ConcurrentWeakHashMap : public ::testing::Test {
+protected:
+    using map_type = map_for<Reads>;
+};
+
+using read_modes = ::testing::Types<whm::locked_reads, whm::lock_free_reads>;
+TYPED_TEST_SUITE(ConcurrentWeakHashMap, read_modes);
+
+TYPED_TEST(ConcurrentWeakHashMap, SingleThreadedOperations) {
+    typename TestFixture::map_type map(8);
+    auto a = std::make_shared<object>(1);
+    auto b = std::make_shared<object>(2);
+
+    EXPECT_TRUE(map.try_emplace(a, 1u));
+    EXPECT_FALSE(map.try_emplace(a, 10u));
+    EXPECT_TRUE(map.insert(b, 2u));
+    EXPECT_EQ(map.find(a), 1u);
+    EXPECT_TRUE(map.contains(std::weak_ptr<object>(b)));
+
+    EXPECT_FALSE(map.insert_or_assign(b, 20u));
+    EXPECT_EQ(map.find(b.get()), 20u);
+    EXPECT_TRUE(map.visit(b, [](std::uint64_t& v) { ++v; }));
+    EXPECT_EQ(map.find(b), 21u);
+
+    EXPECT_EQ(map.erase(a), 1u);
+    EXPECT_FALSE(map.find(a).has_value());
+    EXPECT_EQ(map.size(), 1u);
+
+    b.reset();
+    EXPECT_EQ(map.purge(), 1u);
+    EXPECT_TRUE(map.empty());
+}
+
+TYPED_TEST(ConcurrentWeakHashMap, ExpiredKeysAreNotFound) {
+    typename TestFixture::map_type map(4);
+    std::vector<std::shared_ptr<object>> objects;
+    for (std::uint64_t i = 0; i != 1000; ++i) {
+        objects.push_back(std::make_shared<object>(i));
+        map.try_emplace(objects.back(), i);
+    }
+    std::vector<const object*> dead;
+    for (std::size_t i = 0; i < objects.size(); i += 3) {
+        dead.push_back(objects[i].get());
+        objects[i].reset();
+    }
+    for (const object* p : dead) {
+        EXPECT_FALSE(map.contains(p));
+    }
+    for (const auto& o : objects) {
+        if (o) {
+            EXPECT_EQ(map.find(o), o->serial);
+        }
+    }
+    map.purge();
+    EXPECT_EQ(map.size(), objects.size() - dead.size());
+}
+
+// Every thread keeps its own keys and keeps replacing them, so keys die
+// while the other threads probe the same shards and their addresses are
+// handed to new keys. Values are the keys' serial numbers: a hit with any
+// other value came from a stale entry. Another thread purges throughout.
+TYPED_TEST(ConcurrentWeakHashMap, KeysDyingUnderConcurrentUse) {
+    constexpr int threads = 4;
+    constexpr int keys_per_thread = 64;
+    constexpr int operations = 20000;
+
+    typename TestFixture::map_type map(16);
+    std::atomic<std::uint64_t> next_serial{0};
+    std::atomic<int> errors{0};
+    std::atomic<bool> done{false};
+
+    auto worker = [&](unsigned seed) {
+        std::mt19937 rng(seed);
+        std::vector<std::shared_ptr<object>> keys;
+        for (int i = 0; i != keys_per_thread; ++i) {
+            keys.push_back(std::make_shared<object>(next_serial.fetch_add(1)));
+        }
+        for (int n = 0; n != operations; ++n) {
+            auto& key = keys[rng() % keys.size()];
+            switch (rng() % 5) {
+            case 0:
+                key = std::make_shared<object>(next_serial.fetch_add(1));
+                break;
+            case 1:
+                map.insert_or_assign(key, key->serial);
+                break;
+            case 2:
+                map.erase(key);
+                break;
+            default:
+                if (auto v = map.find(key); v && *v != key->serial) {
+                    errors.fetch_add(1);
+                }
+                break;
+            }
+        }
+    };
+    std::thread purger([&] {
+        while (!done.load()) {
+            map.purge();
+            std::this_thread::yield();
+        }
+    });
+    std::vector<std::thread> workers;
+    for (int t = 0; t != threads; ++t) {
+        workers.emplace_back(worker, static_cast<unsigned>(t + 1));
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    done.store(true);
+    purger.join();
+
+    EXPECT_EQ(errors.load(), 0);
+    map.purge();
+    EXPECT_EQ(map.size(), 0u);
+}
+
+// Runs each task at once, on the calling thread.
+struct inline_executor {
+    template <class F>
+    void operator()(F&& task) const {
+        task();
+    }
+};
+
+// Runs each task on a thread of its own; the threads are joined when the
+// executor is destroyed.
+struct thread_executor {
+    template <class F>
+    void operator()(F&& task) {
+        threads.emplace_back(std::forward<F>(task));
+    }
+
+    std::vector<std::jthread> threads;
+};
+
+// Checks that `snapshot` holds each key of `expected` once, with its serial
+// as the value, and nothing else.
+template <class Snapshot>
+void expect_snapshot_of(const Snapshot& snapshot, const std::vector<std::shared_ptr<object>>& expected) {
+    std::set<const object*> seen;
+    for (const auto& [key, value] : snapshot) {
+        ASSERT_NE(key, nullptr);
+        EXPECT_EQ(value, key->serial);
+        EXPECT_TRUE(seen.insert(key.get()).second) << "key " << key->serial << " appears twice";
+    }
+    EXPECT_EQ(seen.size(), expected.size());
+    for (const auto& key : expected) {
+        EXPECT_EQ(seen.count(key.get()), 1u) << "key " << key->serial << " is missing";
+    }
+}
+
+TYPED_TEST(ConcurrentWeakHashMap, SnapshotHoldsTheLiveKeys) {
+    typename TestFixture::map_type map(8);
+    std::vector<std::shared_ptr<object>> objects;
+    for (std::uint64_t i = 0; i != 1000; ++i) {
+        objects.push_back(std::make_shared<object>(i));
+        map.try_emplace(objects.back(), i);
+    }
+    std::vector<std::shared_ptr<object>> live;
+    for (std::size_t i = 0; i != objects.size(); ++i) {
+        if (i % 3 != 0) {
+            live.push_back(objects[i]);
+        }
+    }
+    objects.clear();
+    EXPECT_EQ(map.size(), 1000u);
+
+    expect_snapshot_of(map.snapshot_live(), live);
+    inline_executor inline_ex;
+    expect_snapshot_of(map.snapshot_live(inline_ex), live);
+    {
+        thread_executor threads;
+        expect_snapshot_of(map.snapshot_live(threads), live);
+    }
+    EXPECT_EQ(map.size(), 1000u);
+}
+
+// Writers keep adding keys that die soon after, and erasing them, while
+// snapshots are taken. The keys held throughout appear in every snapshot,
+// and every entry of a snapshot is pinned and carries its own value.
+TYPED_TEST(ConcurrentWeakHashMap, SnapshotsUnderConcurrentWriters) {
+    constexpr int writers = 2;
+    typename TestFixture::map_type map(8);
+    std::vector<std::shared_ptr<object>> stable;
+    for (std::uint64_t i = 0; i != 200; ++i) {
+        stable.push_back(std::make_shared<object>(i));
+        map.try_emplace(stable.back(), i);
+    }
+    std::atomic<std::uint64_t> next_serial{stable.size()};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t != writers; ++t) {
+        threads.emplace_back([&] {
+            std::vector<std::shared_ptr<object>> mine(16);
+            for (std::size_t n = 0; !done.load(); ++n) {
+                auto& key = mine[n % mine.size()];
+                if (key && n % 3 == 0) {
+                    map.erase(key);
+                }
+                key = std::make_shared<object>(next_serial.fetch_add(1));
+                map.insert_or_assign(key, key->serial);
+            }
+        });
+    }
+
+    std::set<const object*> stable_keys;
+    for (const auto& key : stable) {
+        stable_keys.insert(key.get());
+    }
+    for (int round = 0; round != 20; ++round) {
+        thread_executor ex;
+        const auto snapshot = round % 2 ? map.snapshot_live(ex) : map.snapshot_live();
+        std::set<const object*> seen;
+        std::size_t found = 0;
+        for (const auto& [key, value] : snapshot) {
+            ASSERT_NE(key, nullptr);
+            EXPECT_EQ(value, key->serial);
+            EXPECT_TRUE(seen.insert(key.get()).second);
+            found += stable_keys.count(key.get());
+        }
+        EXPECT_EQ(found, stable.size());
+    }
+    done.store(true);
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+// Refuses every other task by throwing, as a saturated pool might;
+// parallel_for then runs the refused task on the calling thread.
+struct refusing_executor {
+    template <class F>
+    void operator()(F&& task) {
+        if (offered++ % 2 == 1) {
+            throw std::runtime_error("queue full");
+        }
+        ++accepted;
+        task();
+    }
+
+    int offered = 0;
+    int accepted = 0;
+};
+
+// A fixed set of worker threads taking tasks from one queue. Each task,
+// and each worker's stop request, is one release of `queued_`.
+class thread_pool {
+public:
+    explicit thread_pool(int threads) {
+        for (int t = 0; t != threads; ++t) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    ~thread_pool() {
+        queued_.release(static_cast<std::ptrdiff_t>(workers_.size()));
+        for (auto& w : workers_) {
+            w.join();
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        queued_.release();
+    }
+
+    // The pool as an executor.
+    auto executor() {
+        return [this](auto task) { submit(std::move(task)); };
+    }
+
+private:
+    void work() {
+        while (true) {
+            queued_.acquire();
+            std::function<void()> task;
+            {
+                std::lock_guard lock(mutex_);
+                if (tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex_;
+    std::deque<std::function<void()>> tasks_;
+    std::counting_semaphore<> queued_{0};
+    std::vector<std::thread> workers_;
+};
+
+// Fills `map` with 100 keys per shard and lets every third key die.
+template <class Map>
+std::vector<std::shared_ptr<object>> fill_and_expire(Map& map) {
+    std::vector<std::shared_ptr<object>> live;
+    for (std::uint64_t i = 0; i != 100 * map.shard_count(); ++i) {
+        auto key = std::make_shared<object>(i);
+        map.try_emplace(key, i);
+        if (i % 3 != 0) {
+            live.push_back(std::move(key));
+        }
+    }
+    return live;
+}
+
+TYPED_TEST(ConcurrentWeakHashMap, RefusedTasksRunOnTheCallingThread) {
+    typename TestFixture::map_type map(16);
+    const auto live = fill_and_expire(map);
+    const std::size_t dead = map.size() - live.size();
+
+    refusing_executor ex;
+    EXPECT_EQ(map.purge(ex), dead);
+    EXPECT_EQ(ex.offered, 16);
+    EXPECT_EQ(ex.accepted, 8);
+    EXPECT_EQ(map.size(), live.size());
+
+    refusing_executor rehash_ex;
+    map.rehash(4 * live.size(), rehash_ex);
+    EXPECT_EQ(rehash_ex.offered, 16);
+    refusing_executor snapshot_ex;
+    expect_snapshot_of(map.snapshot_live(snapshot_ex), live);
+    EXPECT_EQ(snapshot_ex.offered, 16);
+}
+
+TYPED_TEST(ConcurrentWeakHashMap, PurgeAndRehashOnAThreadPool) {
+    thread_pool pool(4);
+    auto ex = pool.executor();
+    typename TestFixture::map_type map(32);
+    const auto live = fill_and_expire(map);
+    const std::size_t dead = map.size() - live.size();
+
+    EXPECT_EQ(map.purge(ex), dead);
+    EXPECT_EQ(map.size(), live.size());
+    for (std::size_t i = 0; i != map.shard_count(); ++i) {
+        EXPECT_EQ(map.try_purge_shard(i), 0u) << "shard " << i << " was not purged";
+    }
+    map.rehash(8 * live.size(), ex);
+    for (const auto& key : live) {
+        EXPECT_EQ(map.find(key), key->serial);
+    }
+    expect_snapshot_of(map.snapshot_live(ex), live);
+}
+
+// A stats-collecting locked map shows that each shard was rebuilt once.
+TEST(Executor, EveryShardIsRehashed) {
+    using map_type = whm::concurrent_weak_hash_map<
+        object, std::uint64_t, whm::pointer_hash<object>, whm::pointer_equal<object>,
+        std::allocator<std::pair<const std::weak_ptr<object>, std::uint64_t>>, whm::no_sweep, whm::locked_reads,
+        whm::default_resize_policy, whm::collect_stats>;
+    thread_pool pool(4);
+    auto ex = pool.executor();
+    map_type map(16);
+    const auto live = fill_and_expire(map);
+    const whm::table_stats before = map.stats();
+
+    map.rehash(1000 * map.shard_count(), ex);
+    const whm::table_stats after = map.stats();
+    EXPECT_EQ(after.rehash_grow - before.rehash_grow, map.shard_count());
+    EXPECT_EQ(after.size, live.size());
+    EXPECT_GE(after.capacity, 1000 * map.shard_count());
+}
+
+// Hashes like pointer_hash, but throws while `armed` is set.
+struct throwing_hash : whm::pointer_hash<object> {
+    static inline std::atomic<bool> armed{false};
+
+    std::size_t operator()(const object* p) const {
+        if (armed.load()) {
+            throw std::runtime_error("hash failed");
+        }
+        return whm::pointer_hash<object>::operator()(p);
+    }
+};
+
+// The rebuild of every shard throws on a pool thread; the caller sees the
+// exception once all tasks are done, and each shard keeps its entries.
+TEST(Executor, ExceptionsFromTasksReachTheCaller) {
+    using map_type =
+        whm::concurrent_weak_hash_map<object, std::uint64_t, throwing_hash, whm::pointer_equal<object>>;
+    thread_pool pool(4);
+    auto ex = pool.executor();
+    map_type map(8);
+    const auto live = fill_and_expire(map);
+    map.purge(ex);
+
+    throwing_hash::armed.store(true);
+    EXPECT_THROW(map.rehash(100 * live.size(), ex), std::runtime_error);
+    throwing_hash::armed.store(false);
+    EXPECT_EQ(map.size(), live.size());
+    for (const auto& key : live) {
+        EXPECT_EQ(map.find(key), key->serial);
+    }
+}
+
+// One shard grows from a single group to well past migrate_min_groups, so
+// its last several growths migrate a few groups per write while readers
+// probe both arrays. Every key the writer has published, and every key
+// inserted beforehand, must be found with its value throughout, and after
+// purge() has finished the last migration and released the old array.
+TEST(LockFreeReads, KeysStayFindableWhileAShardMigrates) {
+    using table = whm::detail::published_table<int, std::allocator<int>>;
+    constexpr std::size_t keys = 16 * table::migrate_min_groups * table::entry_group::width;
+    constexpr int readers = 3;
+
+    map_for<whm::lock_free_reads> map(1);
+    std::vector<std::shared_ptr<object>> early;
+    for (std::uint64_t i = 0; i != 64; ++i) {
+        early.push_back(std::make_shared<object>(i));
+        map.try_emplace(early.back(), i);
+    }
+    std::vector<std::shared_ptr<object>> added;
+    for (std::size_t i = 0; i != keys; ++i) {
+        added.push_back(std::make_shared<object>(early.size() + i));
+    }
+    std::atomic<std::size_t> published{0};
+    std::atomic<int> phase{0};  // 1 once the writer is done, 2 once purged
+    std::atomic<int> errors{0};
+
+    auto check = [&](const std::shared_ptr<object>& key) {
+        if (map.find(key) != key->serial) {
+            errors.fetch_add(1);
+        }
+    };
+    auto reader = [&](unsigned seed) {
+        std::mt19937 rng(seed);
+        for (int seen_phase = 0; seen_phase != 2;) {
+            seen_phase = phase.load();
+            for (const auto& key : early) {
+                check(key);
+            }
+            if (const std::size_t n = published.load()) {
+                for (int i = 0; i != 64; ++i) {
+                    check(added[rng() % n]);
+                }
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t != readers; ++t) {
+        threads.emplace_back(reader, static_cast<unsigned>(t + 1));
+    }
+    for (std::size_t i = 0; i != added.size(); ++i) {
+        map.try_emplace(added[i], added[i]->serial);
+        published.store(i + 1);
+    }
+    phase.store(1);
+    map.purge();
+    phase.store(2);
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(errors.load(), 0);
+    EXPECT_EQ(map.size(), early.size() + added.size());
+    for (const auto& key : added) {
+        EXPECT_EQ(map.find(key), key->serial);
+    }
+}
+
+}  // namespace
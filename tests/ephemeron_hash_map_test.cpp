@@ -0,0 +1,199 @@
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <whm/ephemeron_hash_map.hpp>
+
+namespace {
+
+struct widget {
+    static inline int instances = 0;
+
+    explicit widget(int i) : id(i) { ++instances; }
+    widget(const widget&) = delete;
+    ~widget() { --instances; }
+
+    int id;
+};
+
+// Refers back to its key with a plain pointer, and checks in its destructor
+// that the key is still there.
+struct observer {
+    static inline int instances = 0;
+    static inline int seen_by_destructor = -1;
+
+    explicit observer(const widget* w) : owner(w), name(64, 'x') { ++instances; }
+    observer(const observer&) = delete;
+    ~observer() {
+        seen_by_destructor = owner->id;
+        --instances;
+    }
+
+    const widget* owner;
+    std::string name;
+};
+
+// Takes ownership of its key while it is being constructed.
+struct owner {
+    static inline int instances = 0;
+
+    explicit owner(const std::weak_ptr<widget>& w) : key(w.lock()) { ++instances; }
+    explicit owner(std::shared_ptr<widget> w) : key(std::move(w)) { ++instances; }
+    owner(const owner&) = delete;
+    ~owner() { --instances; }
+
+    std::shared_ptr<widget> key;
+};
+
+using map_type = whm::ephemeron_hash_map<widget, observer>;
+using owner_map = whm::ephemeron_hash_map<widget, owner>;
+
+class EphemeronHashMap : public ::testing::Test {
+protected:
+    void TearDown() override {
+        EXPECT_EQ(widget::instances, 0);
+        EXPECT_EQ(observer::instances, 0);
+        EXPECT_EQ(owner::instances, 0);
+    }
+};
+
+TEST_F(EphemeronHashMap, ValueDiesWithItsKey) {
+    map_type map;
+    auto w = map.make_key(7);
+    auto [value, inserted] = map.try_emplace(w, w.get());
+    EXPECT_TRUE(inserted);
+    EXPECT_EQ(value->owner, w.get());
+    EXPECT_FALSE(map.try_emplace(w, nullptr).second);
+    value.reset();
+    EXPECT_EQ(observer::instances, 1);
+
+    w.reset();
+    EXPECT_EQ(observer::instances, 0);
+    EXPECT_EQ(observer::seen_by_destructor, 7);
+    EXPECT_EQ(map.purge(), 0u);
+    EXPECT_TRUE(map.empty());
+}
+
+TEST_F(EphemeronHashMap, FoundValuePinsTheKey) {
+    map_type map;
+    auto w = map.make_key(1);
+    map.try_emplace(w, w.get());
+    const widget* p = w.get();
+    auto value = map.find(p);
+    w.reset();
+
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(value->owner->id, 1);
+    EXPECT_TRUE(map.contains(p));
+    value.reset();
+    EXPECT_EQ(widget::instances, 0);
+    EXPECT_FALSE(map.contains(p));
+}
+
+TEST_F(EphemeronHashMap, EraseLeavesTheValueWithItsKey) {
+    map_type map;
+    auto w = map.make_key(2);
+    auto value = map.find(w);
+    EXPECT_EQ(value, nullptr);
+    value = map.try_emplace(w, w.get()).first;
+
+    EXPECT_EQ(map.erase(w), 1u);
+    EXPECT_FALSE(map.contains(w));
+    EXPECT_EQ(value->name, std::string(64, 'x'));
+    EXPECT_EQ(observer::instances, 1);
+
+    auto [again, inserted] = map.try_emplace(w, nullptr);
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(again, value);
+    EXPECT_EQ(again->owner, w.get());
+    EXPECT_EQ(map.find(w), value);
+}
+
+TEST_F(EphemeronHashMap, ClearAndDestructionLeaveValuesWithTheirKeys) {
+    std::shared_ptr<observer> cleared;
+    std::shared_ptr<observer> destroyed;
+    std::shared_ptr<widget> key;
+    {
+        map_type map;
+        auto a = map.make_key(3);
+        key = map.make_key(4);
+        cleared = map.try_emplace(a, a.get()).first;
+        map.try_emplace(key, key.get());
+
+        map.clear();
+        EXPECT_TRUE(map.empty());
+        EXPECT_EQ(cleared->owner->id, 3);
+
+        map.try_emplace(key, key.get());
+        destroyed = map.find(key);
+    }
+    EXPECT_EQ(cleared->name, std::string(64, 'x'));
+    EXPECT_EQ(destroyed->owner->id, 4);
+    EXPECT_EQ(observer::instances, 2);
+
+    cleared.reset();
+    EXPECT_EQ(observer::instances, 1);
+    destroyed.reset();
+    key.reset();
+}
+
+TEST_F(EphemeronHashMap, MovedMapKeepsItsKeys) {
+    map_type map;
+    auto w = map.make_key(5);
+    map.try_emplace(w, w.get());
+
+    map_type moved(std::move(map));
+    EXPECT_TRUE(moved.contains(w));
+    EXPECT_FALSE(moved.try_emplace(w, nullptr).second);
+    w.reset();
+    EXPECT_EQ(moved.purge(), 0u);
+    EXPECT_TRUE(moved.empty());
+}
+
+TEST_F(EphemeronHashMap, RejectsKeysItDidNotMake) {
+    map_type map;
+    map_type other;
+    auto foreign = other.make_key(6);
+    auto plain = std::make_shared<widget>(7);
+    EXPECT_THROW(map.try_emplace(foreign, foreign.get()), std::invalid_argument);
+    EXPECT_THROW(map.try_emplace(plain, plain.get()), std::invalid_argument);
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(observer::instances, 0);
+}
+
+// A value that owns its key would keep both alive forever, so the map
+// refuses it, and the key dies once the caller lets go of it.
+TEST_F(EphemeronHashMap, RejectsValuesThatOwnTheirKey) {
+    owner_map map;
+    auto w = map.make_key(8);
+    EXPECT_THROW(map.try_emplace(w, w), std::invalid_argument);
+    EXPECT_THROW(map.try_emplace(w, std::shared_ptr<widget>(w)), std::invalid_argument);
+    EXPECT_THROW(map.try_emplace(w, std::weak_ptr<widget>(w)), std::invalid_argument);
+    EXPECT_EQ(owner::instances, 0);
+    EXPECT_EQ(w.use_count(), 1);
+    EXPECT_TRUE(map.empty());
+
+    w.reset();
+    EXPECT_EQ(widget::instances, 0);
+}
+
+// Owning some other key is fine: only a cycle through the value's own key
+// is refused.
+TEST_F(EphemeronHashMap, ValuesMayOwnOtherKeys) {
+    owner_map map;
+    auto a = map.make_key(9);
+    auto b = map.make_key(10);
+    EXPECT_TRUE(map.try_emplace(a, b).second);
+    b.reset();
+    EXPECT_EQ(widget::instances, 2);
+
+    a.reset();
+    EXPECT_EQ(owner::instances, 0);
+    EXPECT_EQ(widget::instances, 0);
+    EXPECT_EQ(map.purge(), 0u);
+    EXPECT_TRUE(map.empty());
+}
+
+}  // namespace
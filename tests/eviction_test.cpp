@@ -0,0 +1,172 @@
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/policy.hpp>
+#include <whm/weak_hash_map.hpp>
+
+namespace {
+
+struct object {
+    int id = 0;
+};
+
+template <class V>
+using bounded_map = whm::weak_hash_map<object, V, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                       std::allocator<std::pair<const std::weak_ptr<object>, V>>, whm::no_sweep,
+                                       whm::default_resize_policy, whm::no_stats, whm::slot_layout<>,
+                                       whm::clock_eviction>;
+
+constexpr std::size_t budget = 16 * 1024;
+
+template <class Map>
+std::size_t footprint(const Map& map) {
+    const whm::memory_footprint m = map.memory_usage();
+    return m.table + m.auxiliary;
+}
+
+TEST(Eviction, TableStaysWithinItsBudget) {
+    bounded_map<int> map;
+    map.set_memory_budget(budget);
+    EXPECT_EQ(map.memory_budget(), budget);
+
+    std::vector<std::shared_ptr<object>> keys;
+    for (int i = 0; i != 5000; ++i) {
+        keys.push_back(std::make_shared<object>(object{i}));
+        map.try_emplace(keys.back(), i);
+        ASSERT_LE(footprint(map), budget);
+    }
+    EXPECT_LT(map.size(), keys.size());
+    EXPECT_GT(map.size(), 0u);
+    for (const auto& k : keys) {
+        if (map.contains(k)) {
+            EXPECT_EQ(map.at(k), k->id);
+        }
+    }
+}
+
+// Inserts fresh keys, held in `keys`, until an insertion evicts entries.
+template <class Map>
+void insert_until_eviction(Map& map, std::vector<std::shared_ptr<object>>& keys) {
+    for (std::size_t size = map.size();; size = map.size()) {
+        keys.push_back(std::make_shared<object>(object{static_cast<int>(keys.size())}));
+        map.try_emplace(keys.back(), keys.back()->id);
+        if (map.size() <= size) {
+            return;
+        }
+    }
+}
+
+// The first eviction clears every reference bit on its way round. Entries
+// used after that are passed over by the next one, which evicts unused
+// entries instead.
+TEST(Eviction, RecentlyUsedKeysSurvive) {
+    bounded_map<int> map;
+    map.set_memory_budget(budget);
+    std::vector<std::shared_ptr<object>> keys;
+    insert_until_eviction(map, keys);
+
+    std::vector<std::shared_ptr<object>> hot;
+    for (const auto& k : keys) {
+        if (hot.size() != 32 && map.contains(k)) {
+            hot.push_back(k);
+        }
+    }
+    for (const auto& k : hot) {
+        ASSERT_NE(map.find(k), map.end());
+    }
+    const std::size_t before = keys.size();
+    insert_until_eviction(map, keys);
+    ASSERT_GT(keys.size(), before);
+
+    for (const auto& k : hot) {
+        EXPECT_TRUE(map.contains(k));
+    }
+    std::size_t evicted = 0;
+    for (const auto& k : keys) {
+        evicted += map.contains(k) ? 0 : 1;
+    }
+    EXPECT_GT(evicted, 0u);
+}
+
+TEST(Eviction, LoweringTheBudgetEvictsAtOnce) {
+    bounded_map<int> map;
+    std::vector<std::shared_ptr<object>> keys;
+    for (int i = 0; i != 2000; ++i) {
+        keys.push_back(std::make_shared<object>(object{i}));
+        map.try_emplace(keys.back(), i);
+    }
+    EXPECT_EQ(map.size(), 2000u);
+
+    map.set_memory_budget(budget);
+    EXPECT_LE(footprint(map), budget);
+    EXPECT_LT(map.size(), 2000u);
+}
+
+TEST(Eviction, ExpiredEntriesAreDroppedBeforeLiveOnes) {
+    bounded_map<int> map;
+    map.set_memory_budget(budget);
+    std::vector<std::shared_ptr<object>> keys;
+    insert_until_eviction(map, keys);
+    const std::size_t capacity = map.capacity();
+
+    std::vector<std::shared_ptr<object>> survivors;
+    for (const auto& k : keys) {
+        if (survivors.size() != 8 && map.contains(k)) {
+            survivors.push_back(k);
+        }
+    }
+    keys.clear();
+    for (std::size_t i = 0; i != capacity / 2; ++i) {
+        keys.push_back(std::make_shared<object>());
+        map.try_emplace(keys.back(), 0);
+    }
+    for (const auto& k : survivors) {
+        EXPECT_TRUE(map.contains(k));
+    }
+    for (const auto& k : keys) {
+        EXPECT_TRUE(map.contains(k));
+    }
+    EXPECT_EQ(map.capacity(), capacity);
+}
+
+// When any entry is evicted, its value's destructor drops every key held
+// in `keys`, so the live entries that eviction counted on die under it.
+struct doom {
+    static inline std::vector<std::shared_ptr<object>> keys;
+    static inline int triggered = 0;
+
+    doom() = default;
+    doom(doom&& other) noexcept : armed(std::exchange(other.armed, false)) {}
+    doom& operator=(doom&&) = delete;
+
+    ~doom() {
+        if (armed && !keys.empty()) {
+            ++triggered;
+            std::vector<std::shared_ptr<object>> dying = std::move(keys);
+            keys.clear();
+        }
+    }
+
+    bool armed = true;
+};
+
+TEST(Eviction, KeysDyingDuringEvictionDoNotStallIt) {
+    bounded_map<doom> map;
+    map.set_memory_budget(budget);
+    std::shared_ptr<object> last;
+    for (int i = 0; i != 5000 && doom::triggered == 0; ++i) {
+        last = std::make_shared<object>(object{i});
+        doom::keys.push_back(last);
+        map.try_emplace(last);
+    }
+    ASSERT_EQ(doom::triggered, 1);
+    EXPECT_TRUE(map.contains(last));
+    EXPECT_EQ(map.counts().expired, 0u);
+    EXPECT_LE(footprint(map), budget);
+}
+
+}  // namespace
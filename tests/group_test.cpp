@@ -0,0 +1,138 @@
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/detail/group.hpp>
+
+// Every group compiled for this target, checked against a byte-by-byte
+// model of what match(), match_empty() and match_empty_or_deleted() report.
+
+namespace {
+
+using whm::detail::ctrl_t;
+using whm::detail::h2_t;
+
+// The positions in a group's mask, as bits of one integer.
+template <class Mask>
+std::uint64_t positions(Mask mask) {
+    std::uint64_t bits = 0;
+    for (unsigned i : mask) {
+        bits |= std::uint64_t{1} << i;
+    }
+    return bits;
+}
+
+template <class Pred>
+std::uint64_t expected(const std::vector<ctrl_t>& ctrl, Pred&& pred) {
+    std::uint64_t bits = 0;
+    for (std::size_t i = 0; i != ctrl.size(); ++i) {
+        if (pred(ctrl[i])) {
+            bits |= std::uint64_t{1} << i;
+        }
+    }
+    return bits;
+}
+
+// Control bytes for one group, often repeating a few fingerprints so that
+// groups hold several matches.
+std::vector<ctrl_t> random_ctrl(std::mt19937& rng, std::size_t width) {
+    std::vector<ctrl_t> ctrl(width);
+    for (ctrl_t& c : ctrl) {
+        switch (rng() % 8) {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+            c = static_cast<ctrl_t>(rng() % 4);
+            break;
+        case 4:
+            c = static_cast<ctrl_t>(rng() % 128);
+            break;
+        case 5:
+            c = whm::detail::ctrl_empty;
+            break;
+        case 6:
+            c = whm::detail::ctrl_deleted;
+            break;
+        default:
+            c = whm::detail::ctrl_sentinel;
+            break;
+        }
+    }
+    return ctrl;
+}
+
+template <class Group>
+class GroupMatch : public ::testing::Test {
+protected:
+    void SetUp() override {
+#if defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__))
+        if (!__builtin_cpu_supports("avx2")) {
+            GTEST_SKIP() << "built for AVX2, which this CPU lacks";
+        }
+#endif
+    }
+};
+
+using group_types = ::testing::Types<whm::detail::group_portable
+#if defined(WHM_GROUP_SSE2) || defined(WHM_GROUP_AVX2)
+                                     ,
+                                     whm::detail::group_sse2
+#endif
+#if defined(WHM_GROUP_AVX2)
+                                     ,
+                                     whm::detail::group_avx2
+#endif
+                                     >;
+TYPED_TEST_SUITE(GroupMatch, group_types);
+
+TYPED_TEST(GroupMatch, AgreesWithTheScalarModel) {
+    using group = TypeParam;
+    constexpr std::size_t width = group::width;
+    std::mt19937 rng(width);
+    for (int trial = 0; trial != 20000; ++trial) {
+        const std::vector<ctrl_t> ctrl = random_ctrl(rng, width);
+        const group g(ctrl.data());
+
+        for (h2_t h : {h2_t{0}, h2_t{1}, h2_t{3}, static_cast<h2_t>(rng() % 128)}) {
+            const std::uint64_t exact = expected(ctrl, [h](ctrl_t c) { return c == static_cast<ctrl_t>(h); });
+            const std::uint64_t got = positions(g.match(h));
+            if constexpr (std::is_same_v<group, whm::detail::group_portable>) {
+                // False positives are allowed, but only where a key
+                // comparison will reject them: on other full slots.
+                const std::uint64_t full = expected(ctrl, whm::detail::is_full);
+                EXPECT_EQ(got & exact, exact);
+                EXPECT_EQ(got & ~exact & ~full, 0u);
+            } else {
+                EXPECT_EQ(got, exact);
+            }
+        }
+
+        const std::uint64_t empty = expected(ctrl, whm::detail::is_empty);
+        EXPECT_EQ(positions(g.match_empty()), empty);
+        EXPECT_EQ(positions(g.match_empty_or_deleted()), expected(ctrl, whm::detail::is_empty_or_deleted));
+        EXPECT_EQ(static_cast<bool>(g.match_empty()), empty != 0);
+        if (empty != 0) {
+            const auto mask = g.match_empty();
+            EXPECT_EQ(mask.lowest_bit_set(), static_cast<unsigned>(std::countr_zero(empty)));
+            EXPECT_EQ(mask.trailing_zeros(), static_cast<unsigned>(std::countr_zero(empty)));
+            EXPECT_EQ(mask.leading_zeros(), width - 1 - static_cast<unsigned>(63 - std::countl_zero(empty)));
+        }
+    }
+}
+
+// The control bytes of a table with no allocation end every probe at once.
+TYPED_TEST(GroupMatch, EmptyGroupHasNoMatches) {
+    const TypeParam g(whm::detail::empty_group);
+    for (unsigned h = 0; h != 128; ++h) {
+        EXPECT_FALSE(g.match(static_cast<h2_t>(h)));
+    }
+    EXPECT_TRUE(g.match_empty());
+}
+
+}  // namespace
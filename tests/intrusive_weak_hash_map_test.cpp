@@ -0,0 +1,138 @@
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/intrusive_weak_hash_map.hpp>
+
+namespace {
+
+struct node : whm::weak_hash_map_trackable {
+    explicit node(int i = 0) : id(i) {}
+    int id;
+};
+
+using map_type = whm::intrusive_weak_hash_map<node, std::string>;
+
+std::vector<std::unique_ptr<node>> make_nodes(int n) {
+    std::vector<std::unique_ptr<node>> nodes;
+    for (int i = 0; i != n; ++i) {
+        nodes.push_back(std::make_unique<node>(i));
+    }
+    return nodes;
+}
+
+TEST(IntrusiveWeakHashMap, DestroyingAKeyErasesItsEntry) {
+    map_type map;
+    auto nodes = make_nodes(100);
+    for (const auto& n : nodes) {
+        EXPECT_TRUE(map.try_emplace(n.get(), std::to_string(n->id)).second);
+    }
+    EXPECT_FALSE(map.try_emplace(nodes[0].get(), "again").second);
+
+    for (std::size_t i = 0; i < nodes.size(); i += 2) {
+        nodes[i].reset();
+    }
+    EXPECT_EQ(map.size(), 50u);
+    for (std::size_t i = 1; i < nodes.size(); i += 2) {
+        EXPECT_EQ(map.at(nodes[i].get()), std::to_string(nodes[i]->id));
+    }
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        EXPECT_EQ(it->first->id % 2, 1);
+    }
+}
+
+TEST(IntrusiveWeakHashMap, ErasedEntriesAreUnlinked) {
+    map_type map;
+    auto a = std::make_unique<node>(1);
+    auto b = std::make_unique<node>(2);
+    map.try_emplace(a.get(), "a");
+    map.try_emplace(b.get(), "b");
+
+    EXPECT_EQ(map.erase(a.get()), 1u);
+    EXPECT_EQ(map.erase(a.get()), 0u);
+    a.reset();
+    EXPECT_EQ(map.size(), 1u);
+
+    map.erase(map.find(b.get()));
+    b.reset();
+    EXPECT_TRUE(map.empty());
+}
+
+TEST(IntrusiveWeakHashMap, RehashKeepsTheLinks) {
+    map_type map;
+    auto nodes = make_nodes(1000);
+    for (const auto& n : nodes) {
+        map.try_emplace(n.get(), std::to_string(n->id));
+    }
+    map.rehash(map.capacity() * 4);
+    nodes.erase(nodes.begin() + 500, nodes.end());
+    EXPECT_EQ(map.size(), 500u);
+
+    map.shrink_to_fit();
+    nodes.erase(nodes.begin() + 10, nodes.end());
+    EXPECT_EQ(map.size(), 10u);
+    for (const auto& n : nodes) {
+        EXPECT_EQ(map.at(n.get()), std::to_string(n->id));
+    }
+}
+
+TEST(IntrusiveWeakHashMap, KeyInSeveralMaps) {
+    std::optional<map_type> first(std::in_place);
+    map_type second;
+    auto a = std::make_unique<node>(1);
+    auto b = std::make_unique<node>(2);
+    first->try_emplace(a.get(), "first");
+    first->try_emplace(b.get(), "first");
+    second.try_emplace(a.get(), "second");
+
+    first.reset();
+    EXPECT_EQ(second.at(a.get()), "second");
+    b.reset();
+
+    map_type third;
+    third.try_emplace(a.get(), "third");
+    a.reset();
+    EXPECT_TRUE(second.empty());
+    EXPECT_TRUE(third.empty());
+}
+
+TEST(IntrusiveWeakHashMap, MovedAndSwappedMapsKeepTheirEntries) {
+    auto nodes = make_nodes(4);
+    map_type a;
+    map_type b;
+    a.try_emplace(nodes[0].get(), "0");
+    a.try_emplace(nodes[1].get(), "1");
+    b.try_emplace(nodes[2].get(), "2");
+
+    map_type moved(std::move(a));
+    swap(moved, b);
+    nodes[0].reset();
+    nodes[2].reset();
+    EXPECT_EQ(b.size(), 1u);
+    EXPECT_EQ(b.at(nodes[1].get()), "1");
+    EXPECT_TRUE(moved.empty());
+
+    map_type copy(b);
+    copy.try_emplace(nodes[3].get(), "3");
+    nodes[1].reset();
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(copy.size(), 1u);
+}
+
+TEST(IntrusiveWeakHashMap, CopiedKeyStartsInNoMap) {
+    map_type map;
+    node a(1);
+    map.try_emplace(&a, "a");
+    {
+        node copy(a);
+        EXPECT_FALSE(map.contains(&copy));
+    }
+    EXPECT_EQ(map.size(), 1u);
+    map.clear();
+}
+
+}  // namespace
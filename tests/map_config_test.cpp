@@ -0,0 +1,125 @@
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/map_config.hpp>
+
+namespace {
+
+struct object {
+    int id = 0;
+};
+
+using frame_table = whm::configured_map<object, int, whm::frame_table_config>;
+using registry = whm::configured_map<object, std::string, whm::registry_config>;
+using cache = whm::configured_map<std::string, object, whm::cache_config>;
+using bounded_cache = whm::configured_map<int, object, whm::bounded_cache_config>;
+
+// Each bundle resolves to the container and policies it documents.
+static_assert(std::is_same_v<frame_table, whm::weak_hash_map<object, int>>);
+static_assert(std::is_same_v<whm::configured_map<object, int>, frame_table>);
+static_assert(std::is_same_v<
+              registry, whm::concurrent_weak_hash_map<object, std::string, whm::pointer_hash<object>,
+                                                      whm::pointer_equal<object>,
+                                                      std::allocator<std::pair<const std::weak_ptr<object>, std::string>>,
+                                                      whm::incremental_sweep<8>, whm::locked_reads,
+                                                      whm::default_resize_policy, whm::no_stats, whm::slot_layout<>>>);
+static_assert(std::is_same_v<cache, whm::weak_value_hash_map<std::string, object, std::hash<std::string>,
+                                                             std::equal_to<std::string>,
+                                                             std::allocator<std::pair<const std::string,
+                                                                                      std::weak_ptr<object>>>,
+                                                             whm::incremental_sweep<8>>>);
+static_assert(std::is_same_v<bounded_cache::sweep_policy, whm::incremental_sweep<8>>);
+static_assert(std::is_same_v<bounded_cache::eviction_policy, whm::clock_eviction>);
+static_assert(std::is_same_v<bounded_cache::stats_policy, whm::no_stats>);
+static_assert(std::is_same_v<bounded_cache::resize_policy, whm::default_resize_policy>);
+static_assert(std::is_same_v<cache::eviction_policy, whm::no_eviction>);
+
+// Single-threaded defaults take no room for the policies they leave out.
+static_assert(sizeof(frame_table) == sizeof(whm::weak_hash_map<object, int>));
+
+// Lock-free shards keep their own entries, and take only the sweep policy.
+static_assert(std::is_same_v<
+              whm::configured_map<object, int, whm::map_config<whm::weak_keys, whm::sharded<whm::lock_free_reads>>>,
+              whm::concurrent_weak_hash_map<object, int, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                            std::allocator<std::pair<const std::weak_ptr<object>, int>>,
+                                            whm::no_sweep, whm::lock_free_reads>>);
+
+std::vector<std::shared_ptr<object>> make_objects(std::size_t n) {
+    std::vector<std::shared_ptr<object>> objects;
+    for (std::size_t i = 0; i != n; ++i) {
+        objects.push_back(std::make_shared<object>(object{static_cast<int>(i)}));
+    }
+    return objects;
+}
+
+TEST(MapConfig, FrameTable) {
+    frame_table table;
+    auto objects = make_objects(100);
+    for (const auto& o : objects) {
+        table.try_emplace(o, o->id);
+    }
+    objects.resize(40);
+    EXPECT_EQ(table.size(), 100u);
+    EXPECT_EQ(table.purge(), 60u);
+    for (const auto& o : objects) {
+        EXPECT_EQ(table.at(o), o->id);
+    }
+}
+
+TEST(MapConfig, Registry) {
+    registry map(8);
+    auto objects = make_objects(1000);
+    for (const auto& o : objects) {
+        map.try_emplace(o, std::to_string(o->id));
+    }
+    objects.resize(100);
+    for (int round = 0; round != 200; ++round) {
+        for (const auto& o : objects) {
+            EXPECT_EQ(map.find(o), std::to_string(o->id));
+        }
+        map.try_emplace(objects[static_cast<std::size_t>(round) % objects.size()], "again");
+    }
+    EXPECT_LT(map.size(), 1000u);
+    map.purge();
+    EXPECT_EQ(map.size(), objects.size());
+}
+
+TEST(MapConfig, Cache) {
+    cache textures;
+    auto a = std::make_shared<object>(object{1});
+    EXPECT_EQ(textures.try_emplace("a.png", a).first, a);
+    auto other = std::make_shared<object>(object{2});
+    EXPECT_EQ(textures.try_emplace("a.png", other).first, a);
+    EXPECT_EQ(textures.find("a.png"), a);
+    a.reset();
+    EXPECT_EQ(textures.find("a.png"), nullptr);
+    EXPECT_TRUE(textures.empty());
+}
+
+TEST(MapConfig, BoundedCache) {
+    bounded_cache meshes;
+    constexpr std::size_t budget = 8 * 1024;
+    meshes.set_memory_budget(budget);
+    auto objects = make_objects(2000);
+    for (const auto& o : objects) {
+        meshes.try_emplace(o->id, o);
+        const whm::memory_footprint m = meshes.memory_usage();
+        ASSERT_LE(m.table + m.auxiliary, budget);
+    }
+    EXPECT_LT(meshes.size(), objects.size());
+    EXPECT_GT(meshes.size(), 0u);
+    for (const auto& o : objects) {
+        if (auto found = meshes.find(o->id)) {
+            EXPECT_EQ(found, o);
+        }
+    }
+}
+
+}  // namespace
@@ -0,0 +1,181 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/detail/group.hpp>
+#include <whm/policy.hpp>
+#include <whm/stats.hpp>
+#include <whm/weak_hash_map.hpp>
+#include <whm/weak_value_hash_map.hpp>
+
+namespace {
+
+struct object {
+    int id = 0;
+};
+
+template <class Hash = whm::pointer_hash<object>, class Sweep = whm::no_sweep, class Stats = whm::collect_stats>
+using map_for = whm::weak_hash_map<object, int, Hash, whm::pointer_equal<object>,
+                                   std::allocator<std::pair<const std::weak_ptr<object>, int>>, Sweep,
+                                   whm::default_resize_policy, Stats>;
+
+template <class Sweep = whm::no_sweep>
+using cache_for = whm::weak_value_hash_map<int, object, std::hash<int>, std::equal_to<int>,
+                                           std::allocator<std::pair<const int, std::weak_ptr<object>>>, Sweep,
+                                           whm::default_resize_policy, whm::collect_stats>;
+
+// no_stats takes no room in the map, and collect_stats only its counters.
+static_assert(std::is_empty_v<whm::no_stats>);
+static_assert(sizeof(map_for<whm::pointer_hash<object>, whm::no_sweep, whm::no_stats>) ==
+              sizeof(whm::weak_hash_map<object, int>));
+static_assert(sizeof(map_for<>) == sizeof(whm::weak_hash_map<object, int>) + sizeof(whm::collect_stats));
+
+// Every key lands in the same group and takes the next free slot along the
+// probe sequence, so the n-th key inserted is found in group n / width.
+struct same_hash {
+    std::size_t operator()(const object*) const noexcept { return 0; }
+};
+
+std::vector<std::shared_ptr<object>> make_objects(std::size_t n) {
+    std::vector<std::shared_ptr<object>> objects;
+    for (std::size_t i = 0; i != n; ++i) {
+        objects.push_back(std::make_shared<object>(object{static_cast<int>(i)}));
+    }
+    return objects;
+}
+
+TEST(Stats, ProbeLengthHistogram) {
+    constexpr std::size_t width = whm::detail::group::width;
+    constexpr std::size_t buckets = whm::table_stats::probe_buckets;
+    map_for<same_hash> map;
+    map.reserve(1024);
+    auto objects = make_objects(10 * width);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+
+    const whm::table_stats before = map.stats();
+    for (const auto& o : objects) {
+        EXPECT_TRUE(map.contains(o.get()));
+    }
+    const whm::table_stats after = map.stats();
+    for (std::size_t i = 0; i != buckets - 1; ++i) {
+        EXPECT_EQ(after.probe_length[i] - before.probe_length[i], width) << "bucket " << i;
+    }
+    EXPECT_EQ(after.probe_length[buckets - 1] - before.probe_length[buckets - 1], objects.size() - 7 * width);
+    EXPECT_EQ(after.hits - before.hits, objects.size());
+}
+
+TEST(Stats, CountersAfterAKnownSequence) {
+    map_for<> map;
+    auto objects = make_objects(100);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+    const whm::table_stats filled = map.stats();
+    EXPECT_GT(filled.rehash_grow, 0u);
+    EXPECT_EQ(filled.rehash_in_place + filled.rehash_shrink, 0u);
+    EXPECT_EQ(filled.size, 100u);
+    EXPECT_EQ(filled.capacity, map.capacity());
+
+    std::vector<const object*> dead;
+    for (std::size_t i = 0; i != 30; ++i) {
+        dead.push_back(objects[i].get());
+        objects[i].reset();
+    }
+    auto stranger = std::make_shared<object>();
+    for (std::size_t i = 30; i != objects.size(); ++i) {
+        EXPECT_EQ(map.at(objects[i].get()), objects[i]->id);
+    }
+    EXPECT_FALSE(map.contains(stranger.get()));
+    for (const object* p : dead) {
+        EXPECT_FALSE(map.contains(p));
+    }
+    EXPECT_EQ(map.purge(), 30u);
+    map.rehash(0);
+
+    const whm::table_stats s = map.stats();
+    EXPECT_EQ(s.hits - filled.hits, 70u);
+    EXPECT_EQ(s.misses - filled.misses, 31u);
+    EXPECT_EQ(s.expired_hits - filled.expired_hits, 30u);
+    EXPECT_EQ(s.locks, 0u);
+    EXPECT_EQ(s.sweeps, 1u);
+    EXPECT_EQ(s.swept, 30u);
+    EXPECT_GE(s.max_sweep_time, std::chrono::nanoseconds(0));
+    EXPECT_GE(s.sweep_time, s.max_sweep_time);
+    EXPECT_EQ(s.rehash_grow, filled.rehash_grow);
+    EXPECT_EQ(s.rehash_in_place, 1u);
+    EXPECT_EQ(s.size, 70u);
+    EXPECT_EQ(s.tombstones, 0u);
+}
+
+// Each step of a sweep policy counts as one sweep.
+TEST(Stats, SweepStepsAreRecorded) {
+    map_for<whm::pointer_hash<object>, whm::incremental_sweep<8>> map;
+    auto objects = make_objects(100);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+    objects.clear();
+    // The cursor may start part way through a step's worth of slots.
+    const std::size_t steps = map.capacity() / 8 + 1;
+    const whm::table_stats before = map.stats();
+    for (std::size_t i = 0; i != steps; ++i) {
+        map.find(static_cast<const object*>(nullptr));
+    }
+    const whm::table_stats after = map.stats();
+    EXPECT_EQ(after.sweeps - before.sweeps, steps);
+    EXPECT_EQ(after.swept - before.swept, 100u);
+    EXPECT_EQ(after.size, 0u);
+}
+
+// weak_value_hash_map times its purges and sweep steps the same way.
+TEST(Stats, WeakValueHashMapRecordsSweeps) {
+    auto objects = make_objects(50);
+    cache_for<> cache;
+    cache_for<whm::incremental_sweep<8>> swept;
+    for (const auto& o : objects) {
+        cache.try_emplace(o->id, o);
+        swept.try_emplace(o->id, o);
+    }
+    const whm::table_stats before = swept.stats();
+    EXPECT_EQ(before.sweeps, 50u);
+    EXPECT_EQ(before.swept, 0u);
+    objects.resize(20);
+
+    EXPECT_EQ(cache.purge(), 30u);
+    EXPECT_EQ(cache.stats().sweeps, 1u);
+    EXPECT_EQ(cache.stats().swept, 30u);
+    EXPECT_EQ(cache.find(0), objects[0]);
+    EXPECT_EQ(cache.stats().hits, 1u);
+
+    const std::size_t steps = swept.capacity() / 8 + 1;
+    for (std::size_t i = 0; i != steps; ++i) {
+        swept.find(-1);
+    }
+    const whm::table_stats after = swept.stats();
+    EXPECT_EQ(after.sweeps - before.sweeps, steps);
+    EXPECT_EQ(after.swept, 30u);
+}
+
+TEST(Stats, CopiesStartFromZero) {
+    map_for<> map;
+    auto objects = make_objects(10);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+        map.contains(o.get());
+    }
+    map_for<> copy(map);
+    EXPECT_EQ(map.stats().hits, 10u);
+    EXPECT_EQ(copy.stats().hits, 0u);
+    EXPECT_EQ(copy.stats().size, 10u);
+}
+
+}  // namespace
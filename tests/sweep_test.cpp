@@ -0,0 +1,173 @@
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/policy.hpp>
+#include <whm/weak_hash_map.hpp>
+#include <whm/weak_value_hash_map.hpp>
+
+namespace {
+
+struct object {
+    int id = 0;
+};
+
+using incremental_map = whm::weak_hash_map<object, int, whm::pointer_hash<object>, whm::pointer_equal<object>,
+                                           std::allocator<std::pair<const std::weak_ptr<object>, int>>,
+                                           whm::incremental_sweep<8>>;
+
+TEST(IncrementalSweep, EachOperationReclaimsABoundedNumberOfSlots) {
+    incremental_map map;
+    std::vector<std::shared_ptr<object>> objects;
+    for (int i = 0; i != 100; ++i) {
+        objects.push_back(std::make_shared<object>(object{i}));
+        map.try_emplace(objects.back(), i);
+    }
+    const std::size_t capacity = map.capacity();
+    objects.clear();
+    EXPECT_EQ(map.size(), 100u);
+
+    auto probe = std::make_shared<object>();
+    std::size_t before = map.size();
+    std::size_t operations = 0;
+    while (map.size() != 0) {
+        map.find(probe);
+        ++operations;
+        EXPECT_LE(before - map.size(), incremental_map::sweep_policy::budget);
+        before = map.size();
+        ASSERT_LE(operations, capacity / incremental_map::sweep_policy::budget + 1);
+    }
+    EXPECT_EQ(map.capacity(), capacity);
+}
+
+TEST(IncrementalSweep, LeavesLiveEntriesAndTheirIteratorsAlone) {
+    incremental_map map;
+    std::vector<std::shared_ptr<object>> live;
+    std::vector<std::shared_ptr<object>> dying;
+    for (int i = 0; i != 64; ++i) {
+        auto& group = i % 2 ? live : dying;
+        group.push_back(std::make_shared<object>(object{i}));
+        map.try_emplace(group.back(), i);
+    }
+    auto it = map.find(live.front());
+    ASSERT_NE(it, map.end());
+    dying.clear();
+
+    for (int i = 0; i != 64; ++i) {
+        map.find(live[static_cast<std::size_t>(i) % live.size()]);
+    }
+    EXPECT_EQ(map.size(), live.size());
+    EXPECT_EQ(it->second, live.front()->id);
+    for (const auto& o : live) {
+        ASSERT_TRUE(map.contains(o));
+        EXPECT_EQ(map.at(o), o->id);
+    }
+}
+
+struct tracked_object : object {
+    static inline int instances = 0;
+
+    explicit tracked_object(int i) : object{i} { ++instances; }
+    tracked_object(const tracked_object&) = delete;
+    ~tracked_object() { --instances; }
+};
+
+// pointer_hash that throws while `fail` is set.
+struct failing_hash : whm::pointer_hash<object> {
+    static inline bool fail = false;
+
+    std::size_t operator()(const object* p) const {
+        if (fail) {
+            throw std::runtime_error("failing_hash");
+        }
+        return whm::pointer_hash<object>::operator()(p);
+    }
+};
+
+template <class Hash = whm::pointer_hash<object>>
+using tracked_map = whm::weak_hash_map<object, int, Hash, whm::pointer_equal<object>,
+                                       std::allocator<std::pair<const std::weak_ptr<object>, int>>, whm::tracked_sweep>;
+
+TEST(TrackedSweep, DeadKeysAreErasedByTheNextOperation) {
+    tracked_map<> map;
+    std::vector<std::shared_ptr<tracked_object>> objects;
+    for (int i = 0; i != 100; ++i) {
+        objects.push_back(map.make_tracked<tracked_object>(i));
+        map.try_emplace(objects.back(), i);
+    }
+    auto untracked = std::make_shared<object>();
+    map.try_emplace(untracked, -1);
+
+    for (std::size_t i = 0; i < objects.size(); i += 4) {
+        objects[i].reset();
+    }
+    untracked.reset();
+    EXPECT_EQ(map.size(), 101u);
+
+    map.find(static_cast<const object*>(nullptr));
+    EXPECT_EQ(map.size(), 76u);
+    EXPECT_EQ(map.counts().expired, 1u);  // the untracked key expires lazily
+    for (const auto& o : objects) {
+        if (o) {
+            EXPECT_EQ(map.at(o), o->id);
+        }
+    }
+    EXPECT_EQ(map.purge(), 1u);
+}
+
+TEST(TrackedSweep, KeysMayOutliveTheMap) {
+    std::shared_ptr<tracked_object> survivor;
+    {
+        tracked_map<> map;
+        survivor = map.make_tracked<tracked_object>(1);
+        map.try_emplace(survivor, 1);
+    }
+    survivor.reset();
+    EXPECT_EQ(tracked_object::instances, 0);
+}
+
+TEST(TrackedSweep, MakeTrackedDoesNotLeakWhenHashingThrows) {
+    tracked_map<failing_hash> map;
+    failing_hash::fail = true;
+    EXPECT_THROW(map.make_tracked<tracked_object>(1), std::runtime_error);
+    failing_hash::fail = false;
+    EXPECT_EQ(tracked_object::instances, 0);
+
+    auto key = map.make_tracked<tracked_object>(2);
+    map.try_emplace(key, 2);
+    key.reset();
+    map.find(static_cast<const object*>(nullptr));
+    EXPECT_TRUE(map.empty());
+}
+
+TEST(TrackedSweep, WeakValuesAreErasedWhenTheyDie) {
+    whm::weak_value_hash_map<int, tracked_object, std::hash<int>, std::equal_to<int>,
+                             std::allocator<std::pair<const int, std::weak_ptr<tracked_object>>>, whm::tracked_sweep>
+        cache;
+    auto a = cache.make_tracked<tracked_object>(1, 1);
+    auto b = cache.make_tracked<tracked_object>(2, 2);
+    cache.try_emplace(1, a);
+    cache.try_emplace(2, b);
+    a.reset();
+    EXPECT_FALSE(cache.contains(1));
+    cache.erase(3);
+    EXPECT_EQ(cache.size(), 1u);
+    EXPECT_EQ(cache.find(2), b);
+}
+
+TEST(NoSweep, LeavesExpiredEntriesToPurge) {
+    whm::weak_hash_map<object, int> map;
+    auto a = std::make_shared<object>();
+    map.try_emplace(a, 1);
+    a.reset();
+    for (int i = 0; i != 100; ++i) {
+        map.find(static_cast<const object*>(nullptr));
+    }
+    EXPECT_EQ(map.size(), 1u);
+    EXPECT_EQ(map.purge(), 1u);
+}
+
+}  // namespace
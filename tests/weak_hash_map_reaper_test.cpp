@@ -0,0 +1,156 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/concurrent_weak_hash_map.hpp>
+#include <whm/weak_hash_map_reaper.hpp>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+struct object {
+    int id = 0;
+};
+
+// No sweep policy: only purges remove expired entries.
+using map_type = whm::concurrent_weak_hash_map<object, int>;
+
+std::vector<std::shared_ptr<object>> fill(map_type& map, int n) {
+    std::vector<std::shared_ptr<object>> objects;
+    for (int i = 0; i != n; ++i) {
+        objects.push_back(std::make_shared<object>(object{i}));
+        map.try_emplace(objects.back(), i);
+    }
+    return objects;
+}
+
+// Waits up to ten seconds for `done()`.
+template <class F>
+bool eventually(F&& done) {
+    const auto deadline = std::chrono::steady_clock::now() + 10s;
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+TEST(WeakHashMapReaper, ReclaimsExpiredKeysOfAttachedMaps) {
+    map_type map(8);
+    map_type other(4);
+    auto objects = fill(map, 1000);
+    auto others = fill(other, 100);
+    whm::weak_hash_map_reaper reaper(1ms, 2);
+    auto registration = reaper.attach(map);
+    auto other_registration = reaper.attach(other);
+
+    objects.resize(500);
+    others.clear();
+    // The count is updated after each purge.
+    EXPECT_TRUE(eventually([&] { return reaper.removed() == 600; }));
+    EXPECT_EQ(map.size(), 500u);
+    EXPECT_TRUE(other.empty());
+    for (const auto& o : objects) {
+        EXPECT_EQ(map.find(o), o->id);
+    }
+}
+
+TEST(WeakHashMapReaper, DetachedMapsAreLeftAlone) {
+    map_type map(4);
+    auto objects = fill(map, 100);
+    {
+        whm::weak_hash_map_reaper reaper(1ms);
+        auto registration = reaper.attach(map);
+        registration.reset();
+        objects.clear();
+        std::this_thread::sleep_for(20ms);
+        EXPECT_EQ(reaper.removed(), 0u);
+    }
+    EXPECT_EQ(map.size(), 100u);
+}
+
+// While writers keep adding keys that die at once, maps are attached and
+// detached over and over and destroyed right after detaching. Detaching
+// waits for a purge in progress, so the reaper never touches a dead map.
+TEST(WeakHashMapReaper, DetachingWhileTheReaperRuns) {
+    whm::weak_hash_map_reaper reaper(0ns, 4);
+    for (int round = 0; round != 50; ++round) {
+        auto map = std::make_unique<map_type>(4);
+        auto registration = reaper.attach(*map);
+        std::atomic<bool> stop{false};
+        std::thread writer([&] {
+            for (int i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+                map->try_emplace(std::make_shared<object>(object{i}), i);
+            }
+        });
+        std::this_thread::sleep_for(1ms);
+        stop.store(true, std::memory_order_relaxed);
+        writer.join();
+        registration.reset();
+        map.reset();
+    }
+    EXPECT_GT(reaper.removed(), 0u);
+}
+
+// Registrations that outlive the reaper do nothing when destroyed, and the
+// map carries on without it.
+TEST(WeakHashMapReaper, DestroyingTheReaperBeforeTheMap) {
+    map_type map(4);
+    auto objects = fill(map, 100);
+    whm::weak_hash_map_reaper::registration registration;
+    {
+        whm::weak_hash_map_reaper reaper(1ms);
+        registration = reaper.attach(map);
+        objects.resize(50);
+        EXPECT_TRUE(eventually([&] { return map.size() == 50; }));
+    }
+    objects.clear();
+    std::this_thread::sleep_for(5ms);
+    EXPECT_EQ(map.size(), 50u);
+    registration.reset();
+    registration.reset();
+    EXPECT_EQ(map.purge(), 50u);
+}
+
+// Any type with shard_count() and try_purge_shard() can be attached. Busy
+// shards are counted as skipped, and a purge that throws is retried later.
+struct scripted_target {
+    std::atomic<int> calls{0};
+
+    std::size_t shard_count() const noexcept { return 2; }
+
+    std::optional<std::size_t> try_purge_shard(std::size_t i) {
+        const int call = calls.fetch_add(1);
+        if (call == 0) {
+            throw std::runtime_error("rebuild failed");
+        }
+        if (i == 1) {
+            return std::nullopt;
+        }
+        return 1;
+    }
+};
+
+TEST(WeakHashMapReaper, SkipsBusyShardsAndSurvivesFailedPurges) {
+    scripted_target target;
+    whm::weak_hash_map_reaper reaper(1ms);
+    auto registration = reaper.attach(target);
+    EXPECT_TRUE(eventually([&] { return target.calls.load() >= 10; }));
+    registration.reset();
+    reaper.stop();
+    EXPECT_GT(reaper.removed(), 0u);
+    EXPECT_GT(reaper.skipped(), 0u);
+    EXPECT_EQ(reaper.removed() + reaper.skipped() + 1, static_cast<std::size_t>(target.calls.load()));
+}
+
+}  // namespace
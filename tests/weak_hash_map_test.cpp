@@ -0,0 +1,634 @@
+#include <any>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/policy.hpp>
+#include <whm/stats.hpp>
+#include <whm/weak_hash_map.hpp>
+
+namespace {
+
+struct object {
+    int id = 0;
+};
+
+using map_type = whm::weak_hash_map<object, std::string>;
+
+std::vector<std::shared_ptr<object>> make_objects(std::size_t n) {
+    std::vector<std::shared_ptr<object>> objects;
+    for (std::size_t i = 0; i != n; ++i) {
+        objects.push_back(std::make_shared<object>(object{static_cast<int>(i)}));
+    }
+    return objects;
+}
+
+TEST(WeakHashMap, InsertFindErase) {
+    map_type map;
+    auto a = std::make_shared<object>();
+    auto b = std::make_shared<object>();
+
+    EXPECT_TRUE(map.try_emplace(a, "a").second);
+    EXPECT_FALSE(map.try_emplace(a, "again").second);
+    EXPECT_TRUE(map.insert(b, "b").second);
+    EXPECT_EQ(map.size(), 2u);
+
+    ASSERT_NE(map.find(a), map.end());
+    EXPECT_EQ(map.find(a)->second, "a");
+    EXPECT_EQ(map.at(b.get()), "b");
+    EXPECT_TRUE(map.contains(std::weak_ptr<object>(b)));
+
+    EXPECT_EQ(map.erase(a), 1u);
+    EXPECT_EQ(map.erase(a), 0u);
+    EXPECT_EQ(map.find(a), map.end());
+    EXPECT_EQ(map.size(), 1u);
+    EXPECT_THROW(map.at(a.get()), std::out_of_range);
+}
+
+TEST(WeakHashMap, InsertOrAssignReplacesTheValue) {
+    map_type map;
+    auto a = std::make_shared<object>();
+    EXPECT_TRUE(map.insert_or_assign(a, "one").second);
+    EXPECT_FALSE(map.insert_or_assign(a, "two").second);
+    EXPECT_EQ(map[a], "two");
+}
+
+TEST(WeakHashMap, ExpiredEntriesAreNotFoundAndPurged) {
+    map_type map;
+    auto objects = make_objects(100);
+    for (const auto& o : objects) {
+        map.try_emplace(o, std::to_string(o->id));
+    }
+    std::vector<const object*> dead;
+    for (std::size_t i = 0; i < objects.size(); i += 2) {
+        dead.push_back(objects[i].get());
+        objects[i].reset();
+    }
+
+    EXPECT_EQ(map.size(), 100u);
+    EXPECT_EQ(map.counts().live, 50u);
+    EXPECT_EQ(map.counts().expired, 50u);
+    for (const object* p : dead) {
+        EXPECT_FALSE(map.contains(p));
+    }
+
+    EXPECT_EQ(map.purge(), 50u);
+    EXPECT_EQ(map.size(), 50u);
+    EXPECT_EQ(map.counts().expired, 0u);
+    EXPECT_EQ(map.purge(), 0u);
+    for (const auto& o : objects) {
+        if (o) {
+            ASSERT_NE(map.find(o), map.end());
+            EXPECT_EQ(map.find(o)->second, std::to_string(o->id));
+        }
+    }
+}
+
+TEST(WeakHashMap, GrowthKeepsEveryLiveEntry) {
+    map_type map;
+    auto objects = make_objects(10000);
+    for (const auto& o : objects) {
+        ASSERT_TRUE(map.try_emplace(o, std::to_string(o->id)).second);
+    }
+    EXPECT_EQ(map.size(), objects.size());
+    EXPECT_GE(map.capacity(), objects.size());
+    for (const auto& o : objects) {
+        auto it = map.find(o);
+        ASSERT_NE(it, map.end());
+        EXPECT_EQ(it->second, std::to_string(o->id));
+    }
+}
+
+TEST(WeakHashMap, RebuildsDropExpiredEntries) {
+    map_type map;
+    auto objects = make_objects(1000);
+    for (const auto& o : objects) {
+        map.try_emplace(o, "x");
+    }
+    objects.resize(10);
+    map.rehash(0);
+    EXPECT_EQ(map.size(), 10u);
+    for (const auto& o : objects) {
+        EXPECT_TRUE(map.contains(o));
+    }
+}
+
+// The number of entries a table of `capacity()` holds before inserting one
+// more makes it grow.
+std::size_t fill_limit() {
+    map_type map;
+    std::vector<std::shared_ptr<object>> objects;
+    for (std::size_t capacity = 0;; capacity = map.capacity()) {
+        objects.push_back(std::make_shared<object>());
+        const std::size_t size = map.size();
+        map.try_emplace(objects.back(), "x");
+        if (capacity >= 64 && map.capacity() != capacity) {
+            return size;
+        }
+    }
+}
+
+// A full table whose entries are mostly dead is rebuilt at the same
+// capacity rather than doubled, which also clears its tombstones.
+TEST(WeakHashMap, FullTableOfDeadEntriesIsRebuiltInPlace) {
+    map_type map;
+    auto objects = make_objects(fill_limit());
+    for (const auto& o : objects) {
+        map.try_emplace(o, "x");
+    }
+    const std::size_t capacity = map.capacity();
+    std::vector<std::shared_ptr<object>> erased(objects.end() - 16, objects.end());
+    objects.resize(objects.size() - erased.size());
+    for (const auto& o : erased) {
+        map.erase(o);
+    }
+    ASSERT_GT(map.counts().tombstones, 0u);
+
+    // Inserting into the slots the erasures freed may not need a rebuild;
+    // inserting until the dead entries are gone does.
+    objects.resize(objects.size() / 3);
+    while (map.counts().expired != 0) {
+        objects.push_back(std::make_shared<object>());
+        map.try_emplace(objects.back(), "new");
+    }
+
+    EXPECT_EQ(map.capacity(), capacity);
+    const whm::slot_counts counts = map.counts();
+    EXPECT_EQ(counts.tombstones, 0u);
+    EXPECT_EQ(counts.expired, 0u);
+    EXPECT_EQ(counts.live, objects.size());
+    for (const auto& o : objects) {
+        EXPECT_TRUE(map.contains(o));
+    }
+}
+
+TEST(WeakHashMap, CopiesHoldOnlyLiveEntries) {
+    map_type map;
+    auto objects = make_objects(20);
+    for (const auto& o : objects) {
+        map.try_emplace(o, std::to_string(o->id));
+    }
+    objects.resize(5);
+
+    map_type copy(map);
+    EXPECT_EQ(copy.size(), 5u);
+    for (const auto& o : objects) {
+        ASSERT_TRUE(copy.contains(o));
+        EXPECT_EQ(copy.at(o), std::to_string(o->id));
+    }
+
+    map_type moved(std::move(copy));
+    EXPECT_EQ(moved.size(), 5u);
+    EXPECT_TRUE(copy.empty());
+}
+
+// pointer_hash that counts its calls.
+struct counting_hash : whm::pointer_hash<object> {
+    static inline int calls = 0;
+
+    std::size_t operator()(const object* p) const noexcept {
+        ++calls;
+        return whm::pointer_hash<object>::operator()(p);
+    }
+};
+
+template <class Layout>
+using counting_map = whm::weak_hash_map<object, int, counting_hash, whm::pointer_equal<object>,
+                                        std::allocator<std::pair<const std::weak_ptr<object>, int>>, whm::no_sweep,
+                                        whm::default_resize_policy, whm::collect_stats, Layout>;
+
+// Slots keep their key's address, so growing, rebuilding and purging hash
+// and check entries, dead or alive, without locking a single key.
+TEST(WeakHashMap, RebuildsAndPurgesDoNotLockKeys) {
+    counting_map<whm::slot_layout<>> map;
+    auto objects = make_objects(1000);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+    for (std::size_t i = 0; i < objects.size(); i += 2) {
+        objects[i].reset();
+    }
+    map.rehash(4 * map.capacity());
+    map.reserve(8 * map.capacity());
+    EXPECT_EQ(map.size(), 500u);
+    map.try_emplace(std::make_shared<object>(), 0);
+    EXPECT_EQ(map.purge(), 1u);
+    EXPECT_EQ(map.stats().locks, 0u);
+    for (std::size_t i = 1; i < objects.size(); i += 2) {
+        EXPECT_EQ(map.at(objects[i]), objects[i]->id);
+    }
+}
+
+TEST(WeakHashMap, CachedHashesAreNotRecomputedByRebuilds) {
+    counting_map<whm::slot_layout<whm::slot_key::weak_ptr, true>> cached;
+    counting_map<whm::slot_layout<>> uncached;
+    auto objects = make_objects(1000);
+    for (const auto& o : objects) {
+        cached.try_emplace(o, o->id);
+        uncached.try_emplace(o, o->id);
+    }
+
+    counting_hash::calls = 0;
+    cached.rehash(4 * cached.capacity());
+    EXPECT_EQ(counting_hash::calls, 0);
+    uncached.rehash(4 * uncached.capacity());
+    EXPECT_EQ(counting_hash::calls, 1000);
+    for (const auto& o : objects) {
+        EXPECT_EQ(cached.at(o), o->id);
+    }
+}
+
+struct derived : object {};
+
+// Raw pointers and shared_ptrs, also to a derived class, are looked up by
+// address; only a weak_ptr argument has to be locked.
+TEST(WeakHashMap, LooksUpByPointerWithoutLocking) {
+    counting_map<whm::slot_layout<>> map;
+    auto d = std::make_shared<derived>();
+    const std::shared_ptr<object> base = d;
+    map.try_emplace(base, 7);
+    const derived* p = d.get();
+
+    EXPECT_TRUE(map.contains(p));
+    EXPECT_TRUE(map.contains(d));
+    EXPECT_EQ(map.count(p), 1u);
+    EXPECT_EQ(map.at(d), 7);
+    EXPECT_EQ(map.at(p), 7);
+    ASSERT_NE(map.find(d), map.end());
+    EXPECT_EQ(map.find(p), map.find(base));
+    EXPECT_EQ(map.stats().locks, 0u);
+    EXPECT_EQ(d.use_count(), 2);
+
+    EXPECT_TRUE(map.contains(std::weak_ptr<derived>(d)));
+    EXPECT_EQ(map.stats().locks, 1u);
+    EXPECT_FALSE(map.contains(static_cast<const object*>(nullptr)));
+    EXPECT_EQ(map.erase(p), 1u);
+    EXPECT_FALSE(map.contains(d));
+}
+
+TEST(WeakHashMap, BulkOperationsMatchSingleKeyOperations) {
+    map_type map;
+    auto objects = make_objects(100);
+    std::vector<std::shared_ptr<object>> present(objects.begin(), objects.begin() + 60);
+    EXPECT_EQ(map.insert_many(present, std::string("v")), 60u);
+    EXPECT_EQ(map.insert_many(present, std::string("w")), 0u);
+
+    std::vector<const object*> pointers;
+    for (const auto& o : objects) {
+        pointers.push_back(o.get());
+    }
+    std::vector<map_type::iterator> found(pointers.size());
+    map.find_many(pointers, found);
+    for (std::size_t i = 0; i != pointers.size(); ++i) {
+        EXPECT_EQ(found[i], map.find(pointers[i]));
+        EXPECT_EQ(found[i] != map.end(), i < 60);
+    }
+
+    EXPECT_EQ(map.erase_many(std::span<const object* const>(pointers).subspan(30)), 30u);
+    EXPECT_EQ(map.size(), 30u);
+}
+
+// pointer_hash that drops `victim` at the `countdown`th call, so a key dies
+// while a bulk operation is running.
+struct killing_hash : whm::pointer_hash<object> {
+    static inline std::shared_ptr<object> victim;
+    static inline int countdown = -1;
+
+    std::size_t operator()(const object* p) const noexcept {
+        if (countdown >= 0 && countdown-- == 0) {
+            victim.reset();
+        }
+        return whm::pointer_hash<object>::operator()(p);
+    }
+};
+
+TEST(WeakHashMap, FindManyResultsStayValidWhenKeysDieDuringTheCall) {
+    using swept_map = whm::weak_hash_map<object, int, killing_hash, whm::pointer_equal<object>,
+                                         std::allocator<std::pair<const std::weak_ptr<object>, int>>,
+                                         whm::incremental_sweep<1024>>;
+    swept_map map;
+    auto objects = make_objects(4 * swept_map::bulk_window);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+    killing_hash::victim = std::move(objects.front());
+    std::vector<const object*> pointers{killing_hash::victim.get()};
+    for (std::size_t i = 1; i != objects.size(); ++i) {
+        pointers.push_back(objects[i].get());
+    }
+
+    killing_hash::countdown = static_cast<int>(swept_map::bulk_window);
+    std::vector<swept_map::iterator> found(pointers.size());
+    map.find_many(pointers, found);
+    killing_hash::countdown = -1;
+
+    std::set<const void*> stored;
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        stored.insert(&it->second);
+    }
+    for (std::size_t i = 0; i != found.size(); ++i) {
+        ASSERT_NE(found[i], map.end());
+        EXPECT_EQ(stored.count(&found[i]->second), 1u) << "result " << i << " was swept";
+    }
+}
+
+// Counts its instances, and throws from its copy and move constructors once
+// `countdown` reaches zero.
+struct fragile {
+    static inline int instances = 0;
+    static inline int countdown = -1;
+
+    explicit fragile(int v) : value(v) { ++instances; }
+    fragile(const fragile& other) : value(other.value) {
+        tick();
+        ++instances;
+    }
+    fragile(fragile&& other) : value(other.value) {
+        tick();
+        ++instances;
+    }
+    ~fragile() { --instances; }
+
+    static void tick() {
+        if (countdown >= 0 && countdown-- == 0) {
+            throw std::runtime_error("fragile");
+        }
+    }
+
+    int value;
+};
+
+// Copyable, so a rebuild copies and an exception undoes it.
+TEST(WeakHashMap, ThrowingRebuildLeavesTheTableUnchanged) {
+    whm::weak_hash_map<object, fragile> map;
+    auto objects = make_objects(200);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+    const std::size_t capacity = map.capacity();
+    objects.resize(150);
+
+    fragile::countdown = 100;
+    EXPECT_THROW(map.rehash(capacity * 4), std::runtime_error);
+    fragile::countdown = -1;
+
+    EXPECT_EQ(map.capacity(), capacity);
+    EXPECT_EQ(map.size(), 200u);
+    EXPECT_EQ(fragile::instances, 200);
+    for (const auto& o : objects) {
+        ASSERT_TRUE(map.contains(o));
+        EXPECT_EQ(map.at(o).value, o->id);
+    }
+
+    map.rehash(capacity * 4);
+    EXPECT_EQ(map.size(), 150u);
+    EXPECT_EQ(fragile::instances, 150);
+    map.clear();
+    EXPECT_EQ(fragile::instances, 0);
+}
+
+struct fragile_move_only : fragile {
+    using fragile::fragile;
+    fragile_move_only(fragile_move_only&&) = default;
+};
+
+// Neither copyable nor nothrow movable: an exception loses the entries not
+// yet moved, and the table stays consistent with what is left.
+TEST(WeakHashMap, ThrowingMoveOnlyRebuildKeepsAConsistentTable) {
+    whm::weak_hash_map<object, fragile_move_only> map;
+    auto objects = make_objects(200);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+
+    fragile::countdown = 100;
+    EXPECT_THROW(map.rehash(map.capacity() * 4), std::runtime_error);
+    fragile::countdown = -1;
+
+    EXPECT_EQ(map.size(), 100u);
+    EXPECT_EQ(fragile::instances, 100);
+    std::size_t found = 0;
+    for (const auto& o : objects) {
+        if (map.contains(o)) {
+            EXPECT_EQ(map.at(o).value, o->id);
+            ++found;
+        }
+    }
+    EXPECT_EQ(found, map.size());
+    map.clear();
+    EXPECT_EQ(fragile::instances, 0);
+}
+
+TEST(WeakHashMap, FindOrComputeCallsTheFactoryOnlyOnAMiss) {
+    map_type map;
+    auto a = std::make_shared<object>(object{1});
+    int calls = 0;
+    auto factory = [&](const std::shared_ptr<object>& key) {
+        ++calls;
+        return std::to_string(key->id);
+    };
+
+    auto entry = map.find_or_compute(a, factory);
+    ASSERT_TRUE(entry);
+    EXPECT_TRUE(entry.inserted);
+    EXPECT_EQ(entry.key, a);
+    EXPECT_EQ(*entry.value, "1");
+
+    auto again = map.find_or_compute(std::weak_ptr<object>(a), [&] {
+        ++calls;
+        return std::string("unused");
+    });
+    EXPECT_FALSE(again.inserted);
+    EXPECT_EQ(again.value, entry.value);
+    EXPECT_EQ(calls, 1);
+}
+
+TEST(WeakHashMap, FindOrComputeIgnoresExpiredKeys) {
+    map_type map;
+    std::weak_ptr<object> dead = std::make_shared<object>();
+    bool called = false;
+    auto entry = map.find_or_compute(dead, [&] {
+        called = true;
+        return std::string("x");
+    });
+    EXPECT_FALSE(entry);
+    EXPECT_EQ(entry.key, nullptr);
+    EXPECT_FALSE(called);
+    EXPECT_TRUE(map.empty());
+}
+
+TEST(WeakHashMap, ThrowingFactoryLeavesTheMapUnchanged) {
+    map_type map;
+    auto a = std::make_shared<object>();
+    auto b = std::make_shared<object>();
+    map.try_emplace(a, "a");
+    EXPECT_THROW(map.find_or_compute(b, []() -> std::string { throw std::runtime_error("factory"); }),
+                 std::runtime_error);
+    EXPECT_EQ(map.size(), 1u);
+    EXPECT_FALSE(map.contains(b));
+    EXPECT_TRUE(map.find_or_compute(b, [] { return std::string("b"); }).inserted);
+}
+
+// A value type that any argument converts to: the computed value must be
+// the factory's result, not an object standing for the call.
+TEST(WeakHashMap, FindOrComputeWithGreedyValueTypes) {
+    whm::weak_hash_map<object, std::any> map;
+    auto a = std::make_shared<object>();
+    auto b = std::make_shared<object>();
+    auto entry = map.find_or_compute(a, [] { return 42; });
+    ASSERT_TRUE(entry);
+    EXPECT_EQ(std::any_cast<int>(*entry.value), 42);
+
+    entry = map.find_or_compute(b, [] { return std::any(std::string("b")); });
+    EXPECT_EQ(std::any_cast<std::string>(*entry.value), "b");
+}
+
+// Counts the copies and moves made of it.
+struct counted {
+    static inline int transfers = 0;
+
+    explicit counted(int v) : value(v) {}
+    counted(const counted& other) : value(other.value) { ++transfers; }
+    counted(counted&& other) noexcept : value(other.value) { ++transfers; }
+
+    int value;
+};
+
+TEST(WeakHashMap, FindOrComputeBuildsTheValueInItsSlot) {
+    whm::weak_hash_map<object, counted> map;
+    map.reserve(16);
+    auto a = std::make_shared<object>(object{7});
+    counted::transfers = 0;
+    auto entry = map.find_or_compute(a, [](const std::shared_ptr<object>& key) { return counted(key->id); });
+    EXPECT_EQ(entry.value->value, 7);
+    EXPECT_EQ(counted::transfers, 0);
+}
+
+TEST(WeakHashMap, EraseDuringIteration) {
+    map_type map;
+    auto objects = make_objects(50);
+    for (const auto& o : objects) {
+        map.try_emplace(o, "x");
+    }
+    for (auto it = map.begin(); it != map.end();) {
+        it = map.erase(it);
+    }
+    EXPECT_TRUE(map.empty());
+}
+
+// Refuses every other task by throwing; parallel_for then runs the task on
+// the calling thread.
+struct refusing_executor {
+    template <class F>
+    void operator()(F&& task) {
+        if (offered++ % 2 == 1) {
+            throw std::runtime_error("queue full");
+        }
+        task();
+    }
+
+    int offered = 0;
+};
+
+// Large tables purge in blocks, one task per block of slots.
+TEST(WeakHashMap, PurgeWithAnExecutorThatRefusesTasks) {
+    whm::weak_hash_map<object, int> map;
+    auto objects = make_objects(100000);
+    for (const auto& o : objects) {
+        map.try_emplace(o, o->id);
+    }
+    for (std::size_t i = 0; i < objects.size(); i += 2) {
+        objects[i].reset();
+    }
+    refusing_executor ex;
+    EXPECT_EQ(map.purge(ex), 50000u);
+    EXPECT_GT(ex.offered, 1);
+    EXPECT_EQ(map.size(), 50000u);
+    for (std::size_t i = 1; i < objects.size(); i += 2) {
+        EXPECT_EQ(map.at(objects[i]), objects[i]->id);
+    }
+
+    refusing_executor rehash_ex;
+    map.rehash(4 * map.capacity(), rehash_ex);
+    EXPECT_EQ(map.size(), 50000u);
+}
+
+static_assert(std::forward_iterator<map_type::live_iterator>);
+
+TEST(WeakHashMap, LiveViewSkipsExpiredEntriesWithoutErasingThem) {
+    map_type map;
+    auto objects = make_objects(100);
+    for (const auto& o : objects) {
+        map.try_emplace(o, std::to_string(o->id));
+    }
+    for (std::size_t i = 0; i < objects.size(); i += 2) {
+        objects[i].reset();
+    }
+
+    std::set<int> seen;
+    for (auto [key, value] : map.live_view()) {
+        ASSERT_NE(key, nullptr);
+        EXPECT_EQ(value, std::to_string(key->id));
+        EXPECT_TRUE(seen.insert(key->id).second);
+        value += "!";
+    }
+    EXPECT_EQ(seen.size(), 50u);
+    for (int id : seen) {
+        EXPECT_EQ(id % 2, 1);
+    }
+    EXPECT_EQ(map.size(), 100u);
+    EXPECT_EQ(map.counts().expired, 50u);
+
+    const map_type& view = map;
+    std::size_t visited = 0;
+    for (const auto& entry : view.live_view()) {
+        EXPECT_EQ(entry.second, std::to_string(entry.first->id) + "!");
+        ++visited;
+    }
+    EXPECT_EQ(visited, 50u);
+    EXPECT_EQ(map.counts().expired, 50u);
+}
+
+// Every key hashes alike, so the probe sequence has no empty slot for
+// erasures to leave behind: they all leave tombstones.
+struct same_hash {
+    std::size_t operator()(const object*) const noexcept { return 0; }
+};
+
+// Erased entries leave tombstones, and expired ones stay in place; neither
+// is visited, and no live entry is visited twice.
+TEST(WeakHashMap, ForEachLiveVisitsEachLiveEntryOnce) {
+    whm::weak_hash_map<object, std::string, same_hash> map;
+    auto objects = make_objects(300);
+    for (const auto& o : objects) {
+        map.try_emplace(o, "x");
+    }
+    for (std::size_t i = 0; i != objects.size(); i += 3) {
+        map.erase(objects[i]);
+        objects[i + 1].reset();
+    }
+    ASSERT_EQ(map.counts().tombstones, 100u);
+
+    std::vector<int> visits(objects.size());
+    map.for_each_live([&](const std::weak_ptr<object>& key, std::string& value) {
+        ++visits[static_cast<std::size_t>(key.lock()->id)];
+        value = "visited";
+    });
+    std::as_const(map).for_each_live([&](const std::weak_ptr<object>&, const std::string& value) {
+        EXPECT_EQ(value, "visited");
+    });
+    for (std::size_t i = 0; i != objects.size(); ++i) {
+        EXPECT_EQ(visits[i], i % 3 == 2 ? 1 : 0) << i;
+    }
+    EXPECT_EQ(map.counts().expired, 100u);
+}
+
+}  // namespace
@@ -0,0 +1,140 @@
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/policy.hpp>
+#include <whm/weak_hash_map.hpp>
+#include <whm/weak_trackable.hpp>
+
+namespace {
+
+struct entity : whm::weak_trackable {
+    explicit entity(int i = 0) : id(i) {}
+    int id;
+};
+
+// The same key type held through std::weak_ptr, for comparison.
+template <class V>
+using weak_ptr_map = whm::weak_hash_map<entity, V, whm::pointer_hash<entity>, whm::pointer_equal<entity>,
+                                        std::allocator<std::pair<const std::weak_ptr<entity>, V>>, whm::no_sweep,
+                                        whm::default_resize_policy, whm::no_stats,
+                                        whm::slot_layout<whm::slot_key::weak_ptr>>;
+
+static_assert(std::is_same_v<whm::weak_hash_map<entity, int>::key_type, whm::weak_ref<entity>>);
+static_assert(std::is_same_v<weak_ptr_map<int>::key_type, std::weak_ptr<entity>>);
+static_assert(sizeof(whm::weak_ref<entity>) == 2 * sizeof(void*));
+
+TEST(WeakRef, ExpiresWithItsObject) {
+    whm::weak_ref<entity> empty;
+    EXPECT_TRUE(empty.expired());
+    EXPECT_EQ(empty.get(), nullptr);
+
+    std::optional<entity> e(std::in_place, 7);
+    whm::weak_ref<entity> ref(&*e);
+    whm::weak_ref<entity> copy = ref;
+    EXPECT_EQ(ref.get(), &*e);
+    EXPECT_TRUE(copy.refers_to(&*e));
+
+    const entity* address = &*e;
+    e.reset();
+    EXPECT_TRUE(ref.expired());
+    EXPECT_TRUE(copy.expired());
+    EXPECT_EQ(ref.get(), nullptr);
+    EXPECT_EQ(ref.address(), address);
+
+    whm::weak_ref<entity> moved = std::move(copy);
+    EXPECT_TRUE(moved.expired());
+    EXPECT_EQ(copy.address(), nullptr);
+}
+
+// A copied object is a different object: references to the original do not
+// refer to the copy, and the copy stays alive when the original dies.
+TEST(WeakRef, CopiesHaveReferencesOfTheirOwn) {
+    auto original = std::make_unique<entity>(1);
+    whm::weak_ref<entity> ref(original.get());
+    auto copy = std::make_unique<entity>(*original);
+    EXPECT_TRUE(ref.refers_to(original.get()));
+    EXPECT_FALSE(ref.refers_to(copy.get()));
+
+    whm::weak_ref<entity> copy_ref(copy.get());
+    original.reset();
+    EXPECT_TRUE(ref.expired());
+    EXPECT_FALSE(copy_ref.expired());
+}
+
+TEST(TrackableKeys, SlotsAreSmallerThanWeakPtrSlots) {
+    whm::weak_hash_map<entity, int> compact;
+    weak_ptr_map<int> wide;
+    std::vector<std::shared_ptr<entity>> keys;
+    for (int i = 0; i != 100; ++i) {
+        keys.push_back(std::make_shared<entity>(i));
+        compact.try_emplace(keys.back(), i);
+        wide.try_emplace(keys.back(), i);
+    }
+    const std::size_t compact_slot = compact.memory_usage().live / compact.size();
+    const std::size_t wide_slot = wide.memory_usage().live / wide.size();
+    EXPECT_LE(compact_slot, 3 * sizeof(void*));
+    EXPECT_LT(compact_slot, wide_slot);
+    for (const auto& k : keys) {
+        EXPECT_EQ(compact.at(k), wide.at(k));
+    }
+}
+
+// Keys can be owned any way at all and inserted by pointer.
+TEST(TrackableKeys, InsertedByPointerWhateverOwnsThem) {
+    whm::weak_hash_map<entity, std::string> map;
+    auto owned = std::make_unique<entity>(1);
+    entity local(2);
+    auto shared = std::make_shared<entity>(3);
+
+    EXPECT_TRUE(map.try_emplace(owned.get(), "owned").second);
+    EXPECT_TRUE(map.insert(&local, "local").second);
+    EXPECT_TRUE(map.try_emplace(shared.get(), "shared").second);
+    EXPECT_FALSE(map.try_emplace(shared, "again").second);
+    map[owned.get()] += "!";
+
+    EXPECT_EQ(map.at(owned.get()), "owned!");
+    EXPECT_EQ(map.at(shared), "shared");
+    EXPECT_EQ(*map.find_unpinned(&local), "local");
+    EXPECT_TRUE(map.contains_live(owned.get()));
+
+    owned.reset();
+    EXPECT_EQ(map.counts().expired, 1u);
+    EXPECT_EQ(map.purge(), 1u);
+    EXPECT_EQ(map.size(), 2u);
+    EXPECT_EQ(map.erase(&local), 1u);
+    EXPECT_EQ(map.erase(shared.get()), 1u);
+    EXPECT_TRUE(map.empty());
+}
+
+// The map's references keep the liveness cells allocated after their keys
+// die, so a rebuild can still tell the dead entries apart.
+TEST(TrackableKeys, RebuildsDropDeadKeys) {
+    whm::weak_hash_map<entity, int> map;
+    std::vector<std::unique_ptr<entity>> keys;
+    for (int i = 0; i != 1000; ++i) {
+        keys.push_back(std::make_unique<entity>(i));
+        map.try_emplace(keys.back().get(), i);
+    }
+    keys.resize(300);
+    map.rehash(0);
+    EXPECT_EQ(map.size(), 300u);
+    for (const auto& k : keys) {
+        EXPECT_EQ(map.at(k.get()), k->id);
+    }
+    std::size_t visited = 0;
+    for (const auto& [key, value] : map) {
+        EXPECT_FALSE(key.expired());
+        EXPECT_EQ(key.get()->id, value);
+        ++visited;
+    }
+    EXPECT_EQ(visited, 300u);
+}
+
+}  // namespace
@@ -0,0 +1,219 @@
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <whm/policy.hpp>
+#include <whm/weak_hash_map.hpp>
+#include <whm/weak_value_hash_map.hpp>
+
+namespace {
+
+struct asset {
+    int id = 0;
+};
+
+using cache_type = whm::weak_value_hash_map<std::string, asset>;
+
+template <class Resize>
+using shrinking_cache = whm::weak_value_hash_map<std::string, asset, std::hash<std::string>,
+                                                 std::equal_to<std::string>,
+                                                 std::allocator<std::pair<const std::string, std::weak_ptr<asset>>>,
+                                                 whm::no_sweep, Resize>;
+
+template <class Resize>
+using shrinking_map = whm::weak_hash_map<asset, int, whm::pointer_hash<asset>, whm::pointer_equal<asset>,
+                                         std::allocator<std::pair<const std::weak_ptr<asset>, int>>, whm::no_sweep,
+                                         Resize>;
+
+std::vector<std::shared_ptr<asset>> make_assets(std::size_t n) {
+    std::vector<std::shared_ptr<asset>> assets;
+    for (std::size_t i = 0; i != n; ++i) {
+        assets.push_back(std::make_shared<asset>(asset{static_cast<int>(i)}));
+    }
+    return assets;
+}
+
+TEST(WeakValueHashMap, InsertFindErase) {
+    cache_type cache;
+    auto a = std::make_shared<asset>(asset{1});
+    auto b = std::make_shared<asset>(asset{2});
+
+    EXPECT_TRUE(cache.try_emplace("a", a).second);
+    auto [current, inserted] = cache.try_emplace("a", b);
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(current, a);
+    EXPECT_FALSE(cache.insert_or_assign("a", b));
+    EXPECT_EQ(cache.find("a"), b);
+    EXPECT_TRUE(cache.contains("a"));
+
+    EXPECT_EQ(cache.erase("a"), 1u);
+    EXPECT_EQ(cache.erase("a"), 0u);
+    EXPECT_EQ(cache.find("a"), nullptr);
+}
+
+TEST(WeakValueHashMap, ExpiredValuesAreNotFoundAndPurged) {
+    cache_type cache;
+    auto assets = make_assets(100);
+    for (const auto& a : assets) {
+        cache.try_emplace(std::to_string(a->id), a);
+    }
+    for (std::size_t i = 0; i < assets.size(); i += 2) {
+        assets[i].reset();
+    }
+    EXPECT_FALSE(cache.contains("0"));
+    EXPECT_EQ(cache.size(), 100u);
+    EXPECT_EQ(cache.purge(), 50u);
+    EXPECT_EQ(cache.size(), 50u);
+    for (std::size_t i = 1; i < assets.size(); i += 2) {
+        EXPECT_EQ(cache.find(std::to_string(i)), assets[i]);
+    }
+
+    // An expired entry is reused by the next insertion under its key.
+    auto replacement = std::make_shared<asset>(asset{-1});
+    assets[1].reset();
+    EXPECT_TRUE(cache.try_emplace("1", replacement).second);
+    EXPECT_EQ(cache.size(), 50u);
+    EXPECT_EQ(cache.find("1"), replacement);
+}
+
+TEST(WeakValueHashMap, FindReclaimsAnExpiredEntry) {
+    cache_type cache;
+    auto a = std::make_shared<asset>(asset{1});
+    cache.try_emplace("a", a);
+    a.reset();
+
+    const cache_type& view = cache;
+    EXPECT_EQ(view.find("a"), nullptr);
+    EXPECT_EQ(cache.size(), 1u);
+    std::size_t expired = 0;
+    for (const auto& [key, value] : cache) {
+        EXPECT_EQ(key, "a");
+        expired += value.expired() ? 1 : 0;
+    }
+    EXPECT_EQ(expired, 1u);
+
+    EXPECT_EQ(cache.find("a"), nullptr);
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+// Lookups by std::string_view, without building a std::string.
+struct string_hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+};
+
+TEST(WeakValueHashMap, TransparentLookup) {
+    whm::weak_value_hash_map<std::string, asset, string_hash, std::equal_to<>> cache;
+    auto a = std::make_shared<asset>(asset{1});
+    cache.try_emplace("textures/a.png", a);
+    const std::string_view path = "textures/a.png";
+    EXPECT_EQ(cache.find(path), a);
+    EXPECT_TRUE(cache.contains(path));
+    EXPECT_FALSE(cache.contains(std::string_view("textures/b.png")));
+    EXPECT_EQ(cache.erase(path), 1u);
+    EXPECT_TRUE(cache.empty());
+}
+
+// The sweep policies shared with weak_hash_map reclaim dead values as the
+// map is used.
+TEST(WeakValueHashMap, IncrementalSweepReclaimsDeadValues) {
+    whm::weak_value_hash_map<int, asset, std::hash<int>, std::equal_to<int>,
+                             std::allocator<std::pair<const int, std::weak_ptr<asset>>>, whm::incremental_sweep<16>>
+        cache;
+    auto assets = make_assets(100);
+    for (const auto& a : assets) {
+        cache.try_emplace(a->id, a);
+    }
+    assets.resize(50);
+    for (std::size_t i = 0; i != cache.capacity(); ++i) {
+        cache.find(0);
+    }
+    EXPECT_EQ(cache.size(), 50u);
+    for (const auto& a : assets) {
+        EXPECT_EQ(cache.find(a->id), a);
+    }
+}
+
+TEST(WeakValueHashMap, ShrinksWhenPurgeLeavesItSparse) {
+    shrinking_cache<whm::shrink_on_sparse<>> cache;
+    auto assets = make_assets(10000);
+    for (const auto& a : assets) {
+        cache.try_emplace(std::to_string(a->id), a);
+    }
+    const std::size_t capacity = cache.capacity();
+    assets.resize(10);
+    EXPECT_EQ(cache.purge(), 9990u);
+    EXPECT_LT(cache.capacity(), capacity / 64);
+    for (const auto& a : assets) {
+        EXPECT_EQ(cache.find(std::to_string(a->id)), a);
+    }
+}
+
+TEST(WeakValueHashMap, ShrinksWhenEraseLeavesItSparse) {
+    shrinking_cache<whm::shrink_on_sparse<>> cache;
+    auto assets = make_assets(1000);
+    for (const auto& a : assets) {
+        cache.try_emplace(std::to_string(a->id), a);
+    }
+    const std::size_t capacity = cache.capacity();
+    for (std::size_t i = 10; i != assets.size(); ++i) {
+        cache.erase(std::to_string(i));
+    }
+    EXPECT_LT(cache.capacity(), capacity);
+    EXPECT_EQ(cache.size(), 10u);
+}
+
+TEST(WeakValueHashMap, DefaultPolicyKeepsItsCapacity) {
+    cache_type cache;
+    auto assets = make_assets(1000);
+    for (const auto& a : assets) {
+        cache.try_emplace(std::to_string(a->id), a);
+    }
+    const std::size_t capacity = cache.capacity();
+    assets.resize(10);
+    cache.purge();
+    EXPECT_EQ(cache.capacity(), capacity);
+
+    cache.shrink_to_fit();
+    EXPECT_LT(cache.capacity(), capacity);
+    EXPECT_EQ(cache.size(), 10u);
+    assets.clear();
+    cache.shrink_to_fit();
+    EXPECT_EQ(cache.capacity(), 0u);
+}
+
+// weak_hash_map under the same policies, for comparison.
+TEST(WeakHashMapShrink, ShrinksWhenPurgeLeavesItSparse) {
+    shrinking_map<whm::shrink_on_sparse<>> map;
+    auto assets = make_assets(10000);
+    for (const auto& a : assets) {
+        map.try_emplace(a, a->id);
+    }
+    const std::size_t capacity = map.capacity();
+    assets.resize(10);
+    EXPECT_EQ(map.purge(), 9990u);
+    EXPECT_LT(map.capacity(), capacity / 64);
+    for (const auto& a : assets) {
+        EXPECT_EQ(map.at(a), a->id);
+    }
+}
+
+TEST(WeakHashMapShrink, DefaultPolicyKeepsItsCapacity) {
+    shrinking_map<whm::default_resize_policy> map;
+    auto assets = make_assets(1000);
+    for (const auto& a : assets) {
+        map.try_emplace(a, a->id);
+    }
+    const std::size_t capacity = map.capacity();
+    assets.resize(10);
+    map.purge();
+    EXPECT_EQ(map.capacity(), capacity);
+    map.shrink_to_fit();
+    EXPECT_LT(map.capacity(), capacity);
+}
+
+}  // namespace